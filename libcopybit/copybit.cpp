@@ -421,7 +421,7 @@ static int stretch_copybit(
 {
     struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
     int status = 0;
-    private_handle_t *yv12_handle = NULL;
+    private_handle_t *conv_handle = NULL;
     if (ctx) {
         struct {
             uint32_t count;
@@ -461,20 +461,20 @@ static int stretch_copybit(
         if(src->format ==  HAL_PIXEL_FORMAT_YV12) {
             int usage =
             GRALLOC_USAGE_PRIVATE_CAMERA_HEAP|GRALLOC_USAGE_PRIVATE_UNCACHED;
-            if (0 == alloc_buffer(&yv12_handle,src->w,src->h,
+            if (0 == alloc_buffer(&conv_handle,src->w,src->h,
                                   src->format, usage)){
-                if(0 == convertYV12toYCrCb420SP(src,yv12_handle)){
+                if(0 == convertYV12toYCrCb420SP(src,conv_handle)){
                     (const_cast<copybit_image_t *>(src))->format =
                         HAL_PIXEL_FORMAT_YCrCb_420_SP;
                     (const_cast<copybit_image_t *>(src))->handle =
-                        yv12_handle;
+                        conv_handle;
                     (const_cast<copybit_image_t *>(src))->base =
-                        (void *)yv12_handle->base;
+                        (void *)conv_handle->base;
                 }
                 else{
                     ALOGE("Error copybit conversion from yv12 failed");
-                    if(yv12_handle)
-                        free_buffer(yv12_handle);
+                    if(conv_handle)
+                        free_buffer(conv_handle);
                     return -EINVAL;
                 }
             }
@@ -483,6 +483,31 @@ static int stretch_copybit(
                 return -EINVAL;
             }
         }
+        if(src->format == HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED) {
+            // MDP cannot fetch the macro-tiled layout, detile it first
+            int usage =
+            GRALLOC_USAGE_PRIVATE_CAMERA_HEAP|GRALLOC_USAGE_PRIVATE_UNCACHED;
+            if (0 == alloc_buffer(&conv_handle,src->w,src->h,
+                                  HAL_PIXEL_FORMAT_YCbCr_420_SP, usage)){
+                if(0 == convertNV12TiletoYCbCr420SP(src,conv_handle)){
+                    (const_cast<copybit_image_t *>(src))->format =
+                        HAL_PIXEL_FORMAT_YCbCr_420_SP;
+                    (const_cast<copybit_image_t *>(src))->handle =
+                        conv_handle;
+                    (const_cast<copybit_image_t *>(src))->base =
+                        (void *)conv_handle->base;
+                }
+                else{
+                    ALOGE("Error copybit conversion from nv12 tile failed");
+                    free_buffer(conv_handle);
+                    return -EINVAL;
+                }
+            }
+            else{
+                ALOGE("Error:unable to allocate memory for nv12 tile conversion");
+                return -EINVAL;
+            }
+        }
         const uint32_t maxCount = sizeof(list.req)/sizeof(list.req[0]);
         const struct copybit_rect_t bounds = {0, 0, (int)dst->w, (int)dst->h};
         struct copybit_rect_t clip;
@@ -521,8 +546,8 @@ static int stretch_copybit(
         ALOGE ("%s : Invalid COPYBIT context", __FUNCTION__);
         status = -EINVAL;
     }
-    if(yv12_handle)
-        free_buffer(yv12_handle);
+    if(conv_handle)
+        free_buffer(conv_handle);
     return status;
 }
 
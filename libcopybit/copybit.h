@@ -275,6 +275,21 @@ struct copybit_device_t {
    */
   int (*clear)(struct copybit_device_t *dev, struct copybit_image_t const *buf,
                struct copybit_rect_t *rect);
+
+  /**
+    * Hands over the acquire fence of the source used by the next
+    * blit/stretch. The implementation owns the fd and makes sure it has
+    * signaled before the draw is submitted, so that callers do not have to
+    * wait on it themselves. May be NULL if the implementation cannot defer
+    * the wait.
+    *
+    * @param dev from open
+    *
+    * @param acquireFenceFd - fence fd of the source buffer, or -1
+    *
+    * @return 0 if successful
+    */
+  int (*set_sync)(struct copybit_device_t *dev, int acquireFenceFd);
 };
 
 
@@ -18,12 +18,15 @@
  * limitations under the License.
  */
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include <sys/resource.h>
 #include <sys/prctl.h>
 
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
 #include <errno.h>
 #include <fcntl.h>
 
@@ -38,6 +41,7 @@
 #include <cutils/ashmem.h>
 #include <linux/ashmem.h>
 #include <gralloc_priv.h>
+#include <format_info.h>
 
 #include <copybit.h>
 #include <alloc_controller.h>
@@ -47,6 +51,7 @@
 #include "software_converter.h"
 
 #include <dlfcn.h>
+#include <sync/sync.h>
 
 using gralloc::IMemAlloc;
 using gralloc::IonController;
@@ -103,15 +108,14 @@ C2D_STATUS (*LINK_c2dFillSurface) ( uint32 surface_id, uint32 fill_color,
 #error "Unsupported HW version"
 #endif
 
-// The following defines can be changed as required i.e. as we encounter
-// complex use cases.
-#define MAX_RGB_SURFACES 32       // Max. RGB layers currently supported per draw
-#define MAX_YUV_2_PLANE_SURFACES 4// Max. 2-plane YUV layers currently supported per draw
-#define MAX_YUV_3_PLANE_SURFACES 1// Max. 3-plane YUV layers currently supported per draw
-// +1 for the destination surface. We cannot have multiple destination surfaces.
-#define MAX_SURFACES (MAX_RGB_SURFACES + MAX_YUV_2_PLANE_SURFACES + MAX_YUV_3_PLANE_SURFACES + 1)
+// Initial sizes of the source surface pools and of the blit list. The pools
+// and the list grow on demand, so these only need to cover the common case.
+#define INIT_RGB_SURFACES 32        // RGB source surfaces created at open
+#define INIT_YUV_2_PLANE_SURFACES 4 // 2-plane YUV source surfaces created at open
+#define INIT_YUV_3_PLANE_SURFACES 1 // 3-plane YUV source surfaces created at open
+#define INIT_BLIT_OBJECT_COUNT 64   // Blit objects reserved for a draw
 #define NUM_SURFACE_TYPES 3      // RGB_SURFACE + YUV_SURFACE_2_PLANES + YUV_SURFACE_3_PLANES
-#define MAX_BLIT_OBJECT_COUNT 50 // Max. blit objects that can be passed per draw
+#define SURFACE_POOL_GROW_STEP 8 // Surfaces added to a pool when it runs dry
 
 enum {
     RGB_SURFACE,
@@ -133,24 +137,29 @@ enum eC2DFlags {
 static gralloc::IAllocController* sAlloc = 0;
 /******************************************************************************/
 
+/** Pool of C2D source surface templates of one surface type */
+struct surface_pool {
+    C2D_OBJECT_STR *objects;
+    int count;                  // Templates used by the pending draw
+    int size;                   // Templates created
+};
+
 /** State information for each device instance */
 struct copybit_context_t {
     struct copybit_device_t device;
-    // Templates for the various source surfaces. These templates are created
-    // to avoid the expensive create/destroy C2D Surfaces
-    C2D_OBJECT_STR blit_rgb_object[MAX_RGB_SURFACES];
-    C2D_OBJECT_STR blit_yuv_2_plane_object[MAX_YUV_2_PLANE_SURFACES];
-    C2D_OBJECT_STR blit_yuv_3_plane_object[MAX_YUV_3_PLANE_SURFACES];
-    C2D_OBJECT_STR blit_list[MAX_BLIT_OBJECT_COUNT]; // Z-ordered list of blit objects
+    // Templates for the various source surfaces, indexed by surface type.
+    // These templates are created to avoid the expensive create/destroy of
+    // C2D Surfaces and are kept for the lifetime of the device.
+    surface_pool src_pool[NUM_SURFACE_TYPES];
+    C2D_OBJECT_STR *blit_list;  // Z-ordered list of blit objects
+    int blit_list_size;         // Allocated entries in blit_list
     C2D_DRIVER_INFO c2d_driver_info;
     void *libc2d2;
     alloc_data temp_src_buffer;
     alloc_data temp_dst_buffer;
     unsigned int dst[NUM_SURFACE_TYPES]; // dst surfaces
-    unsigned int mapped_gpu_addr[MAX_SURFACES]; // GPU addresses mapped inside copybit
-    int blit_rgb_count;         // Total RGB surfaces being blit
-    int blit_yuv_2_plane_count; // Total 2 plane YUV surfaces being
-    int blit_yuv_3_plane_count; // Total 3 plane YUV  surfaces being blit
+    unsigned int *mapped_gpu_addr; // GPU addresses mapped inside copybit
+    int mapped_gpu_addr_size;   // One slot per pooled surface + destination
     int blit_count;             // Total blit objects.
     unsigned int trg_transform;      /* target transform */
     int fb_width;
@@ -162,6 +171,13 @@ struct copybit_context_t {
     void* time_stamp;
     bool dst_surface_mapped; // Set when dst surface is mapped to GPU addr
     void* dst_surface_base; // Stores the dst surface addr
+    int acq_fence_fd; // Merged acquire fence of the pending blit objects
+
+    // Per frame statistics, logged when debug.copybit.stats is set
+    bool stats_enabled;
+    int frame_draw_calls;       // c2dDraw calls since the last flush
+    int frame_blit_objects;     // Blit objects submitted since the last flush
+    int64_t frame_cpu_time_ns;  // Thread CPU time spent queueing blits
 
     // used for signaling the wait thread
     bool wait_timestamp;
@@ -213,6 +229,24 @@ tag: HARDWARE_MODULE_TAG,
 };
 
 
+/* Unmap the addresses mapped for the last draw and release the surface
+ * templates and blit objects it used. Called with wait_cleanup_lock held.
+ */
+static void reset_batch(copybit_context_t* ctx)
+{
+    for (int i = 0; i < ctx->mapped_gpu_addr_size; i++) {
+        if (ctx->mapped_gpu_addr[i]) {
+            LINK_c2dUnMapAddr( (void*)ctx->mapped_gpu_addr[i]);
+            ctx->mapped_gpu_addr[i] = 0;
+        }
+    }
+    for (int i = 0; i < NUM_SURFACE_TYPES; i++)
+        ctx->src_pool[i].count = 0;
+    ctx->blit_count = 0;
+    ctx->dst_surface_mapped = false;
+    ctx->dst_surface_base = 0;
+}
+
 /* thread function which waits on the timeStamp and cleans up the surfaces */
 static void* c2d_wait_loop(void* ptr) {
     copybit_context_t* ctx = (copybit_context_t*)(ptr);
@@ -231,20 +265,7 @@ static void* c2d_wait_loop(void* ptr) {
                 ALOGE("%s: LINK_c2dWaitTimeStamp ERROR!!", __FUNCTION__);
             }
             ctx->wait_timestamp = false;
-            // Unmap any mapped addresses.
-            for (int i = 0; i < MAX_SURFACES; i++) {
-                if (ctx->mapped_gpu_addr[i]) {
-                    LINK_c2dUnMapAddr( (void*)ctx->mapped_gpu_addr[i]);
-                    ctx->mapped_gpu_addr[i] = 0;
-                }
-            }
-            // Reset the counts after the draw.
-            ctx->blit_rgb_count = 0;
-            ctx->blit_yuv_2_plane_count = 0;
-            ctx->blit_yuv_3_plane_count = 0;
-            ctx->blit_count = 0;
-            ctx->dst_surface_mapped = false;
-            ctx->dst_surface_base = 0;
+            reset_batch(ctx);
         }
         pthread_mutex_unlock(&ctx->wait_cleanup_lock);
         if(ctx->stop_thread)
@@ -255,26 +276,27 @@ static void* c2d_wait_loop(void* ptr) {
 }
 
 
+/* C2D format of a HAL format, -1 when C2D can't read it */
+static int lookup_c2d_format(int format) {
+#define C2D_FORMAT_CASE(fmt, name, bpp, planes, hsub, vsub, chroma,       \
+                        align, flags, mdp, c2d)                           \
+        case fmt: return c2d;
+    switch (format) {
+        GRALLOC_FORMAT_TABLE(C2D_FORMAT_CASE)
+        default: break;
+    }
+#undef C2D_FORMAT_CASE
+    return -1;
+}
+
 /* convert COPYBIT_FORMAT to C2D format */
 static int get_format(int format) {
-    switch (format) {
-        case HAL_PIXEL_FORMAT_RGB_565:        return C2D_COLOR_FORMAT_565_RGB;
-        case HAL_PIXEL_FORMAT_RGBX_8888:      return C2D_COLOR_FORMAT_8888_ARGB |
-                                              C2D_FORMAT_SWAP_RB |
-                                                  C2D_FORMAT_DISABLE_ALPHA;
-        case HAL_PIXEL_FORMAT_RGBA_8888:      return C2D_COLOR_FORMAT_8888_ARGB |
-                                              C2D_FORMAT_SWAP_RB;
-        case HAL_PIXEL_FORMAT_BGRA_8888:      return C2D_COLOR_FORMAT_8888_ARGB;
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP:   return C2D_COLOR_FORMAT_420_NV12;
-        case HAL_PIXEL_FORMAT_NV12_ENCODEABLE:return C2D_COLOR_FORMAT_420_NV12;
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP:   return C2D_COLOR_FORMAT_420_NV21;
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED: return C2D_COLOR_FORMAT_420_NV12 |
-                                                  C2D_FORMAT_MACROTILED;
-        default:                              ALOGE("%s: invalid format (0x%x",
-                                                     __FUNCTION__, format);
-                                              return -EINVAL;
+    int c2dFormat = lookup_c2d_format(format);
+    if (c2dFormat == -1) {
+        ALOGE("%s: invalid format (0x%x", __FUNCTION__, format);
+        return -EINVAL;
     }
-    return -EINVAL;
+    return c2dFormat;
 }
 
 /* Get the C2D formats needed for conversion to YUV */
@@ -358,7 +380,7 @@ static uint32 c2d_get_gpuaddr(copybit_context_t* ctx,
     }
 
     // Check for a freeindex in the mapped_gpu_addr list
-    for (freeindex = 0; freeindex < MAX_SURFACES; freeindex++) {
+    for (freeindex = 0; freeindex < ctx->mapped_gpu_addr_size; freeindex++) {
         if (ctx->mapped_gpu_addr[freeindex] == 0) {
             // free index is available
             // map GPU addr and use this as mapped_idx
@@ -394,47 +416,26 @@ static void unmap_gpuaddr(copybit_context_t* ctx, int mapped_idx)
 
 static int is_supported_rgb_format(int format)
 {
-    switch(format) {
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_RGB_565:
-        case HAL_PIXEL_FORMAT_BGRA_8888: {
-            return COPYBIT_SUCCESS;
-        }
-        default:
-            return COPYBIT_FAILURE;
-    }
+    const format_info *info = getFormatInfo(format);
+    if (info && info->planes == 1 && lookup_c2d_format(format) != -1)
+        return COPYBIT_SUCCESS;
+    return COPYBIT_FAILURE;
 }
 
 static int get_num_planes(int format)
 {
-    switch(format) {
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-        case HAL_PIXEL_FORMAT_NV12_ENCODEABLE:
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED: {
-            return 2;
-        }
-        case HAL_PIXEL_FORMAT_YV12: {
-            return 3;
-        }
-        default:
-            return COPYBIT_FAILURE;
-    }
+    const format_info *info = getFormatInfo(format);
+    if (info && info->planes > 1)
+        return info->planes;
+    return COPYBIT_FAILURE;
 }
 
 static int is_supported_yuv_format(int format)
 {
-    switch(format) {
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-        case HAL_PIXEL_FORMAT_NV12_ENCODEABLE:
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED: {
-            return COPYBIT_SUCCESS;
-        }
-        default:
-            return COPYBIT_FAILURE;
-    }
+    const format_info *info = getFormatInfo(format);
+    if (info && info->planes > 1 && lookup_c2d_format(format) != -1)
+        return COPYBIT_SUCCESS;
+    return COPYBIT_FAILURE;
 }
 
 static int is_valid_destination_format(int format)
@@ -518,6 +519,12 @@ static int set_image(copybit_context_t* ctx, uint32 surfaceId,
         return -EINVAL;
     }
 
+    // The surfaces below use the CPU address as well
+    if(mapBufferData(handle)) {
+        ALOGE("%s: could not map the buffer", __func__);
+        return -EINVAL;
+    }
+
     if (handle->gpuaddr == 0) {
         gpuaddr = c2d_get_gpuaddr(ctx, handle, mapped_idx);
         if(!gpuaddr) {
@@ -599,6 +606,22 @@ static int set_image(copybit_context_t* ctx, uint32 surfaceId,
     return status;
 }
 
+/* Wait for the acquire fences handed over through set_sync. All the fences
+ * for a draw are merged into one, so this is a single wait per submission
+ * instead of one wait per layer in the client.
+ */
+static void wait_acquire_fence(struct copybit_context_t *ctx)
+{
+    if (ctx->acq_fence_fd < 0)
+        return;
+    if (sync_wait(ctx->acq_fence_fd, 1000) < 0) {
+        ALOGE("%s: sync_wait error!! error no = %d err str = %s",
+              __FUNCTION__, errno, strerror(errno));
+    }
+    close(ctx->acq_fence_fd);
+    ctx->acq_fence_fd = -1;
+}
+
 /** copy the bits */
 static int msm_copybit(struct copybit_context_t *ctx, unsigned int target)
 {
@@ -606,6 +629,8 @@ static int msm_copybit(struct copybit_context_t *ctx, unsigned int target)
         return COPYBIT_SUCCESS;
     }
 
+    wait_acquire_fence(ctx);
+
     for (int i = 0; i < ctx->blit_count; i++)
     {
         ctx->blit_list[i].next = &(ctx->blit_list[i+1]);
@@ -622,6 +647,8 @@ static int msm_copybit(struct copybit_context_t *ctx, unsigned int target)
         ALOGE("%s: LINK_c2dDraw ERROR", __FUNCTION__);
         return COPYBIT_FAILURE;
     }
+    ctx->frame_draw_calls++;
+    ctx->frame_blit_objects += ctx->blit_count;
     return COPYBIT_SUCCESS;
 }
 
@@ -652,10 +679,49 @@ static int flush_get_fence_copybit (struct copybit_device_t *dev, int* fd)
         ctx->wait_timestamp = true;
         pthread_cond_signal(&ctx->wait_cleanup_cond);
     }
+    ALOGD_IF(ctx->stats_enabled, "%s: draw calls %d blit objects %d "
+             "cpu time %lld us", __FUNCTION__, ctx->frame_draw_calls,
+             ctx->frame_blit_objects, ctx->frame_cpu_time_ns / 1000);
+    ctx->frame_draw_calls = 0;
+    ctx->frame_blit_objects = 0;
+    ctx->frame_cpu_time_ns = 0;
     pthread_mutex_unlock(&ctx->wait_cleanup_lock);
     return status;
 }
 
+static int set_sync_copybit(struct copybit_device_t *dev,
+                            int acquireFenceFd)
+{
+    struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
+    if (!ctx) {
+        if (acquireFenceFd >= 0)
+            close(acquireFenceFd);
+        return COPYBIT_FAILURE;
+    }
+    if (acquireFenceFd < 0)
+        return COPYBIT_SUCCESS;
+
+    pthread_mutex_lock(&ctx->wait_cleanup_lock);
+    if (ctx->acq_fence_fd < 0) {
+        ctx->acq_fence_fd = acquireFenceFd;
+    } else {
+        int merged = sync_merge("copybit_acq", ctx->acq_fence_fd,
+                                acquireFenceFd);
+        if (merged < 0) {
+            // Could not merge, wait on what we have so far to stay correct.
+            ALOGE("%s: sync_merge failed, waiting inline", __FUNCTION__);
+            wait_acquire_fence(ctx);
+            ctx->acq_fence_fd = acquireFenceFd;
+        } else {
+            close(ctx->acq_fence_fd);
+            close(acquireFenceFd);
+            ctx->acq_fence_fd = merged;
+        }
+    }
+    pthread_mutex_unlock(&ctx->wait_cleanup_lock);
+    return COPYBIT_SUCCESS;
+}
+
 static int finish_copybit(struct copybit_device_t *dev)
 {
     struct copybit_context_t* ctx = (struct copybit_context_t*)dev;
@@ -669,22 +735,7 @@ static int finish_copybit(struct copybit_device_t *dev)
         return COPYBIT_FAILURE;
     }
 
-    // Unmap any mapped addresses.
-    for (int i = 0; i < MAX_SURFACES; i++) {
-        if (ctx->mapped_gpu_addr[i]) {
-            LINK_c2dUnMapAddr( (void*)ctx->mapped_gpu_addr[i]);
-            ctx->mapped_gpu_addr[i] = 0;
-        }
-    }
-
-    // Reset the counts after the draw.
-    ctx->blit_rgb_count = 0;
-    ctx->blit_yuv_2_plane_count = 0;
-    ctx->blit_yuv_3_plane_count = 0;
-    ctx->blit_count = 0;
-    ctx->dst_surface_mapped = false;
-    ctx->dst_surface_base = 0;
-
+    reset_batch(ctx);
     return status;
 }
 
@@ -1059,12 +1110,140 @@ static int copy_image(private_handle_t *src_handle,
     return ret;
 }
 
-static void delete_handle(private_handle_t *handle)
+/* Create a C2D surface of the given type backed by a dummy address. The
+ * surface is pointed at the real buffer with c2dUpdateSurface at blit time.
+ */
+static C2D_STATUS create_dummy_surface(int surface_type,
+                                       unsigned int *surface_id)
+{
+    if (surface_type == RGB_SURFACE) {
+        C2D_RGB_SURFACE_DEF surfDefinition = {0};
+        surfDefinition.buffer = (void*)0xdddddddd;
+        surfDefinition.phys = (void*)0xdddddddd;
+        surfDefinition.stride = 1 * 4;
+        surfDefinition.width = 1;
+        surfDefinition.height = 1;
+        surfDefinition.format = C2D_COLOR_FORMAT_8888_ARGB;
+        return LINK_c2dCreateSurface(surface_id, C2D_TARGET | C2D_SOURCE,
+                                     (C2D_SURFACE_TYPE)(C2D_SURFACE_RGB_HOST |
+                                                 C2D_SURFACE_WITH_PHYS |
+                                                 C2D_SURFACE_WITH_PHYS_DUMMY),
+                                     &surfDefinition);
+    }
+
+    C2D_YUV_SURFACE_DEF yuvSurfaceDef = {0};
+    yuvSurfaceDef.format = (surface_type == YUV_SURFACE_2_PLANES) ?
+                            C2D_COLOR_FORMAT_420_NV12 :
+                            C2D_COLOR_FORMAT_420_YV12;
+    yuvSurfaceDef.width = 4;
+    yuvSurfaceDef.height = 4;
+    yuvSurfaceDef.plane0 = (void*)0xaaaaaaaa;
+    yuvSurfaceDef.phys0 = (void*) 0xaaaaaaaa;
+    yuvSurfaceDef.stride0 = 4;
+
+    yuvSurfaceDef.plane1 = (void*)0xaaaaaaaa;
+    yuvSurfaceDef.phys1 = (void*) 0xaaaaaaaa;
+    yuvSurfaceDef.stride1 = 4;
+    if (surface_type == YUV_SURFACE_3_PLANES) {
+        yuvSurfaceDef.plane2 = (void*)0xaaaaaaaa;
+        yuvSurfaceDef.phys2 = (void*) 0xaaaaaaaa;
+        yuvSurfaceDef.stride2 = 4;
+    }
+    return LINK_c2dCreateSurface(surface_id, C2D_TARGET | C2D_SOURCE,
+                                 (C2D_SURFACE_TYPE)(C2D_SURFACE_YUV_HOST |
+                                                 C2D_SURFACE_WITH_PHYS |
+                                                 C2D_SURFACE_WITH_PHYS_DUMMY),
+                                 &yuvSurfaceDef);
+}
+
+/* Add up to count surface templates to the pool of the given type. The
+ * mapped address table is grown along with it so that every pooled surface
+ * and the destination can hold a mapping at the same time.
+ */
+static int grow_surface_pool(copybit_context_t* ctx, int surface_type,
+                             int count)
 {
-    if (handle) {
-        delete handle;
-        handle = 0;
+    surface_pool *pool = &ctx->src_pool[surface_type];
+    C2D_OBJECT_STR *objects = (C2D_OBJECT_STR *)realloc(pool->objects,
+                              (pool->size + count) * sizeof(C2D_OBJECT_STR));
+    if (!objects) {
+        ALOGE("%s: realloc of surface pool %d failed", __FUNCTION__,
+              surface_type);
+        return COPYBIT_FAILURE;
+    }
+    pool->objects = objects;
+
+    int mapped_size = 1;
+    for (int i = 0; i < NUM_SURFACE_TYPES; i++)
+        mapped_size += ctx->src_pool[i].size;
+    mapped_size += count;
+    if (mapped_size > ctx->mapped_gpu_addr_size) {
+        unsigned int *mapped = (unsigned int *)realloc(ctx->mapped_gpu_addr,
+                                          mapped_size * sizeof(unsigned int));
+        if (!mapped) {
+            ALOGE("%s: realloc of mapped address table failed",
+                  __FUNCTION__);
+            return COPYBIT_FAILURE;
+        }
+        memset(mapped + ctx->mapped_gpu_addr_size, 0,
+               (mapped_size - ctx->mapped_gpu_addr_size) *
+               sizeof(unsigned int));
+        ctx->mapped_gpu_addr = mapped;
+        ctx->mapped_gpu_addr_size = mapped_size;
+    }
+
+    int added = 0;
+    for (; added < count; added++) {
+        unsigned int surface_id = 0;
+        if (create_dummy_surface(surface_type, &surface_id)) {
+            ALOGE("%s: create surface of type %d failed", __FUNCTION__,
+                  surface_type);
+            break;
+        }
+        memset(&pool->objects[pool->size], 0, sizeof(C2D_OBJECT_STR));
+        pool->objects[pool->size].surface_id = surface_id;
+        pool->size++;
     }
+    return added ? COPYBIT_SUCCESS : COPYBIT_FAILURE;
+}
+
+/* Double the blit list so that all the blit objects of a frame can be
+ * submitted with a single c2dDraw.
+ */
+static int grow_blit_list(copybit_context_t* ctx)
+{
+    int size = ctx->blit_list_size ? ctx->blit_list_size * 2 :
+                                     INIT_BLIT_OBJECT_COUNT;
+    C2D_OBJECT_STR *list = (C2D_OBJECT_STR *)realloc(ctx->blit_list,
+                                              size * sizeof(C2D_OBJECT_STR));
+    if (!list) {
+        ALOGE("%s: realloc of blit list failed", __FUNCTION__);
+        return COPYBIT_FAILURE;
+    }
+    ctx->blit_list = list;
+    ctx->blit_list_size = size;
+    return COPYBIT_SUCCESS;
+}
+
+static int get_surface_type(int format)
+{
+    if (is_supported_rgb_format(format) == COPYBIT_SUCCESS)
+        return RGB_SURFACE;
+    if (is_supported_yuv_format(format) == COPYBIT_SUCCESS) {
+        int num_planes = get_num_planes(format);
+        if (num_planes == 2)
+            return YUV_SURFACE_2_PLANES;
+        if (num_planes == 3)
+            return YUV_SURFACE_3_PLANES;
+    }
+    return -EINVAL;
+}
+
+static int64_t thread_cpu_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
 static bool need_to_execute_draw(struct copybit_context_t* ctx,
@@ -1118,37 +1297,36 @@ static int stretch_copybit_internal(
         return COPYBIT_FAILURE;
     }
 
-    int dst_surface_type;
-    if (is_supported_rgb_format(dst->format) == COPYBIT_SUCCESS) {
-        dst_surface_type = RGB_SURFACE;
-        flags |= FLAGS_PREMULTIPLIED_ALPHA;
-    } else if (is_supported_yuv_format(dst->format) == COPYBIT_SUCCESS) {
-        int num_planes = get_num_planes(dst->format);
-        flags |= FLAGS_YUV_DESTINATION;
-        if (num_planes == 2) {
-            dst_surface_type = YUV_SURFACE_2_PLANES;
-        } else if (num_planes == 3) {
-            dst_surface_type = YUV_SURFACE_3_PLANES;
-        } else {
-            ALOGE("%s: dst number of YUV planes is invalid dst format = 0x%x",
-                  __FUNCTION__, dst->format);
-            return COPYBIT_FAILURE;
-        }
-    } else {
+    int dst_surface_type = get_surface_type(dst->format);
+    if (dst_surface_type < 0) {
         ALOGE("%s: Invalid dst surface format 0x%x", __FUNCTION__,
                                                      dst->format);
         return COPYBIT_FAILURE;
     }
+    if (dst_surface_type == RGB_SURFACE) {
+        flags |= FLAGS_PREMULTIPLIED_ALPHA;
+    } else {
+        flags |= FLAGS_YUV_DESTINATION;
+    }
+
+    src_surface_type = get_surface_type(src->format);
+    if (src_surface_type < 0) {
+        ALOGE("%s: Invalid source surface format 0x%x", __FUNCTION__,
+                                                        src->format);
+        return -EINVAL;
+    }
+
+    if (ctx->dst_surface_type != dst_surface_type) {
+        // c2dDraw takes a single target, draw what is pending on the old one.
+        finish_copybit(dev);
+    }
 
-    if (ctx->blit_rgb_count == MAX_RGB_SURFACES ||
-        ctx->blit_yuv_2_plane_count == MAX_YUV_2_PLANE_SURFACES ||
-        ctx->blit_yuv_3_plane_count == MAX_YUV_2_PLANE_SURFACES ||
-        ctx->blit_count == MAX_BLIT_OBJECT_COUNT ||
-        ctx->dst_surface_type != dst_surface_type) {
-        // we have reached the max. limits of our internal structures or
-        // changed the target.
-        // Draw the remaining surfaces. We need to do the finish here since
-        // we need to free up the surface templates.
+    surface_pool *pool = &ctx->src_pool[src_surface_type];
+    if (pool->count == pool->size &&
+        grow_surface_pool(ctx, src_surface_type, SURFACE_POOL_GROW_STEP)) {
+        // Out of surface templates and could not create more. Draw the
+        // pending surfaces, we need to do the finish here since we need to
+        // free up the surface templates.
         finish_copybit(dev);
     }
 
@@ -1166,29 +1344,24 @@ static int stretch_copybit_internal(
     bool need_temp_dst = need_temp_buffer(dst);
     bufferInfo dst_info;
     populate_buffer_info(dst, dst_info);
-    private_handle_t* dst_hnd = new private_handle_t(-1, 0, 0, 0, dst_info.format,
-                                                     dst_info.width, dst_info.height);
-    if (dst_hnd == NULL) {
-        ALOGE("%s: dst_hnd is null", __FUNCTION__);
-        return COPYBIT_FAILURE;
-    }
+    private_handle_t dst_hnd(-1, 0, 0, 0, dst_info.format,
+                             dst_info.width, dst_info.height);
     if (need_temp_dst) {
         if (get_size(dst_info) != ctx->temp_dst_buffer.size) {
             free_temp_buffer(ctx->temp_dst_buffer);
             // Create a temp buffer and set that as the destination.
             if (COPYBIT_FAILURE == get_temp_buffer(dst_info, ctx->temp_dst_buffer)) {
                 ALOGE("%s: get_temp_buffer(dst) failed", __FUNCTION__);
-                delete_handle(dst_hnd);
                 return COPYBIT_FAILURE;
             }
         }
-        dst_hnd->fd = ctx->temp_dst_buffer.fd;
-        dst_hnd->size = ctx->temp_dst_buffer.size;
-        dst_hnd->flags = ctx->temp_dst_buffer.allocType;
-        dst_hnd->base = (int)(ctx->temp_dst_buffer.base);
-        dst_hnd->offset = ctx->temp_dst_buffer.offset;
-        dst_hnd->gpuaddr = 0;
-        dst_image.handle = dst_hnd;
+        dst_hnd.fd = ctx->temp_dst_buffer.fd;
+        dst_hnd.size = ctx->temp_dst_buffer.size;
+        dst_hnd.flags = ctx->temp_dst_buffer.allocType;
+        dst_hnd.base = (int)(ctx->temp_dst_buffer.base);
+        dst_hnd.offset = ctx->temp_dst_buffer.offset;
+        dst_hnd.gpuaddr = 0;
+        dst_image.handle = &dst_hnd;
     }
     if(!ctx->dst_surface_mapped) {
         //map the destination surface to GPU address
@@ -1196,7 +1369,6 @@ static int stretch_copybit_internal(
                            (eC2DFlags)flags, mapped_dst_idx);
         if(status) {
             ALOGE("%s: dst: set_image error", __FUNCTION__);
-            delete_handle(dst_hnd);
             unmap_gpuaddr(ctx, mapped_dst_idx);
             return COPYBIT_FAILURE;
         }
@@ -1211,31 +1383,7 @@ static int stretch_copybit_internal(
 
     // Update the source
     flags = 0;
-    if(is_supported_rgb_format(src->format) == COPYBIT_SUCCESS) {
-        src_surface_type = RGB_SURFACE;
-        src_surface = ctx->blit_rgb_object[ctx->blit_rgb_count];
-    } else if (is_supported_yuv_format(src->format) == COPYBIT_SUCCESS) {
-        int num_planes = get_num_planes(src->format);
-        if (num_planes == 2) {
-            src_surface_type = YUV_SURFACE_2_PLANES;
-            src_surface = ctx->blit_yuv_2_plane_object[ctx->blit_yuv_2_plane_count];
-        } else if (num_planes == 3) {
-            src_surface_type = YUV_SURFACE_3_PLANES;
-            src_surface = ctx->blit_yuv_3_plane_object[ctx->blit_yuv_2_plane_count];
-        } else {
-            ALOGE("%s: src number of YUV planes is invalid src format = 0x%x",
-                  __FUNCTION__, src->format);
-            delete_handle(dst_hnd);
-            unmap_gpuaddr(ctx, mapped_dst_idx);
-            return -EINVAL;
-        }
-    } else {
-        ALOGE("%s: Invalid source surface format 0x%x", __FUNCTION__,
-                                                        src->format);
-        delete_handle(dst_hnd);
-        unmap_gpuaddr(ctx, mapped_dst_idx);
-        return -EINVAL;
-    }
+    src_surface = pool->objects[pool->count];
 
     copybit_image_t src_image;
     src_image.w = src->w;
@@ -1246,54 +1394,44 @@ static int stretch_copybit_internal(
     bool need_temp_src = need_temp_buffer(src);
     bufferInfo src_info;
     populate_buffer_info(src, src_info);
-    private_handle_t* src_hnd = new private_handle_t(-1, 0, 0, 0, src_info.format,
-                                                 src_info.width, src_info.height);
-    if (NULL == src_hnd) {
-        ALOGE("%s: src_hnd is null", __FUNCTION__);
-        delete_handle(dst_hnd);
-        unmap_gpuaddr(ctx, mapped_dst_idx);
-        return COPYBIT_FAILURE;
-    }
+    private_handle_t src_hnd(-1, 0, 0, 0, src_info.format,
+                             src_info.width, src_info.height);
     if (need_temp_src) {
+        // The source is read by the CPU below, not just by the GPU
+        wait_acquire_fence(ctx);
         if (get_size(src_info) != ctx->temp_src_buffer.size) {
             free_temp_buffer(ctx->temp_src_buffer);
             // Create a temp buffer and set that as the destination.
             if (COPYBIT_SUCCESS != get_temp_buffer(src_info,
                                                ctx->temp_src_buffer)) {
                 ALOGE("%s: get_temp_buffer(src) failed", __FUNCTION__);
-                delete_handle(dst_hnd);
-                delete_handle(src_hnd);
                 unmap_gpuaddr(ctx, mapped_dst_idx);
                 return COPYBIT_FAILURE;
             }
         }
-        src_hnd->fd = ctx->temp_src_buffer.fd;
-        src_hnd->size = ctx->temp_src_buffer.size;
-        src_hnd->flags = ctx->temp_src_buffer.allocType;
-        src_hnd->base = (int)(ctx->temp_src_buffer.base);
-        src_hnd->offset = ctx->temp_src_buffer.offset;
-        src_hnd->gpuaddr = 0;
-        src_image.handle = src_hnd;
+        src_hnd.fd = ctx->temp_src_buffer.fd;
+        src_hnd.size = ctx->temp_src_buffer.size;
+        src_hnd.flags = ctx->temp_src_buffer.allocType;
+        src_hnd.base = (int)(ctx->temp_src_buffer.base);
+        src_hnd.offset = ctx->temp_src_buffer.offset;
+        src_hnd.gpuaddr = 0;
+        src_image.handle = &src_hnd;
 
         // Copy the source.
         status = copy_image((private_handle_t *)src->handle, &src_image,
                                 CONVERT_TO_C2D_FORMAT);
         if (status == COPYBIT_FAILURE) {
             ALOGE("%s:copy_image failed in temp source",__FUNCTION__);
-            delete_handle(dst_hnd);
-            delete_handle(src_hnd);
             unmap_gpuaddr(ctx, mapped_dst_idx);
             return status;
         }
 
         // Clean the cache
-        IMemAlloc* memalloc = sAlloc->getAllocator(src_hnd->flags);
-        if (memalloc->clean_buffer((void *)(src_hnd->base), src_hnd->size,
-                                   src_hnd->offset, src_hnd->fd,
+        IMemAlloc* memalloc = sAlloc->getAllocator(src_hnd.flags);
+        if (memalloc->clean_buffer((void *)(src_hnd.base), src_hnd.size,
+                                   src_hnd.offset, src_hnd.fd,
                                    gralloc::CACHE_CLEAN)) {
             ALOGE("%s: clean_buffer failed", __FUNCTION__);
-            delete_handle(dst_hnd);
-            delete_handle(src_hnd);
             unmap_gpuaddr(ctx, mapped_dst_idx);
             return COPYBIT_FAILURE;
         }
@@ -1305,8 +1443,6 @@ static int stretch_copybit_internal(
                        (eC2DFlags)flags, mapped_src_idx);
     if(status) {
         ALOGE("%s: set_image (src) error", __FUNCTION__);
-        delete_handle(dst_hnd);
-        delete_handle(src_hnd);
         unmap_gpuaddr(ctx, mapped_dst_idx);
         unmap_gpuaddr(ctx, mapped_src_idx);
         return COPYBIT_FAILURE;
@@ -1319,8 +1455,6 @@ static int stretch_copybit_internal(
             src_surface.config_mask &= ~C2D_ALPHA_BLEND_NONE;
             if(!(src_surface.global_alpha)) {
                 // src alpha is zero
-                delete_handle(dst_hnd);
-                delete_handle(src_hnd);
                 unmap_gpuaddr(ctx, mapped_dst_idx);
                 unmap_gpuaddr(ctx, mapped_src_idx);
                 return COPYBIT_FAILURE;
@@ -1330,21 +1464,14 @@ static int stretch_copybit_internal(
         src_surface.config_mask |= C2D_ALPHA_BLEND_NONE;
     }
 
-    if (src_surface_type == RGB_SURFACE) {
-        ctx->blit_rgb_object[ctx->blit_rgb_count] = src_surface;
-        ctx->blit_rgb_count++;
-    } else if (src_surface_type == YUV_SURFACE_2_PLANES) {
-        ctx->blit_yuv_2_plane_object[ctx->blit_yuv_2_plane_count] = src_surface;
-        ctx->blit_yuv_2_plane_count++;
-    } else {
-        ctx->blit_yuv_3_plane_object[ctx->blit_yuv_3_plane_count] = src_surface;
-        ctx->blit_yuv_3_plane_count++;
-    }
+    pool->objects[pool->count] = src_surface;
+    pool->count++;
 
     struct copybit_rect_t clip;
     while ((status == 0) && region->next(region, &clip)) {
         set_rects(ctx, &(src_surface), dst_rect, src_rect, &clip);
-        if (ctx->blit_count == MAX_BLIT_OBJECT_COUNT) {
+        if (ctx->blit_count == ctx->blit_list_size &&
+            grow_blit_list(ctx)) {
             ALOGW("Reached end of blit count");
             finish_copybit(dev);
         }
@@ -1362,23 +1489,19 @@ static int stretch_copybit_internal(
     if (need_temp_dst) {
         // copy the temp. destination without the alignment to the actual
         // destination.
-        status = copy_image(dst_hnd, dst, CONVERT_TO_ANDROID_FORMAT);
+        status = copy_image(&dst_hnd, dst, CONVERT_TO_ANDROID_FORMAT);
         if (status == COPYBIT_FAILURE) {
             ALOGE("%s:copy_image failed in temp Dest",__FUNCTION__);
-            delete_handle(dst_hnd);
-            delete_handle(src_hnd);
             unmap_gpuaddr(ctx, mapped_dst_idx);
             unmap_gpuaddr(ctx, mapped_src_idx);
             return status;
         }
         // Clean the cache.
-        IMemAlloc* memalloc = sAlloc->getAllocator(dst_hnd->flags);
-        memalloc->clean_buffer((void *)(dst_hnd->base), dst_hnd->size,
-                               dst_hnd->offset, dst_hnd->fd,
+        IMemAlloc* memalloc = sAlloc->getAllocator(dst_hnd.flags);
+        memalloc->clean_buffer((void *)(dst_hnd.base), dst_hnd.size,
+                               dst_hnd.offset, dst_hnd.fd,
                                gralloc::CACHE_CLEAN);
     }
-    delete_handle(dst_hnd);
-    delete_handle(src_hnd);
 
     ctx->is_premultiplied_alpha = false;
     ctx->fb_width = 0;
@@ -1400,8 +1523,10 @@ static int stretch_copybit(
     int status = COPYBIT_SUCCESS;
     bool needsBlending = (ctx->src_global_alpha != 0);
     pthread_mutex_lock(&ctx->wait_cleanup_lock);
+    int64_t start = thread_cpu_time_ns();
     status = stretch_copybit_internal(dev, dst, src, dst_rect, src_rect,
                                     region, needsBlending);
+    ctx->frame_cpu_time_ns += thread_cpu_time_ns() - start;
     pthread_mutex_unlock(&ctx->wait_cleanup_lock);
     return status;
 }
@@ -1418,7 +1543,9 @@ static int blit_copybit(
     struct copybit_rect_t dr = { 0, 0, (int)dst->w, (int)dst->h };
     struct copybit_rect_t sr = { 0, 0, (int)src->w, (int)src->h };
     pthread_mutex_lock(&ctx->wait_cleanup_lock);
+    int64_t start = thread_cpu_time_ns();
     status = stretch_copybit_internal(dev, dst, src, &dr, &sr, region, false);
+    ctx->frame_cpu_time_ns += thread_cpu_time_ns() - start;
     pthread_mutex_unlock(&ctx->wait_cleanup_lock);
     return status;
 }
@@ -1442,25 +1569,24 @@ static void clean_up(copybit_context_t* ctx)
     pthread_mutex_destroy(&ctx->wait_cleanup_lock);
     pthread_cond_destroy (&ctx->wait_cleanup_cond);
 
+    if (ctx->acq_fence_fd >= 0)
+        close(ctx->acq_fence_fd);
+
     for (int i = 0; i < NUM_SURFACE_TYPES; i++) {
         if (ctx->dst[i])
             LINK_c2dDestroySurface(ctx->dst[i]);
     }
 
-    for (int i = 0; i < MAX_RGB_SURFACES; i++) {
-        if (ctx->blit_rgb_object[i].surface_id)
-            LINK_c2dDestroySurface(ctx->blit_rgb_object[i].surface_id);
-    }
-
-    for (int i = 0; i < MAX_YUV_2_PLANE_SURFACES; i++) {
-        if (ctx->blit_yuv_2_plane_object[i].surface_id)
-            LINK_c2dDestroySurface(ctx->blit_yuv_2_plane_object[i].surface_id);
-    }
-
-    for (int i = 0; i < MAX_YUV_3_PLANE_SURFACES; i++) {
-        if (ctx->blit_yuv_3_plane_object[i].surface_id)
-            LINK_c2dDestroySurface(ctx->blit_yuv_3_plane_object[i].surface_id);
+    for (int i = 0; i < NUM_SURFACE_TYPES; i++) {
+        surface_pool *pool = &ctx->src_pool[i];
+        for (int j = 0; j < pool->size; j++) {
+            if (pool->objects[j].surface_id)
+                LINK_c2dDestroySurface(pool->objects[j].surface_id);
+        }
+        free(pool->objects);
     }
+    free(ctx->blit_list);
+    free(ctx->mapped_gpu_addr);
 
     if (ctx->libc2d2) {
         ::dlclose(ctx->libc2d2);
@@ -1487,8 +1613,6 @@ static int open_copybit(const struct hw_module_t* module, const char* name,
                         struct hw_device_t** device)
 {
     int status = COPYBIT_SUCCESS;
-    C2D_RGB_SURFACE_DEF surfDefinition = {0};
-    C2D_YUV_SURFACE_DEF yuvSurfaceDef = {0} ;
     struct copybit_context_t *ctx;
     char fbName[64];
 
@@ -1500,6 +1624,7 @@ static int open_copybit(const struct hw_module_t* module, const char* name,
 
     /* initialize drawstate */
     memset(ctx, 0, sizeof(*ctx));
+    ctx->acq_fence_fd = -1;
     ctx->libc2d2 = ::dlopen("libC2D2.so", RTLD_NOW);
     if (!ctx->libc2d2) {
         ALOGE("FATAL ERROR: could not dlopen libc2d2.so: %s", dlerror());
@@ -1555,145 +1680,35 @@ static int open_copybit(const struct hw_module_t* module, const char* name,
     ctx->device.finish = finish_copybit;
     ctx->device.flush_get_fence = flush_get_fence_copybit;
     ctx->device.clear = clear_copybit;
+    ctx->device.set_sync = set_sync_copybit;
 
-    /* Create RGB Surface */
-    surfDefinition.buffer = (void*)0xdddddddd;
-    surfDefinition.phys = (void*)0xdddddddd;
-    surfDefinition.stride = 1 * 4;
-    surfDefinition.width = 1;
-    surfDefinition.height = 1;
-    surfDefinition.format = C2D_COLOR_FORMAT_8888_ARGB;
-    if (LINK_c2dCreateSurface(&(ctx->dst[RGB_SURFACE]), C2D_TARGET | C2D_SOURCE,
-                              (C2D_SURFACE_TYPE)(C2D_SURFACE_RGB_HOST |
-                                                 C2D_SURFACE_WITH_PHYS |
-                                                 C2D_SURFACE_WITH_PHYS_DUMMY ),
-                                                 &surfDefinition)) {
-        ALOGE("%s: create ctx->dst_surface[RGB_SURFACE] failed", __FUNCTION__);
-        ctx->dst[RGB_SURFACE] = 0;
-        clean_up(ctx);
-        status = COPYBIT_FAILURE;
-        *device = NULL;
-        return status;
-    }
-
-    unsigned int surface_id = 0;
-    for (int i = 0; i < MAX_RGB_SURFACES; i++)
-    {
-        if (LINK_c2dCreateSurface(&surface_id, C2D_TARGET | C2D_SOURCE,
-                              (C2D_SURFACE_TYPE)(C2D_SURFACE_RGB_HOST |
-                                                 C2D_SURFACE_WITH_PHYS |
-                                                 C2D_SURFACE_WITH_PHYS_DUMMY ),
-                                                 &surfDefinition)) {
-            ALOGE("%s: create RGB source surface %d failed", __FUNCTION__, i);
-            ctx->blit_rgb_object[i].surface_id = 0;
+    const int initSurfaces[NUM_SURFACE_TYPES] = {
+        INIT_RGB_SURFACES,
+        INIT_YUV_2_PLANE_SURFACES,
+        INIT_YUV_3_PLANE_SURFACES
+    };
+    for (int i = 0; i < NUM_SURFACE_TYPES; i++) {
+        if (create_dummy_surface(i, &(ctx->dst[i]))) {
+            ALOGE("%s: create ctx->dst[%d] failed", __FUNCTION__, i);
+            ctx->dst[i] = 0;
             status = COPYBIT_FAILURE;
             break;
-        } else {
-            ctx->blit_rgb_object[i].surface_id = surface_id;
-            ALOGW("%s i = %d surface_id=%d",  __FUNCTION__, i,
-                                          ctx->blit_rgb_object[i].surface_id);
         }
-    }
-
-    if (status == COPYBIT_FAILURE) {
-        clean_up(ctx);
-        status = COPYBIT_FAILURE;
-        *device = NULL;
-        return status;
-    }
-
-    // Create 2 plane YUV surfaces
-    yuvSurfaceDef.format = C2D_COLOR_FORMAT_420_NV12;
-    yuvSurfaceDef.width = 4;
-    yuvSurfaceDef.height = 4;
-    yuvSurfaceDef.plane0 = (void*)0xaaaaaaaa;
-    yuvSurfaceDef.phys0 = (void*) 0xaaaaaaaa;
-    yuvSurfaceDef.stride0 = 4;
-
-    yuvSurfaceDef.plane1 = (void*)0xaaaaaaaa;
-    yuvSurfaceDef.phys1 = (void*) 0xaaaaaaaa;
-    yuvSurfaceDef.stride1 = 4;
-    if (LINK_c2dCreateSurface(&(ctx->dst[YUV_SURFACE_2_PLANES]),
-                              C2D_TARGET | C2D_SOURCE,
-                              (C2D_SURFACE_TYPE)(C2D_SURFACE_YUV_HOST |
-                               C2D_SURFACE_WITH_PHYS |
-                               C2D_SURFACE_WITH_PHYS_DUMMY),
-                              &yuvSurfaceDef)) {
-        ALOGE("%s: create ctx->dst[YUV_SURFACE_2_PLANES] failed", __FUNCTION__);
-        ctx->dst[YUV_SURFACE_2_PLANES] = 0;
-        clean_up(ctx);
-        status = COPYBIT_FAILURE;
-        *device = NULL;
-        return status;
-    }
-
-    for (int i=0; i < MAX_YUV_2_PLANE_SURFACES; i++)
-    {
-        if (LINK_c2dCreateSurface(&surface_id, C2D_TARGET | C2D_SOURCE,
-                              (C2D_SURFACE_TYPE)(C2D_SURFACE_YUV_HOST |
-                                                 C2D_SURFACE_WITH_PHYS |
-                                                 C2D_SURFACE_WITH_PHYS_DUMMY ),
-                              &yuvSurfaceDef)) {
-            ALOGE("%s: create YUV source %d failed", __FUNCTION__, i);
-            ctx->blit_yuv_2_plane_object[i].surface_id = 0;
+        if (grow_surface_pool(ctx, i, initSurfaces[i]) ||
+            ctx->src_pool[i].size != initSurfaces[i]) {
+            ALOGE("%s: create source surfaces of type %d failed",
+                  __FUNCTION__, i);
             status = COPYBIT_FAILURE;
             break;
-        } else {
-            ctx->blit_yuv_2_plane_object[i].surface_id = surface_id;
-            ALOGW("%s: 2 Plane YUV i=%d surface_id=%d",  __FUNCTION__, i,
-                                   ctx->blit_yuv_2_plane_object[i].surface_id);
         }
     }
 
-    if (status == COPYBIT_FAILURE) {
-        clean_up(ctx);
-        status = COPYBIT_FAILURE;
-        *device = NULL;
-        return status;
-    }
-
-    // Create YUV 3 plane surfaces
-    yuvSurfaceDef.format = C2D_COLOR_FORMAT_420_YV12;
-    yuvSurfaceDef.plane2 = (void*)0xaaaaaaaa;
-    yuvSurfaceDef.phys2 = (void*) 0xaaaaaaaa;
-    yuvSurfaceDef.stride2 = 4;
-
-    if (LINK_c2dCreateSurface(&(ctx->dst[YUV_SURFACE_3_PLANES]),
-                              C2D_TARGET | C2D_SOURCE,
-                              (C2D_SURFACE_TYPE)(C2D_SURFACE_YUV_HOST |
-                                                 C2D_SURFACE_WITH_PHYS |
-                                                 C2D_SURFACE_WITH_PHYS_DUMMY),
-                              &yuvSurfaceDef)) {
-        ALOGE("%s: create ctx->dst[YUV_SURFACE_3_PLANES] failed", __FUNCTION__);
-        ctx->dst[YUV_SURFACE_3_PLANES] = 0;
-        clean_up(ctx);
+    if (status == COPYBIT_SUCCESS && grow_blit_list(ctx)) {
         status = COPYBIT_FAILURE;
-        *device = NULL;
-        return status;
-    }
-
-    for (int i=0; i < MAX_YUV_3_PLANE_SURFACES; i++)
-    {
-        if (LINK_c2dCreateSurface(&(surface_id),
-                              C2D_TARGET | C2D_SOURCE,
-                              (C2D_SURFACE_TYPE)(C2D_SURFACE_YUV_HOST |
-                                                 C2D_SURFACE_WITH_PHYS |
-                                                 C2D_SURFACE_WITH_PHYS_DUMMY),
-                              &yuvSurfaceDef)) {
-            ALOGE("%s: create 3 plane YUV surface %d failed", __FUNCTION__, i);
-            ctx->blit_yuv_3_plane_object[i].surface_id = 0;
-            status = COPYBIT_FAILURE;
-            break;
-        } else {
-            ctx->blit_yuv_3_plane_object[i].surface_id = surface_id;
-            ALOGW("%s: 3 Plane YUV i=%d surface_id=%d",  __FUNCTION__, i,
-                                   ctx->blit_yuv_3_plane_object[i].surface_id);
-        }
     }
 
     if (status == COPYBIT_FAILURE) {
         clean_up(ctx);
-        status = COPYBIT_FAILURE;
         *device = NULL;
         return status;
     }
@@ -1719,11 +1734,12 @@ static int open_copybit(const struct hw_module_t* module, const char* name,
     ctx->fb_width = 0;
     ctx->fb_height = 0;
 
-    ctx->blit_rgb_count = 0;
-    ctx->blit_yuv_2_plane_count = 0;
-    ctx->blit_yuv_3_plane_count = 0;
     ctx->blit_count = 0;
 
+    char property[PROPERTY_VALUE_MAX];
+    if (property_get("debug.copybit.stats", property, "0") > 0)
+        ctx->stats_enabled = (atoi(property) != 0);
+
     ctx->wait_timestamp = false;
     ctx->stop_thread = false;
     pthread_mutex_init(&(ctx->wait_cleanup_lock), NULL);
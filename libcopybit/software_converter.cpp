@@ -42,6 +42,11 @@ int convertYV12toYCrCb420SP(const copybit_image_t *src, private_handle_t *yv12_h
         return -1;
     }
 
+    if(mapBufferData(hnd) || mapBufferData(yv12_handle)) {
+        ALOGE("%s: could not map the buffers", __FUNCTION__);
+        return -1;
+    }
+
     // Please refer to the description of YV12 in hardware.h
     // for the formulae used to calculate buffer sizes and offsets
 
@@ -123,6 +128,28 @@ int convertYV12toYCrCb420SP(const copybit_image_t *src, private_handle_t *yv12_h
   return 0;
 }
 
+/** Convert YCbCr_420_SP_TILED to YCbCr_420_SP */
+int convertNV12TiletoYCbCr420SP(const copybit_image_t *src,
+                                private_handle_t *nv12_handle)
+{
+    private_handle_t* hnd = (private_handle_t*)src->handle;
+
+    if(hnd == NULL || nv12_handle == NULL){
+        ALOGE("Invalid handle");
+        return -1;
+    }
+
+    if(mapBufferData(hnd) || mapBufferData(nv12_handle)) {
+        ALOGE("%s: could not map the buffers", __FUNCTION__);
+        return -1;
+    }
+
+    unsigned char* dstY = (unsigned char*)nv12_handle->base;
+    unsigned char* dstC = dstY + src->w * src->h;
+    return detileNV12((const uint8_t*)hnd->base, src->w, src->h,
+                      dstY, dstC, src->w, false, 0);
+}
+
 struct copyInfo{
     int width;
     int height;
@@ -212,6 +239,10 @@ int convert_yuv_c2d_to_yuv_android(private_handle_t *hnd,
             return COPYBIT_FAILURE;
     }
 
+    if (mapBufferData(hnd) || mapBufferData(dst_hnd)) {
+        ALOGE("%s: could not map the buffers", __FUNCTION__);
+        return COPYBIT_FAILURE;
+    }
     ret = copy_source_to_destination(hnd->base, dst_hnd->base, info);
     return ret;
 }
@@ -257,6 +288,10 @@ int convert_yuv_android_to_yuv_c2d(private_handle_t *hnd,
             return -1;
     }
 
+    if (mapBufferData(hnd) || mapBufferData(dst_hnd)) {
+        ALOGE("%s: could not map the buffers", __FUNCTION__);
+        return COPYBIT_FAILURE;
+    }
     ret = copy_source_to_destination(hnd->base, dst_hnd->base, info);
     return ret;
 }
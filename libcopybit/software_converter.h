@@ -38,6 +38,17 @@
 
 int convertYV12toYCrCb420SP(const copybit_image_t *src,private_handle_t *yv12_handle);
 
+/*
+ * Function to convert a macro-tiled NV12 image into linear YCbCr_420_SP
+ *
+ * @param: source image in YCbCr_420_SP_TILED
+ * @param: destination buffer of at least w * h * 3 / 2 bytes
+ *
+ * @return: return status
+ */
+int convertNV12TiletoYCbCr420SP(const copybit_image_t *src,
+                                private_handle_t *nv12_handle);
+
 /*
  * Function to convert the c2d format into an equivalent Android format
  *
@@ -34,8 +34,11 @@
 #include "alloc_controller.h"
 #include "memalloc.h"
 #include "ionalloc.h"
+#include "memfdalloc.h"
 #include "gr.h"
 #include "comptype.h"
+#include "qdMetaData.h"
+#include "format_info.h"
 
 #ifdef VENUS_COLOR_FORMAT
 #include <media/msm_media_info.h>
@@ -85,6 +88,34 @@ static bool useUncached(int usage)
     return false;
 }
 
+enum {
+    ZERO_ALWAYS,    // Always clear
+    ZERO_SKIP,      // Skip the clear if the heap hands out zeroed pages
+};
+
+// Zeroing policy by usage, the first entry matching the usage wins
+static const struct {
+    int usage;
+    int policy;
+} sZeroPolicyTable[] = {
+    // The CPU may read what it didn't write
+    { GRALLOC_USAGE_SW_READ_MASK | GRALLOC_USAGE_SW_WRITE_MASK, ZERO_ALWAYS },
+    // Camera output and GPU render targets are fully written first
+    { GRALLOC_USAGE_HW_CAMERA_WRITE,        ZERO_SKIP },
+    { GRALLOC_USAGE_HW_RENDER,              ZERO_SKIP },
+    { 0,                                    ZERO_ALWAYS },
+};
+
+static int getZeroPolicy(int usage)
+{
+    size_t count = sizeof(sZeroPolicyTable) / sizeof(sZeroPolicyTable[0]);
+    for (size_t i = 0; i < count; i++) {
+        if (!sZeroPolicyTable[i].usage || (usage & sZeroPolicyTable[i].usage))
+            return sZeroPolicyTable[i].policy;
+    }
+    return ZERO_ALWAYS;
+}
+
 //-------------- AdrenoMemInfo-----------------------//
 AdrenoMemInfo::AdrenoMemInfo()
 {
@@ -105,64 +136,26 @@ AdrenoMemInfo::~AdrenoMemInfo()
 int AdrenoMemInfo::getStride(int width, int format)
 {
     int stride = ALIGN(width, 32);
+    const format_info *info = getFormatInfo(format);
+    if (!info)
+        return stride;
+
     // Currently surface padding is only computed for RGB* surfaces.
-    if (format <= HAL_PIXEL_FORMAT_BGRA_8888) {
-        int bpp = 4;
-        switch(format)
-        {
-            case HAL_PIXEL_FORMAT_RGB_888:
-            case HAL_PIXEL_FORMAT_BGR_888:
-                bpp = 3;
-                break;
-            case HAL_PIXEL_FORMAT_RGB_565:
-                bpp = 2;
-                break;
-            default: break;
-        }
+    if (info->flags & FMT_RGB) {
         if ((libadreno_utils) && (LINK_adreno_compute_padding)) {
             int surface_tile_height = 1;   // Linear surface
             int raster_mode         = 0;   // Adreno unknown raster mode.
             int padding_threshold   = 512; // Threshold for padding surfaces.
             // the function below expects the width to be a multiple of
             // 32 pixels, hence we pass stride instead of width.
-            stride = LINK_adreno_compute_padding(stride, bpp,
+            stride = LINK_adreno_compute_padding(stride, info->bpp,
                                       surface_tile_height, raster_mode,
                                       padding_threshold);
         }
+    } else if (info->strideAlign == 0) {
+        stride = VENUS_Y_STRIDE(COLOR_FMT_NV12, width);
     } else {
-        switch (format)
-        {
-            case HAL_PIXEL_FORMAT_YCrCb_420_SP_ADRENO:
-            //case HAL_PIXEL_FORMAT_RAW_SENSOR:
-                stride = ALIGN(width, 32);
-                break;
-            case HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED:
-                stride = ALIGN(width, 128);
-                break;
-            case HAL_PIXEL_FORMAT_NV12_ENCODEABLE:
-            case HAL_PIXEL_FORMAT_YCbCr_420_SP:
-            case HAL_PIXEL_FORMAT_NV12:
-            case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-            case HAL_PIXEL_FORMAT_YV12:
-            case HAL_PIXEL_FORMAT_YCbCr_422_SP:
-            case HAL_PIXEL_FORMAT_YCrCb_422_SP:
-            case HAL_PIXEL_FORMAT_YCbCr_422_I:
-            case HAL_PIXEL_FORMAT_YCrCb_422_I:
-            case HAL_PIXEL_FORMAT_CrYCbY_422_I:
-            case HAL_PIXEL_FORMAT_CbYCrY_422_I:
-                stride = ALIGN(width, 16);
-                break;
-            case HAL_PIXEL_FORMAT_YCbCr_420_SP_VENUS:
-                stride = VENUS_Y_STRIDE(COLOR_FMT_NV12, width);
-                break;
-            case HAL_PIXEL_FORMAT_BLOB:
-                stride = width;
-                break;
-            case HAL_PIXEL_FORMAT_NV21_ZSL:
-                stride = ALIGN(width, 64);
-                break;
-            default: break;
-        }
+        stride = ALIGN(width, info->strideAlign);
     }
     return stride;
 }
@@ -182,30 +175,40 @@ IAllocController* IAllocController::getInstance(void)
 IonController::IonController()
 {
     mIonAlloc = new IonAlloc();
+    mMemfdAlloc = NULL;
     mUseTZProtection = false;
+    mForceZero = false;
     char property[PROPERTY_VALUE_MAX];
+#ifdef USE_MEMFD_ALLOC
+    mMemfdAlloc = new MemfdAlloc();
+#else
+    // Hosts and emulators without /dev/ion can switch to memfd at runtime
+    if ((property_get("debug.gralloc.memfd", property, NULL) > 0) &&
+        (atoi(property) == 1)) {
+        mMemfdAlloc = new MemfdAlloc();
+    }
+#endif
     if ((property_get("persist.gralloc.cp.level3", property, NULL) <= 0) ||
                             (atoi(property) != 1)) {
         mUseTZProtection = true;
     }
+    // Buffers are shared across processes, this clears every buffer that
+    // may hold stale contents, whatever the usage
+    if ((property_get("persist.gralloc.zero.force", property, NULL) > 0) &&
+        (atoi(property) == 1)) {
+        mForceZero = true;
+    }
 }
 
-int IonController::allocate(alloc_data& data, int usage)
+int IonController::getIonFlags(int usage)
 {
     int ionFlags = 0;
-    int ret;
-    bool nonContig = false;
-
-    data.uncached = useUncached(usage);
-    data.allocType = 0;
 
     if(usage & GRALLOC_USAGE_PRIVATE_UI_CONTIG_HEAP)
         ionFlags |= ION_HEAP(ION_SF_HEAP_ID);
 
-    if(usage & GRALLOC_USAGE_PRIVATE_SYSTEM_HEAP) {
+    if(usage & GRALLOC_USAGE_PRIVATE_SYSTEM_HEAP)
         ionFlags |= ION_HEAP(ION_SYSTEM_HEAP_ID);
-        nonContig = true;
-    }
 
     if(usage & GRALLOC_USAGE_PRIVATE_IOMMU_HEAP)
         ionFlags |= ION_HEAP(ION_IOMMU_HEAP_ID);
@@ -234,9 +237,6 @@ int IonController::allocate(alloc_data& data, int usage)
     if(usage & GRALLOC_USAGE_PRIVATE_ADSP_HEAP)
         ionFlags |= ION_HEAP(ION_ADSP_HEAP_ID);
 
-    if(ionFlags & ION_SECURE)
-         data.allocType |= private_handle_t::PRIV_FLAGS_SECURE_BUFFER;
-
     // if no flags are set, default to
     // SF + IOMMU heaps, so that bypass can work
     // we can fall back to system heap if
@@ -244,8 +244,38 @@ int IonController::allocate(alloc_data& data, int usage)
     if(!ionFlags)
         ionFlags = ION_HEAP(ION_SF_HEAP_ID) | ION_HEAP(ION_IOMMU_HEAP_ID);
 
+    return ionFlags;
+}
+
+int IonController::allocate(alloc_data& data, int usage)
+{
+    int ret;
+    int ionFlags = getIonFlags(usage);
+    bool nonContig = (usage & GRALLOC_USAGE_PRIVATE_SYSTEM_HEAP);
+
+    data.uncached = useUncached(usage);
+    data.allocType = 0;
+
+    if(mMemfdAlloc) {
+        // There is no content protection without ION secure heaps
+        if(ionFlags & ION_SECURE) {
+            ALOGE("%s: secure buffers are not supported with memfd",
+                  __FUNCTION__);
+            return -EINVAL;
+        }
+        data.flags = 0;
+        ret = mMemfdAlloc->alloc_buffer(data);
+        if(ret >= 0)
+            data.allocType |= private_handle_t::PRIV_FLAGS_USES_MEMFD;
+        return ret;
+    }
+
+    if(ionFlags & ION_SECURE)
+         data.allocType |= private_handle_t::PRIV_FLAGS_SECURE_BUFFER;
+
+    bool zero = mForceZero || getZeroPolicy(usage) == ZERO_ALWAYS;
     data.flags = ionFlags;
-    ret = mIonAlloc->alloc_buffer(data);
+    ret = mIonAlloc->alloc_buffer(data, zero);
 
     // Fallback
     if(ret < 0 && canFallback(usage,
@@ -254,7 +284,7 @@ int IonController::allocate(alloc_data& data, int usage)
         ALOGW("Falling back to system heap");
         data.flags = ION_HEAP(ION_SYSTEM_HEAP_ID);
         nonContig = true;
-        ret = mIonAlloc->alloc_buffer(data);
+        ret = mIonAlloc->alloc_buffer(data, zero);
     }
 
     if(ret >= 0 ) {
@@ -271,6 +301,9 @@ IMemAlloc* IonController::getAllocator(int flags)
     IMemAlloc* memalloc = NULL;
     if (flags & private_handle_t::PRIV_FLAGS_USES_ION) {
         memalloc = mIonAlloc;
+    } else if (mMemfdAlloc &&
+               (flags & private_handle_t::PRIV_FLAGS_USES_MEMFD)) {
+        memalloc = mMemfdAlloc;
     } else {
         ALOGE("%s: Invalid flags passed: 0x%x", __FUNCTION__, flags);
     }
@@ -282,24 +315,11 @@ size_t getBufferSizeAndDimensions(int width, int height, int format,
                                   int& alignedw, int &alignedh)
 {
     size_t size;
+    const format_info *info = getFormatInfo(format);
 
     alignedw = AdrenoMemInfo::getInstance().getStride(width, format);
     alignedh = ALIGN(height, 32);
     switch (format) {
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-            size = alignedw * alignedh * 4;
-            break;
-        case HAL_PIXEL_FORMAT_RGB_888:
-        case HAL_PIXEL_FORMAT_BGR_888:
-            size = alignedw * alignedh * 3;
-            break;
-        case HAL_PIXEL_FORMAT_RGB_565:
-        //case HAL_PIXEL_FORMAT_RAW_SENSOR:
-            size = alignedw * alignedh * 2;
-            break;
-
             // adreno formats
         case HAL_PIXEL_FORMAT_YCrCb_420_SP_ADRENO:  // NV21
             size  = ALIGN(alignedw*alignedh, 4096);
@@ -374,6 +394,11 @@ size_t getBufferSizeAndDimensions(int width, int height, int format,
             size = ALIGN((alignedw*alignedh) + (alignedw* alignedh)/2, 4096);
             break;
         default:
+            // Packed RGB formats, YUV sizes follow the codec rules above
+            if (info && (info->flags & FMT_RGB)) {
+                size = alignedw * alignedh * info->bpp;
+                break;
+            }
             ALOGE("unrecognized pixel format: 0x%x", format);
             return -EINVAL;
     }
@@ -383,71 +408,46 @@ size_t getBufferSizeAndDimensions(int width, int height, int format,
 
 int getYUVPlaneInfo(private_handle_t* hnd, struct android_ycbcr* ycbcr)
 {
-    int err = 0;
     int width = hnd->width;
     int height = hnd->height;
-    int format = hnd->format;
+    const format_info *info = getFormatInfo(hnd->format);
 
     unsigned int ystride, cstride;
-    unsigned int alignment = 4096;
 
     memset(ycbcr->reserved, 0, sizeof(ycbcr->reserved));
 
-    // Get the chroma offsets from the handle width/height. We take advantage
-    // of the fact the width _is_ the stride
-    switch (format) {
-        //Semiplanar
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
-        case HAL_PIXEL_FORMAT_NV12:
-        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP_VENUS:
-        case HAL_PIXEL_FORMAT_NV12_ENCODEABLE: //Same as YCbCr_420_SP_VENUS
-            ystride = cstride = width;
-            ycbcr->y  = (void*)hnd->base;
-            ycbcr->cb = (void*)(hnd->base + ystride * height);
-            ycbcr->cr = (void*)(hnd->base + ystride * height + 1);
-            ycbcr->ystride = ystride;
-            ycbcr->cstride = cstride;
-            ycbcr->chroma_step = 2;
-        break;
-
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-        case HAL_PIXEL_FORMAT_YCrCb_422_SP:
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP_ADRENO:
-        case HAL_PIXEL_FORMAT_NV21_ZSL:
-        //case HAL_PIXEL_FORMAT_RAW_SENSOR:
-            ystride = cstride = width;
-            ycbcr->y  = (void*)hnd->base;
-            ycbcr->cr = (void*)(hnd->base + ystride * height);
-            ycbcr->cb = (void*)(hnd->base + ystride * height + 1);
-            ycbcr->ystride = ystride;
-            ycbcr->cstride = cstride;
-            ycbcr->chroma_step = 2;
-        break;
+    // Only linear layouts with horizontally subsampled chroma can be
+    // described. Get the chroma offsets from the handle width/height, we
+    // take advantage of the fact the width _is_ the stride
+    if (!info || (info->flags & FMT_TILED) || info->hsub != 1 ||
+        (info->planes != 2 && info->planes != 3)) {
+        ALOGD("%s: Invalid format passed: 0x%x", __FUNCTION__, hnd->format);
+        return -EINVAL;
+    }
 
+    ystride = width;
+    ycbcr->y = (void*)hnd->base;
+    ycbcr->ystride = ystride;
+    if (info->planes == 2) {
+        //Semiplanar
+        cstride = width;
+        void *first = (void*)(hnd->base + ystride * height);
+        void *second = (void*)(hnd->base + ystride * height + 1);
+        ycbcr->cb = (info->chroma == FMT_CHROMA_CBCR) ? first : second;
+        ycbcr->cr = (info->chroma == FMT_CHROMA_CBCR) ? second : first;
+        ycbcr->chroma_step = 2;
+    } else {
         //Planar
-        case HAL_PIXEL_FORMAT_YV12:
-            ystride = width;
-            cstride = ALIGN(width/2, 16);
-            ycbcr->y  = (void*)hnd->base;
-            ycbcr->cr = (void*)(hnd->base + ystride * height);
-            ycbcr->cb = (void*)(hnd->base + ystride * height +
-                    cstride * height/2);
-            ycbcr->ystride = ystride;
-            ycbcr->cstride = cstride;
-            ycbcr->chroma_step = 1;
-
-        break;
-        //Unsupported formats
-        case HAL_PIXEL_FORMAT_YCbCr_422_I:
-        case HAL_PIXEL_FORMAT_YCrCb_422_I:
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED:
-        default:
-        ALOGD("%s: Invalid format passed: 0x%x", __FUNCTION__, format);
-        err = -EINVAL;
+        cstride = ALIGN(width/2, 16);
+        void *first = (void*)(hnd->base + ystride * height);
+        void *second = (void*)(hnd->base + ystride * height +
+                               cstride * height/2);
+        ycbcr->cb = (info->chroma == FMT_CHROMA_CBCR) ? first : second;
+        ycbcr->cr = (info->chroma == FMT_CHROMA_CBCR) ? second : first;
+        ycbcr->chroma_step = 1;
     }
-    return err;
-
+    ycbcr->cstride = cstride;
+    return 0;
 }
 
 // Allocate buffer from width, height and format into a
@@ -483,6 +483,36 @@ int alloc_buffer(private_handle_t **pHnd, int w, int h, int format, int usage)
     return 0;
 }
 
+size_t getMappedSize(const private_handle_t *hnd)
+{
+    if (hnd->flags & private_handle_t::PRIV_FLAGS_METADATA_COLOCATED)
+        return hnd->offset_metadata - hnd->offset +
+                ROUND_UP_PAGESIZE(sizeof(MetaData_t));
+    return hnd->size;
+}
+
+int mapBufferData(private_handle_t *hnd)
+{
+    // The framebuffer is always mapped, secure buffers never are
+    if (!hnd || hnd->base ||
+        (hnd->flags & (private_handle_t::PRIV_FLAGS_FRAMEBUFFER |
+                       private_handle_t::PRIV_FLAGS_SECURE_BUFFER)))
+        return 0;
+    gralloc::IAllocController* sAlloc =
+        gralloc::IAllocController::getInstance();
+    IMemAlloc* memalloc = sAlloc->getAllocator(hnd->flags);
+    void *base = 0;
+    int err = memalloc ? memalloc->map_buffer(&base, getMappedSize(hnd),
+                                              hnd->offset, hnd->fd) : -EINVAL;
+    if (err) {
+        ALOGE("%s: Could not mmap handle %p, fd=%d", __FUNCTION__,
+              hnd, hnd->fd);
+        return err;
+    }
+    hnd->base = intptr_t(base) + hnd->offset;
+    return 0;
+}
+
 void free_buffer(private_handle_t *hnd)
 {
     gralloc::IAllocController* sAlloc =
@@ -34,6 +34,7 @@ namespace gralloc {
 struct alloc_data;
 class IMemAlloc;
 class IonAlloc;
+class MemfdAlloc;
 
 class IAllocController {
 
@@ -64,8 +65,13 @@ class IonController : public IAllocController {
     IonController();
 
     private:
+    int getIonFlags(int usage);
+
     IonAlloc* mIonAlloc;
+    MemfdAlloc* mMemfdAlloc;
     bool mUseTZProtection;
+    // persist.gralloc.zero.force, ignore the usage based zeroing policy
+    bool mForceZero;
 
 };
 } //end namespace gralloc
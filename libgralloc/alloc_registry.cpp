@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2016 The Linux Foundation. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of The Linux Foundation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <cutils/atomic.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include "gralloc_priv.h"
+#include "format_info.h"
+#include "alloc_registry.h"
+
+using gralloc::AllocRegistry;
+
+AllocRegistry* AllocRegistry::sInstance = NULL;
+static pthread_once_t sInitOnce = PTHREAD_ONCE_INIT;
+
+void AllocRegistry::init()
+{
+    // On unless explicitly disabled
+    char property[PROPERTY_VALUE_MAX];
+    if ((property_get("persist.gralloc.alloc_registry", property,
+                      NULL) > 0) && (atoi(property) == 0))
+        return;
+    sInstance = new AllocRegistry();
+}
+
+// NULL when disabled, the property is only read once
+AllocRegistry* AllocRegistry::getInstance()
+{
+    pthread_once(&sInitOnce, init);
+    return sInstance;
+}
+
+AllocRegistry::AllocRegistry() : mLiveCount(0), mLiveBytes(0), mDropped(0)
+{
+    memset(mSlots, 0, sizeof(mSlots));
+}
+
+int32_t AllocRegistry::getKey(const private_handle_t* hnd)
+{
+    uint64_t p = (uintptr_t)hnd;
+    int32_t key = (int32_t)(p ^ (p >> 32));
+    if (!isLive(key))
+        key |= 4;
+    return key;
+}
+
+uint32_t AllocRegistry::hash(int32_t key)
+{
+    // Handles are heap pointers, mix out the allocator alignment
+    uint32_t h = (uint32_t)key;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h & (NUM_SLOTS - 1);
+}
+
+void AllocRegistry::add(const private_handle_t* hnd, int usage, int heapFlags)
+{
+    int32_t key = getKey(hnd);
+    uint32_t idx = hash(key);
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        Slot& slot = mSlots[(idx + i) & (NUM_SLOTS - 1)];
+        int32_t cur = android_atomic_acquire_load(&slot.key);
+        if (cur != SLOT_EMPTY && cur != SLOT_TOMBSTONE)
+            continue;
+        // Claim the slot, fill it in and only then publish the handle so
+        // that dumps never see a half written entry
+        if (android_atomic_acquire_cas(cur, SLOT_BUSY, &slot.key))
+            continue;
+        slot.handle = hnd;
+        slot.size = hnd->size;
+        slot.format = hnd->format;
+        slot.usage = usage;
+        slot.bufferType = hnd->bufferType;
+        slot.heapFlags = heapFlags;
+        slot.pid = getpid();
+        slot.tid = gettid();
+        slot.time = systemTime(SYSTEM_TIME_MONOTONIC);
+        android_atomic_release_store(key, &slot.key);
+        android_atomic_inc(&mLiveCount);
+        android_atomic_add(hnd->size, &mLiveBytes);
+        return;
+    }
+    android_atomic_inc(&mDropped);
+}
+
+void AllocRegistry::remove(const private_handle_t* hnd)
+{
+    int32_t key = getKey(hnd);
+    uint32_t idx = hash(key);
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        Slot& slot = mSlots[(idx + i) & (NUM_SLOTS - 1)];
+        int32_t cur = android_atomic_acquire_load(&slot.key);
+        if (cur == SLOT_EMPTY)
+            break;
+        if (cur != key || slot.handle != hnd)
+            continue;
+        android_atomic_dec(&mLiveCount);
+        android_atomic_add(-slot.size, &mLiveBytes);
+        android_atomic_release_store(SLOT_TOMBSTONE, &slot.key);
+        return;
+    }
+}
+
+struct histogram_bin {
+    int key;
+    int count;
+    int64_t bytes;
+};
+
+static void addToHistogram(histogram_bin* bins, int& numBins, int maxBins,
+                           int key, int size)
+{
+    for (int i = 0; i < numBins; i++) {
+        if (bins[i].key == key) {
+            bins[i].count++;
+            bins[i].bytes += size;
+            return;
+        }
+    }
+    // Everything past the last bin is accounted in it
+    if (numBins == maxBins) {
+        bins[maxBins - 1].count++;
+        bins[maxBins - 1].bytes += size;
+        return;
+    }
+    bins[numBins].key = key;
+    bins[numBins].count = 1;
+    bins[numBins].bytes = size;
+    numBins++;
+}
+
+#define DUMP(...) \
+    do { \
+        if (len - pos > 1) \
+            pos += snprintf(buf + pos, len - pos, __VA_ARGS__); \
+        if (pos > len - 1) \
+            pos = len - 1; \
+    } while (0)
+
+int AllocRegistry::dump(char* buf, int len)
+{
+    histogram_bin byUsage[MAX_HISTOGRAM];
+    histogram_bin byFormat[MAX_HISTOGRAM];
+    int numUsage = 0, numFormat = 0;
+    int pos = 0;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    if (!buf || len <= 0)
+        return 0;
+    buf[0] = '\0';
+
+    DUMP("gralloc allocations: %d live, %d KB, %d untracked\n",
+         android_atomic_acquire_load(&mLiveCount),
+         android_atomic_acquire_load(&mLiveBytes) / 1024,
+         android_atomic_acquire_load(&mDropped));
+
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        if (!isLive(android_atomic_acquire_load(&mSlots[i].key)))
+            continue;
+        addToHistogram(byUsage, numUsage, MAX_HISTOGRAM,
+                       mSlots[i].usage, mSlots[i].size);
+        addToHistogram(byFormat, numFormat, MAX_HISTOGRAM,
+                       mSlots[i].format, mSlots[i].size);
+    }
+
+    DUMP("by usage:\n");
+    for (int i = 0; i < numUsage; i++)
+        DUMP("  0x%08x: %d buffers, %d KB\n", byUsage[i].key,
+             byUsage[i].count, (int)(byUsage[i].bytes / 1024));
+
+    DUMP("by format:\n");
+    for (int i = 0; i < numFormat; i++) {
+        const format_info *info = getFormatInfo(byFormat[i].key);
+        DUMP("  %s (0x%x): %d buffers, %d KB\n", info ? info->name : "?",
+             byFormat[i].key, byFormat[i].count,
+             (int)(byFormat[i].bytes / 1024));
+    }
+
+    DUMP("handle             size      format     usage      type heap       "
+         "pid   tid   age(ms)\n");
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        const Slot& slot = mSlots[i];
+        int32_t key = android_atomic_acquire_load(&slot.key);
+        if (!isLive(key))
+            continue;
+        DUMP("%-18p %-9d 0x%08x 0x%08x %-4d 0x%08x %-5d %-5d %lld\n",
+             slot.handle, slot.size, slot.format, slot.usage, slot.bufferType,
+             slot.heapFlags, slot.pid, slot.tid,
+             (long long)ns2ms(now - slot.time));
+    }
+    return pos;
+}
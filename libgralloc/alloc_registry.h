@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2016 The Linux Foundation. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of The Linux Foundation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GRALLOC_ALLOC_REGISTRY_H
+#define GRALLOC_ALLOC_REGISTRY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Timers.h>
+
+struct private_handle_t;
+
+namespace gralloc {
+
+// Live gralloc allocations of this process, for finding out who owns
+// graphics memory. Entries live in a fixed open addressing table keyed by
+// handle; add and remove only take a few atomic operations and never
+// allocate, so the registry stays cheap enough to be on in production.
+// Allocations that don't fit in the table are only counted.
+class AllocRegistry {
+
+    public:
+    static AllocRegistry* getInstance();
+
+    void add(const private_handle_t* hnd, int usage, int heapFlags);
+
+    void remove(const private_handle_t* hnd);
+
+    // Text dump with totals, histograms by usage and by format and the
+    // live entries, truncated to len. Returns the length written.
+    int dump(char* buf, int len);
+
+    private:
+    enum {
+        NUM_SLOTS = 2048,   // power of 2
+        MAX_HISTOGRAM = 32,
+    };
+
+    // Slot keys, any other value is a live entry
+    enum {
+        SLOT_EMPTY = 0,
+        SLOT_TOMBSTONE = 1,
+        SLOT_BUSY = 2,
+    };
+
+    struct Slot {
+        volatile int32_t key;
+        const private_handle_t* handle;
+        int size;
+        int format;
+        int usage;
+        int bufferType;
+        int heapFlags;
+        pid_t pid;
+        pid_t tid;
+        nsecs_t time;
+    };
+
+    AllocRegistry();
+
+    static void init();
+
+    static uint32_t hash(int32_t key);
+
+    // Handle folded to 32 bits for the atomic slot key, the slot keeps the
+    // full handle for telling apart handles that fold the same
+    static int32_t getKey(const private_handle_t* hnd);
+
+    // Keys above 2GB are negative, so compare against each marker
+    static bool isLive(int32_t key) {
+        return key != SLOT_EMPTY && key != SLOT_TOMBSTONE && key != SLOT_BUSY;
+    }
+
+    Slot mSlots[NUM_SLOTS];
+    volatile int32_t mLiveCount;
+    volatile int32_t mLiveBytes;
+    volatile int32_t mDropped;
+
+    static AllocRegistry* sInstance;
+};
+
+}
+
+#endif /* GRALLOC_ALLOC_REGISTRY_H */
@@ -74,6 +74,15 @@ struct private_module_t {
     uint32_t zOrder;
     uint32_t updateZOrder;
     uint32_t fbIndex;
+    // fast post mode, debug.gralloc.fb_fast_post
+    uint32_t fastPost;
+    const struct prop_info *zOrderProp;
+    uint32_t zOrderSerial;
+    uint32_t zOrderRetry;
+    // release fences of the last two non-blocking commits, a commit's
+    // fence only signals once the commit after it is displayed
+    int commitFence[2];
+    uint32_t commitIndex;
 };
 
 
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2016 The Linux Foundation. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of The Linux Foundation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GRALLOC_FORMAT_INFO_H
+#define GRALLOC_FORMAT_INFO_H
+
+#include "gralloc_priv.h"
+
+// Layout of the first plane, chroma order and per-format flags
+enum {
+    FMT_CHROMA_NONE = 0,
+    FMT_CHROMA_CBCR,
+    FMT_CHROMA_CRCB,
+};
+
+enum {
+    FMT_RGB   = 0x1,  // RGB surface, stride is padded for the GPU
+    FMT_UI    = 0x2,  // allocated as a UI buffer
+    FMT_TILED = 0x4,  // 64x32 macro-tiled, no linear plane layout
+};
+
+/*
+ * One row per HAL format known to the display HAL:
+ *   format, dump name, bytes per pixel of plane 0, planes,
+ *   chroma subsampling shift (h, v), chroma order,
+ *   stride alignment in pixels (0: VENUS_Y_STRIDE), flags,
+ *   MDP format (-1: unsupported), C2D format (-1: unsupported)
+ * Users expand the columns they need with their own F(); the MDP and C2D
+ * columns are only expanded where their headers are included.
+ */
+#define GRALLOC_FORMAT_TABLE(F)                                              \
+    F(HAL_PIXEL_FORMAT_RGBA_8888, "RGBA_8888", 4, 1, 0, 0,                   \
+      FMT_CHROMA_NONE, 32, FMT_RGB | FMT_UI, MDP_RGBA_8888,                  \
+      C2D_COLOR_FORMAT_8888_ARGB | C2D_FORMAT_SWAP_RB)                       \
+    F(HAL_PIXEL_FORMAT_RGBX_8888, "RGBX_8888", 4, 1, 0, 0,                   \
+      FMT_CHROMA_NONE, 32, FMT_RGB | FMT_UI, MDP_RGBX_8888,                  \
+      C2D_COLOR_FORMAT_8888_ARGB | C2D_FORMAT_SWAP_RB |                      \
+      C2D_FORMAT_DISABLE_ALPHA)                                              \
+    F(HAL_PIXEL_FORMAT_RGB_888, "RGB_888", 3, 1, 0, 0,                       \
+      FMT_CHROMA_NONE, 32, FMT_RGB | FMT_UI, MDP_RGB_888, -1)                \
+    F(HAL_PIXEL_FORMAT_RGB_565, "RGB_565", 2, 1, 0, 0,                       \
+      FMT_CHROMA_NONE, 32, FMT_RGB | FMT_UI, MDP_RGB_565,                    \
+      C2D_COLOR_FORMAT_565_RGB)                                              \
+    F(HAL_PIXEL_FORMAT_BGRA_8888, "BGRA_8888", 4, 1, 0, 0,                   \
+      FMT_CHROMA_NONE, 32, FMT_RGB | FMT_UI, MDP_BGRA_8888,                  \
+      C2D_COLOR_FORMAT_8888_ARGB)                                            \
+    F(HAL_PIXEL_FORMAT_BGR_888, "BGR_888", 3, 1, 0, 0,                       \
+      FMT_CHROMA_NONE, 32, FMT_RGB | FMT_UI, MDP_BGR_888, -1)                \
+    F(HAL_PIXEL_FORMAT_R_8, "R_8", 1, 1, 0, 0,                               \
+      FMT_CHROMA_NONE, 32, FMT_UI, -1, -1)                                   \
+    F(HAL_PIXEL_FORMAT_RG_88, "RG_88", 2, 1, 0, 0,                           \
+      FMT_CHROMA_NONE, 32, FMT_UI, -1, -1)                                   \
+    F(HAL_PIXEL_FORMAT_YV12, "YV12", 1, 3, 1, 1,                             \
+      FMT_CHROMA_CRCB, 16, 0, MDP_Y_CR_CB_GH2V2, -1)                         \
+    F(HAL_PIXEL_FORMAT_YCbCr_420_SP, "YCbCr_420_SP", 1, 2, 1, 1,             \
+      FMT_CHROMA_CBCR, 16, 0, MDP_Y_CBCR_H2V2, C2D_COLOR_FORMAT_420_NV12)    \
+    F(HAL_PIXEL_FORMAT_YCrCb_420_SP, "YCrCb_420_SP_NV21", 1, 2, 1, 1,        \
+      FMT_CHROMA_CRCB, 16, 0, MDP_Y_CRCB_H2V2, C2D_COLOR_FORMAT_420_NV21)    \
+    F(HAL_PIXEL_FORMAT_NV12, "NV12", 1, 2, 1, 1,                             \
+      FMT_CHROMA_CBCR, 16, 0, -1, -1)                                        \
+    F(HAL_PIXEL_FORMAT_NV12_ENCODEABLE, "NV12_ENCODEABLE", 1, 2, 1, 1,       \
+      FMT_CHROMA_CBCR, 16, 0, -1, C2D_COLOR_FORMAT_420_NV12)                 \
+    F(HAL_PIXEL_FORMAT_YCbCr_420_SP_VENUS, "YCbCr_420_SP_VENUS", 1, 2, 1, 1, \
+      FMT_CHROMA_CBCR, 0, 0, MDP_Y_CBCR_H2V2_VENUS, -1)                      \
+    F(HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED, "YCbCr_420_SP_TILED_TILE_4x2",    \
+      1, 2, 1, 1, FMT_CHROMA_CBCR, 128, FMT_TILED, MDP_Y_CBCR_H2V2_TILE,      \
+      C2D_COLOR_FORMAT_420_NV12 | C2D_FORMAT_MACROTILED)                     \
+    F(HAL_PIXEL_FORMAT_YCrCb_420_SP_ADRENO, "YCrCb_420_SP_ADRENO",           \
+      1, 2, 1, 1, FMT_CHROMA_CRCB, 32, 0, -1, -1)                            \
+    F(HAL_PIXEL_FORMAT_NV21_ZSL, "NV21_ZSL", 1, 2, 1, 1,                     \
+      FMT_CHROMA_CRCB, 64, 0, -1, -1)                                        \
+    F(HAL_PIXEL_FORMAT_YCbCr_422_SP, "YCbCr_422_SP_NV16", 1, 2, 1, 0,        \
+      FMT_CHROMA_CBCR, 16, 0, MDP_Y_CBCR_H2V1, -1)                           \
+    F(HAL_PIXEL_FORMAT_YCrCb_422_SP, "YCrCb_422_SP", 1, 2, 1, 0,             \
+      FMT_CHROMA_CRCB, 16, 0, MDP_Y_CRCB_H2V1, -1)                           \
+    F(HAL_PIXEL_FORMAT_YCbCr_422_I, "YCbCr_422_I_YUY2", 2, 1, 1, 0,          \
+      FMT_CHROMA_CBCR, 16, 0, MDP_YCBYCR_H2V1, -1)                           \
+    F(HAL_PIXEL_FORMAT_YCrCb_422_I, "YCrCb_422_I_YVYU", 2, 1, 1, 0,          \
+      FMT_CHROMA_CRCB, 16, 0, MDP_YCRYCB_H2V1, -1)                           \
+    F(HAL_PIXEL_FORMAT_CbYCrY_422_I, "CbYCrY_422_I_UYVY", 2, 1, 1, 0,        \
+      FMT_CHROMA_CBCR, 16, 0, MDP_CBYCRY_H2V1, -1)                           \
+    F(HAL_PIXEL_FORMAT_CrYCbY_422_I, "CrYCbY_422_I_VYUY", 2, 1, 1, 0,        \
+      FMT_CHROMA_CRCB, 16, 0, MDP_CRYCBY_H2V1, -1)                           \
+    F(HAL_PIXEL_FORMAT_YCbCr_444_SP, "YCbCr_444_SP", 1, 2, 0, 0,             \
+      FMT_CHROMA_CBCR, 32, 0, MDP_Y_CBCR_H1V1, -1)                           \
+    F(HAL_PIXEL_FORMAT_YCrCb_444_SP, "YCrCb_444_SP", 1, 2, 0, 0,             \
+      FMT_CHROMA_CRCB, 32, 0, MDP_Y_CRCB_H1V1, -1)                           \
+    F(HAL_PIXEL_FORMAT_BLOB, "BLOB", 1, 1, 0, 0,                             \
+      FMT_CHROMA_NONE, 1, 0, -1, -1)                                         \
+    F(HAL_PIXEL_FORMAT_INTERLACE, "INTERLACE", 0, 0, 0, 0,                   \
+      FMT_CHROMA_NONE, 32, 0, -1, -1)
+
+struct format_info {
+    int format;
+    const char *name;
+    int bpp;
+    int planes;
+    int hsub;
+    int vsub;
+    int chroma;
+    int strideAlign;
+    int flags;
+};
+
+// Lookup compiles to a switch, the rows are constant data
+inline const format_info *getFormatInfo(int format)
+{
+#define FORMAT_INFO_CASE(fmt, name, bpp, planes, hsub, vsub, chroma,      \
+                         align, flags, mdp, c2d)                          \
+    case fmt: {                                                           \
+        static const format_info info = { fmt, name, bpp, planes, hsub,   \
+                                          vsub, chroma, align, flags };   \
+        return &info;                                                     \
+    }
+    switch (format) {
+        GRALLOC_FORMAT_TABLE(FORMAT_INFO_CASE)
+        default:
+            break;
+    }
+#undef FORMAT_INFO_CASE
+    return NULL;
+}
+
+#endif /* GRALLOC_FORMAT_INFO_H */
@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <cutils/atomic.h>
+#include <sys/system_properties.h>
+#include <sync/sync.h>
 
 #include <linux/fb.h>
 #include <linux/msm_mdp.h>
@@ -73,6 +75,9 @@ static const int mFbDisplayMappingLen =
 #define LENGTH_OF_NAME_MAX   64
 #define FB_ATTRIBUTE_DISPLAY_ID_PATH "/sys/class/graphics/fb%u/msm_fb_disp_id"
 #define KPI_LOG_MESSAGE      "fb_post[%s]"
+#define ZORDER_PROP_TEMPLATE "sys.fb.fb_layer_zorder.%d"
+// posts between lookups of a z-order property that isn't set yet
+#define ZORDER_PROP_RETRY    64
 
 static void place_marker(const char* str)
 {
@@ -129,6 +134,116 @@ static int fb_setSwapInterval(struct framebuffer_device_t* dev,
     return 0;
 }
 
+static void setZOrder(private_module_t* m, const char* value)
+{
+    uint32_t zOrder = atoi(value);
+    if (zOrder <= ZORDER_3) {
+        if (zOrder != m->zOrder) {
+            m->zOrder = zOrder;
+            m->updateZOrder = 1;
+        }
+    } else {
+        ALOGE("%s, zOrder=%d is out of bound [%d,%d], fbIndex=%d",
+            __FUNCTION__, zOrder, ZORDER_0, ZORDER_3, m->fbIndex);
+    }
+}
+
+static void readZOrder(private_module_t* m)
+{
+    char value[PROPERTY_VALUE_MAX];
+    char key[PROPERTY_KEY_MAX];
+
+    memset(key, 0x00, sizeof(key));
+    snprintf(key, PROPERTY_KEY_MAX, ZORDER_PROP_TEMPLATE, m->fbIndex);
+    if(property_get(key, value, NULL)) {
+        setZOrder(m, value);
+    } else {
+        ALOGV("%s no prop=%s, use zOrder=%d for fb layer",
+            __FUNCTION__, key, m->zOrder);
+    }
+}
+
+// Keeps the prop_info of the z-order property and only reads the value
+// back when its serial changes, so an unchanged z-order costs one load
+static void readZOrderCached(private_module_t* m)
+{
+    if (!m->zOrderProp) {
+        if (m->zOrderRetry--)
+            return;
+        m->zOrderRetry = ZORDER_PROP_RETRY;
+        char key[PROPERTY_KEY_MAX];
+        snprintf(key, PROPERTY_KEY_MAX, ZORDER_PROP_TEMPLATE, m->fbIndex);
+        m->zOrderProp = __system_property_find(key);
+        if (!m->zOrderProp)
+            return;
+        m->zOrderSerial = ~__system_property_serial(m->zOrderProp);
+    }
+
+    uint32_t serial = __system_property_serial(m->zOrderProp);
+    if (serial == m->zOrderSerial)
+        return;
+    char value[PROP_VALUE_MAX];
+    __system_property_read(m->zOrderProp, NULL, value);
+    m->zOrderSerial = serial;
+    setZOrder(m, value);
+}
+
+static void initFastPost(private_module_t* m)
+{
+    char property[PROPERTY_VALUE_MAX];
+    m->commitFence[0] = m->commitFence[1] = -1;
+    m->commitIndex = 0;
+    m->fastPost = (property_get("debug.gralloc.fb_fast_post", property,
+                                NULL) > 0) && (atoi(property) == 1);
+}
+
+// Commits without waiting for the frame to be displayed. The release fence
+// of the commit is kept and waited on two posts later, when the buffer of
+// this commit is reused. With fewer than three framebuffers fb_post waits on
+// the previous commit before returning instead. Returns 1 if the driver
+// can't hand out a fence and the caller has to do a blocking commit.
+static int commitNonBlocking(private_module_t* m, mdp_display_commit* commit)
+{
+    int releaseFd = -1;
+    mdp_buf_sync data;
+    memset(&data, 0, sizeof(data));
+    data.acq_fen_fd_cnt = 0;
+    data.rel_fen_fd = &releaseFd;
+    if (ioctl(m->mdpArbFd, MSMFB_BUFFER_SYNC, &data) < 0) {
+        ALOGE("%s: MSMFB_BUFFER_SYNC failed, str: %s, using blocking commits",
+                __FUNCTION__, strerror(errno));
+        m->fastPost = 0;
+        return 1;
+    }
+
+    commit->wait_for_finish = false;
+    if (ioctl(m->mdpArbFd, MSMFB_DISPLAY_COMMIT, commit)) {
+        int err = -errno;
+        if (releaseFd >= 0)
+            close(releaseFd);
+        return err;
+    }
+    // waitForCommit emptied this slot before the play
+    m->commitFence[m->commitIndex] = releaseFd;
+    m->commitIndex ^= 1;
+    return 0;
+}
+
+// Waits for the commit two posts back, whose fence signals once the
+// previous post is on screen
+static void waitForCommit(private_module_t* m)
+{
+    int& fence = m->commitFence[m->commitIndex];
+    if (fence < 0)
+        return;
+    if (sync_wait(fence, 1000) < 0) {
+        ALOGE("%s: sync_wait error!! error no = %d err str = %s",
+                __FUNCTION__, errno, strerror(errno));
+    }
+    close(fence);
+    fence = -1;
+}
+
 static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
 {
     private_module_t* m =
@@ -138,34 +253,16 @@ static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
     size_t offset = 0;
     msmfb_overlay_data overlay_data;
     char log_msg[LENGTH_OF_NAME_MAX];
-    char value[PROPERTY_VALUE_MAX];
-    char key[PROPERTY_KEY_MAX];
-    uint32_t zOrder = 0;
 
     memset(&overlay_data, 0x00, sizeof(overlay_data));
 
     if (!m->automotive)
         offset = hnd->base - m->framebuffer->base;
 
-    memset(key, 0x00, sizeof(key));
-    snprintf(key, PROPERTY_KEY_MAX,
-        "sys.fb.fb_layer_zorder.%d", m->fbIndex);
-    if(property_get(key, value, NULL)) {
-        zOrder = atoi(value);
-        if (zOrder <= ZORDER_3) {
-            if (zOrder != m->zOrder) {
-                m->zOrder = zOrder;
-                m->updateZOrder = 1;
-            }
-        } else {
-            ALOGE("%s, zOrder=%d is out of bound [%d,%d], fbIndex=%d",
-                __FUNCTION__, zOrder, ZORDER_0, ZORDER_3, m->fbIndex);
-        }
-    } else {
-        ALOGV("%s no prop=%s, use zOrder=%d for fb layer",
-            __FUNCTION__, key, m->zOrder);
-    }
-
+    if (m->fastPost)
+        readZOrderCached(m);
+    else
+        readZOrder(m);
 
     /* Set overlay first*/
     if(!m->setOverlay || m->updateZOrder) {
@@ -205,6 +302,9 @@ static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
         m->updateZOrder = 0;
     }
 
+    // The buffer posted two commits back may only be replaced once released
+    waitForCommit(m);
+
     overlay_data.id = m->overlay.id;
     overlay_data.data.memory_id = hnd->fd;
     overlay_data.data.offset = hnd->offset;
@@ -219,12 +319,24 @@ static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
     memset(&commit, 0x00, sizeof(commit));
     commit.flags = MDP_DISPLAY_COMMIT_OVERLAY;
     commit.wait_for_finish = true;
-    if(ioctl(m->mdpArbFd, MSMFB_DISPLAY_COMMIT, &commit)) {
+    int err = 1;
+    if (m->fastPost)
+        err = commitNonBlocking(m, &commit);
+    if (err == 1) {
+        commit.wait_for_finish = true;
+        err = ioctl(m->mdpArbFd, MSMFB_DISPLAY_COMMIT, &commit) ? -errno : 0;
+    }
+    if(err) {
         ALOGE("%s: MSMFB_DISPLAY_COMMIT for display=%s failed, str: %s",
                 __FUNCTION__, (m->display_id)?(m->display_id):"NULL",
-                strerror(errno));
-        return -errno;
-    } else if(m->automotive) {
+                strerror(-err));
+        return err;
+    }
+    // With double buffering the buffer handed back to the GPU is the one the
+    // previous commit scanned out, so it has to be released before returning
+    if (m->numBuffers < 3)
+        waitForCommit(m);
+    if(m->automotive) {
         /* Log KPI message for first fb post */
         if (!m->logKPI) {
             memset(log_msg, 0x00, LENGTH_OF_NAME_MAX);
@@ -235,7 +347,10 @@ static int fb_post(struct framebuffer_device_t* dev, buffer_handle_t buffer)
         }
     }
 
-    if(!m->automotive) {
+    // The overlay pipe already scans out the buffer. Panning the base layer
+    // as well is only needed when posting on the fb node directly.
+    bool arbitrated = m->framebuffer && (m->mdpArbFd != m->framebuffer->fd);
+    if(!m->automotive && !(m->fastPost && arbitrated)) {
         m->info.activate = FB_ACTIVATE_VBL;
         m->info.yoffset = offset / m->finfo.line_length;
         if (ioctl(m->framebuffer->fd, FBIOPUT_VSCREENINFO, &m->info) == -1) {
@@ -686,6 +801,11 @@ static int fb_close(struct hw_device_t *dev)
     mdp_display_commit commit;
     if (ctx) {
         private_module_t* m = (private_module_t*)ctx->device.common.module;
+        if (m) {
+            waitForCommit(m);
+            m->commitIndex ^= 1;
+            waitForCommit(m);
+        }
         if(m && m->framebuffer && (m->mdpArbFd >= 0) &&
             ((int)(m->overlay.id) >= 0) && (m->setOverlay)) {
             if(ioctl(m->mdpArbFd, MSMFB_OVERLAY_UNSET,
@@ -780,6 +900,7 @@ int fb_device_open(hw_module_t const* module, const char* name,
         dev->device.compositionComplete = fb_compositionComplete;
         m->mdpArbFd = -1;
         m->zOrder = DEFAULT_OVERLAY_Z_ORDER;
+        initFastPost(m);
 
         status = getFbIdx(m, name, &fb_idx);
         if (status) {
@@ -864,6 +985,7 @@ int framebuffer_open_ex(const struct hw_module_t* module, const char *name,
     m->display_id = getDisplayId(m, fb_idx);
     m->mdpArbFd = -1;
     m->zOrder = DEFAULT_OVERLAY_Z_ORDER;
+    initFastPost(m);
 
     status = bindMdpArb(m, name, fb_idx);
     if (status) {
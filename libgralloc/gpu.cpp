@@ -25,6 +25,8 @@
 #include "gpu.h"
 #include "memalloc.h"
 #include "alloc_controller.h"
+#include "format_info.h"
+#include "alloc_registry.h"
 #include <qdMetaData.h>
 #include "mdp_version.h"
 
@@ -52,6 +54,14 @@ gpu_context_t::gpu_context_t(const private_module_t* module,
 #endif
     free           = gralloc_free;
 
+    // Place MetaData_t in the tail of each buffer instead of allocating
+    // it separately, saving an fd, an allocation and a mapping per buffer
+    char property[PROPERTY_VALUE_MAX];
+    mColocateMetadata = false;
+    if ((property_get("persist.gralloc.metadata.colocate", property,
+                      NULL) > 0) && (atoi(property) == 1)) {
+        mColocateMetadata = true;
+    }
 }
 
 int gpu_context_t::gralloc_alloc_buffer(size_t size, int usage,
@@ -76,7 +86,10 @@ int gpu_context_t::gralloc_alloc_buffer(size_t size, int usage,
         data.align = ALIGN(data.align, SZ_1M);
         size = ALIGN(size, data.align);
     }
-    data.size = size;
+    // Secure buffers can't be mapped, they keep a separate metadata buffer
+    bool colocate = mColocateMetadata && !(usage & GRALLOC_USAGE_PROTECTED);
+    size_t metaSize = ROUND_UP_PAGESIZE(sizeof(MetaData_t));
+    data.size = colocate ? size + metaSize : size;
     data.pHandle = (unsigned int) pHandle;
     err = mAllocCtrl->allocate(data, usage);
 
@@ -86,13 +99,20 @@ int gpu_context_t::gralloc_alloc_buffer(size_t size, int usage,
         eData.fd = -1;
         eData.base = 0;
         eData.offset = 0;
-        eData.size = ROUND_UP_PAGESIZE(sizeof(MetaData_t));
+        eData.size = metaSize;
         eData.pHandle = data.pHandle;
         eData.align = getpagesize();
-        int eDataUsage = GRALLOC_USAGE_PRIVATE_SYSTEM_HEAP;
-        int eDataErr = mAllocCtrl->allocate(eData, eDataUsage);
-        ALOGE_IF(eDataErr, "gralloc failed for eDataErr=%s",
-                                          strerror(-eDataErr));
+        if (colocate) {
+            // page aligned tail of the main allocation, always clear it
+            eData.offset = size;
+            eData.base = data.base;
+            memset((char*)data.base + data.offset + size, 0, metaSize);
+        } else {
+            int eDataUsage = GRALLOC_USAGE_PRIVATE_SYSTEM_HEAP;
+            int eDataErr = mAllocCtrl->allocate(eData, eDataUsage);
+            ALOGE_IF(eDataErr, "gralloc failed for eDataErr=%s",
+                                              strerror(-eDataErr));
+        }
 
         if (usage & GRALLOC_USAGE_PRIVATE_EXTERNAL_ONLY) {
             flags |= private_handle_t::PRIV_FLAGS_EXTERNAL_ONLY;
@@ -148,13 +168,21 @@ int gpu_context_t::gralloc_alloc_buffer(size_t size, int usage,
 
         flags |= data.allocType;
         int eBaseAddr = int(eData.base) + eData.offset;
-        private_handle_t *hnd = new private_handle_t(data.fd, size, flags,
+        // size is the image only, the metadata tail is at offset_metadata
+        private_handle_t *hnd = new private_handle_t(data.fd,
+                colocate ? size : data.size, flags,
                 bufferType, format, width, height, eData.fd, eData.offset,
                 eBaseAddr);
 
         hnd->offset = data.offset;
         hnd->base = int(data.base) + data.offset;
         hnd->gpuaddr = 0;
+        if (colocate)
+            hnd->setMetadataColocated();
+
+        AllocRegistry* registry = AllocRegistry::getInstance();
+        if (registry)
+            registry->add(hnd, usage, data.allocType);
 
         *pHandle = hnd;
     }
@@ -167,13 +195,10 @@ int gpu_context_t::gralloc_alloc_buffer(size_t size, int usage,
 void gpu_context_t::getGrallocInformationFromFormat(int inputFormat,
                                                     int *bufferType)
 {
+    const format_info *info = getFormatInfo(inputFormat);
     *bufferType = BUFFER_TYPE_VIDEO;
 
-    if (inputFormat <= HAL_PIXEL_FORMAT_BGRA_8888) {
-        // RGB formats
-        *bufferType = BUFFER_TYPE_UI;
-    } else if ((inputFormat == HAL_PIXEL_FORMAT_R_8) ||
-               (inputFormat == HAL_PIXEL_FORMAT_RG_88)) {
+    if (info && (info->flags & FMT_UI)) {
         *bufferType = BUFFER_TYPE_UI;
     }
 }
@@ -329,11 +354,18 @@ int gpu_context_t::free_impl(private_handle_t const* hnd) {
 
         terminateBuffer(&m->base, const_cast<private_handle_t*>(hnd));
         IMemAlloc* memalloc = mAllocCtrl->getAllocator(hnd->flags);
-        int err = memalloc->free_buffer((void*)hnd->base, (size_t) hnd->size,
+        int err = memalloc->free_buffer((void*)hnd->base, getMappedSize(hnd),
                                         hnd->offset, hnd->fd);
         if(err)
             return err;
+        AllocRegistry* registry = AllocRegistry::getInstance();
+        if (registry)
+            registry->remove(hnd);
         // free the metadata space
+        if (hnd->flags & private_handle_t::PRIV_FLAGS_METADATA_COLOCATED) {
+            delete hnd;
+            return 0;
+        }
         unsigned long size = ROUND_UP_PAGESIZE(sizeof(MetaData_t));
         err = memalloc->free_buffer((void*)hnd->base_metadata,
                                     (size_t) size, hnd->offset_metadata,
@@ -68,6 +68,7 @@ class gpu_context_t : public alloc_device_t {
 
     private:
    IAllocController* mAllocCtrl;
+    bool mColocateMetadata;
     void getGrallocInformationFromFormat(int inputFormat,
                                          int *bufferType);
 };
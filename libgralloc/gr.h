@@ -60,6 +60,23 @@ int alloc_buffer(private_handle_t **pHnd, int w, int h, int format, int usage);
 void free_buffer(private_handle_t *hnd);
 int getYUVPlaneInfo(private_handle_t* pHnd, struct android_ycbcr* ycbcr);
 
+// Bytes of the fd the data plane mapping covers. That is size, plus the
+// metadata tail for handles with co-located metadata.
+size_t getMappedSize(const private_handle_t *hnd);
+
+// Map the data plane of a handle that was registered without it, see
+// persist.gralloc.lazy_map. Consumers that read hnd->base directly call
+// this first. The mapping is dropped when the handle is unregistered.
+int mapBufferData(private_handle_t *hnd);
+
+// Convert a YCbCr_420_SP_TILED image (64x32 macro-tiled NV12) to linear
+// NV12, or NV21 when swapUV is set. dstStride applies to both planes. The
+// tile rows are split in bands across numThreads threads, 0 picks one per
+// online CPU.
+int detileNV12(const uint8_t* src, int width, int height,
+               uint8_t* dstY, uint8_t* dstC, int dstStride,
+               bool swapUV, int numThreads);
+
 /*****************************************************************************/
 
 class Locker {
@@ -90,6 +90,8 @@ enum {
     GRALLOC_MODULE_PERFORM_GET_STRIDE,
     GRALLOC_MODULE_PERFORM_GET_CUSTOM_STRIDE_AND_HEIGHT_FROM_HANDLE,
     GRALLOC_MODULE_PERFORM_GET_YUV_PLANE_INFO,
+    /* (char* buf, int len): text dump of the live allocations */
+    GRALLOC_MODULE_PERFORM_DUMP_ALLOCATIONS,
 };
 
 #define GRALLOC_HEAP_MASK   (GRALLOC_USAGE_PRIVATE_UI_CONTIG_HEAP |\
@@ -178,6 +180,10 @@ struct private_handle_t : public native_handle {
             PRIV_FLAGS_ITU_R_601_FR       = 0x00400000,
             PRIV_FLAGS_ITU_R_709          = 0x00800000,
             PRIV_FLAGS_SECURE_DISPLAY     = 0x01000000,
+            PRIV_FLAGS_USES_MEMFD         = 0x02000000,
+            // MetaData_t lives in the tail of the buffer's own allocation,
+            // at offset_metadata past size
+            PRIV_FLAGS_METADATA_COLOCATED = 0x04000000,
         };
 
         // file-descriptors
@@ -224,10 +230,20 @@ struct private_handle_t : public native_handle {
             return (flags & PRIV_FLAGS_USES_PMEM) != 0;
         }
 
+        // Handles with co-located metadata carry a single fd, the
+        // fd_metadata slot is then an unused int.
+        void setMetadataColocated() {
+            flags |= PRIV_FLAGS_METADATA_COLOCATED;
+            fd_metadata = -1;
+            numInts = sNumInts + 1;
+            numFds = sNumFds - 1;
+        }
+
         static int validate(const native_handle* h) {
             const private_handle_t* hnd = (const private_handle_t*)h;
             if (!h || h->version != sizeof(native_handle) ||
-                h->numInts != sNumInts || h->numFds != sNumFds ||
+                !((h->numInts == sNumInts && h->numFds == sNumFds) ||
+                  (h->numInts == sNumInts + 1 && h->numFds == sNumFds - 1)) ||
                 hnd->magic != sMagic)
             {
                 ALOGD("Invalid gralloc handle (at %p): "
@@ -30,7 +30,9 @@
 #define DEBUG 0
 #include <linux/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <cutils/log.h>
 #include <errno.h>
@@ -40,9 +42,118 @@
 using gralloc::IonAlloc;
 
 #define ION_DEVICE "/dev/ion"
+#define MAX_IMPORTS 32
+
+// Heaps that hand out pages the kernel has already zeroed
+#define ZEROED_HEAPS ION_HEAP(ION_SYSTEM_HEAP_ID)
+// Buffers from this size on are zeroed by several threads
+#define PARALLEL_ZERO_SIZE (4 * 1024 * 1024)
+#define MAX_ZERO_THREADS 4
+
+struct ZeroChunk {
+    char *base;
+    size_t len;
+};
+
+// Helper threads for zeroing large buffers. They are started once and
+// kept, creating threads on every allocation costs about what they save.
+// One allocation at a time uses them, concurrent ones zero on their own.
+static struct {
+    pthread_once_t once;
+    pthread_mutex_t busy;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    ZeroChunk chunks[MAX_ZERO_THREADS - 1];
+    int next;
+    int count;
+    int remaining;
+    int workers;
+} sZero = { PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER,
+            PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+            PTHREAD_COND_INITIALIZER, {{0, 0}}, 0, 0, 0, 0 };
+
+static void *zeroWorker(void *)
+{
+    pthread_mutex_lock(&sZero.lock);
+    while (true) {
+        while (sZero.next >= sZero.count)
+            pthread_cond_wait(&sZero.work, &sZero.lock);
+        ZeroChunk chunk = sZero.chunks[sZero.next++];
+        pthread_mutex_unlock(&sZero.lock);
+        memset(chunk.base, 0, chunk.len);
+        pthread_mutex_lock(&sZero.lock);
+        if (--sZero.remaining == 0)
+            pthread_cond_signal(&sZero.done);
+    }
+    return NULL;
+}
+
+static void startZeroWorkers()
+{
+    int numCpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (numCpus > MAX_ZERO_THREADS)
+        numCpus = MAX_ZERO_THREADS;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 1; i < numCpus; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, zeroWorker, NULL))
+            break;
+        sZero.workers++;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// Zero a newly mapped buffer. Large buffers are split in page aligned
+// chunks across the helper threads, the memset of one core can't saturate
+// the bus.
+static void zeroBuffer(void *base, size_t len)
+{
+    if (len < PARALLEL_ZERO_SIZE) {
+        memset(base, 0, len);
+        return;
+    }
+    pthread_once(&sZero.once, startZeroWorkers);
+    if (!sZero.workers || pthread_mutex_trylock(&sZero.busy)) {
+        memset(base, 0, len);
+        return;
+    }
+
+    int numChunks = sZero.workers + 1;
+    size_t chunkLen = ALIGN(len / numChunks, getpagesize());
+    char *p = (char *)base;
+    pthread_mutex_lock(&sZero.lock);
+    for (int i = 0; i < sZero.workers; i++) {
+        sZero.chunks[i].base = p;
+        sZero.chunks[i].len = chunkLen;
+        p += chunkLen;
+    }
+    sZero.next = 0;
+    sZero.count = sZero.remaining = sZero.workers;
+    pthread_cond_broadcast(&sZero.work);
+    pthread_mutex_unlock(&sZero.lock);
+
+    // The caller takes the tail
+    memset(p, 0, len - (p - (char *)base));
+
+    pthread_mutex_lock(&sZero.lock);
+    while (sZero.remaining)
+        pthread_cond_wait(&sZero.done, &sZero.lock);
+    sZero.count = 0;
+    pthread_mutex_unlock(&sZero.lock);
+    pthread_mutex_unlock(&sZero.busy);
+}
 
 int IonAlloc::open_device()
 {
+    // Only opening the device is serialized, the ion ioctls themselves
+    // are safe to issue concurrently on one client
+    if(mIonFd >= 0)
+        return 0;
+
+    Locker::Autolock _l(mLock);
     if(mIonFd == FD_INIT)
         mIonFd = open(ION_DEVICE, O_RDONLY);
 
@@ -57,6 +168,8 @@ int IonAlloc::open_device()
 
 void IonAlloc::close_device()
 {
+    // Closing the ion client drops its imported handles
+    mImports.clear();
     if(mIonFd >= 0)
         close(mIonFd);
     mIonFd = FD_INIT;
@@ -64,7 +177,12 @@ void IonAlloc::close_device()
 
 int IonAlloc::alloc_buffer(alloc_data& data)
 {
-    Locker::Autolock _l(mLock);
+    // Callers without a zeroing policy always get a cleared buffer
+    return alloc_buffer(data, true);
+}
+
+int IonAlloc::alloc_buffer(alloc_data& data, bool zero)
+{
     int err = 0;
     struct ion_handle_data handle_data;
     struct ion_fd_data fd_data;
@@ -109,10 +227,18 @@ int IonAlloc::alloc_buffer(alloc_data& data)
             ioctl(mIonFd, ION_IOC_FREE, &handle_data);
             return err;
         }
-        memset(base, 0, ionAllocData.len);
-        // Clean cache after memset
-        clean_buffer(base, data.size, data.offset, fd_data.fd,
-                     CACHE_CLEAN_AND_INVALIDATE);
+        // The clear is only skipped when every heap in the mask hands out
+        // zeroed pages, other heaps may return stale contents
+        bool zeroedHeap = !(ionAllocData.heap_mask & ~ZEROED_HEAPS);
+        if (zero || !zeroedHeap) {
+            zeroBuffer(base, ionAllocData.len);
+            // Clean cache after memset, the allocation handle is still valid
+            cache_range range;
+            range.offset = data.offset;
+            range.length = data.size;
+            flush_ranges(ionAllocData.handle, base, &range, 1,
+                         CACHE_CLEAN_AND_INVALIDATE);
+        }
     }
 
     data.base = base;
@@ -126,7 +252,6 @@ int IonAlloc::alloc_buffer(alloc_data& data)
 
 int IonAlloc::free_buffer(void* base, size_t size, int offset, int fd)
 {
-    Locker::Autolock _l(mLock);
     ALOGD_IF(DEBUG, "ion: Freeing buffer base:%p size:%d fd:%d",
           base, size, fd);
     int err = 0;
@@ -136,6 +261,7 @@ int IonAlloc::free_buffer(void* base, size_t size, int offset, int fd)
 
     if(base)
         err = unmap_buffer(base, size, offset);
+    release_fd(fd);
     close(fd);
     return err;
 }
@@ -176,32 +302,65 @@ int IonAlloc::unmap_buffer(void *base, size_t size, int offset)
     return err;
 
 }
-int IonAlloc::clean_buffer(void *base, size_t size, int offset, int fd, int op)
+int IonAlloc::get_import(int fd, struct ion_handle** handle)
 {
-    struct ion_flush_data flush_data;
-    struct ion_fd_data fd_data;
-    struct ion_handle_data handle_data;
-    struct ion_handle* handle;
-    int err = 0;
-
-    err = open_device();
-    if (err)
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int err = -errno;
+        ALOGE("%s: fstat failed with error - %s", __FUNCTION__,
+              strerror(errno));
         return err;
+    }
+    ssize_t idx = mImports.indexOfKey(fd);
+    if (idx >= 0) {
+        if (mImports.valueAt(idx).ino == st.st_ino) {
+            *handle = mImports.valueAt(idx).handle;
+            return 0;
+        }
+        // The fd was closed and reused for another buffer
+        free_import(idx);
+    }
 
+    struct ion_fd_data fd_data;
     fd_data.fd = fd;
     if (ioctl(mIonFd, ION_IOC_IMPORT, &fd_data)) {
-        err = -errno;
+        int err = -errno;
         ALOGE("%s: ION_IOC_IMPORT failed with error - %s",
               __FUNCTION__, strerror(errno));
         return err;
     }
 
-    handle_data.handle = fd_data.handle;
-    flush_data.handle  = fd_data.handle;
-    flush_data.vaddr   = base;
-    flush_data.offset  = offset;
-    flush_data.length  = size;
+    // Keep the cache bounded, every entry holds a reference on its buffer
+    if (mImports.size() >= MAX_IMPORTS)
+        free_import(0);
+    Import import;
+    import.handle = fd_data.handle;
+    import.ino = st.st_ino;
+    mImports.add(fd, import);
+    *handle = fd_data.handle;
+    return 0;
+}
 
+void IonAlloc::free_import(size_t index)
+{
+    struct ion_handle_data handle_data;
+    handle_data.handle = mImports.valueAt(index).handle;
+    ioctl(mIonFd, ION_IOC_FREE, &handle_data);
+    mImports.removeItemsAt(index);
+}
+
+void IonAlloc::release_fd(int fd)
+{
+    Locker::Autolock _l(mImportLock);
+    ssize_t idx = mImports.indexOfKey(fd);
+    if (idx >= 0)
+        free_import(idx);
+}
+
+int IonAlloc::flush_ranges(struct ion_handle* handle, void *base,
+                           const cache_range *ranges, int count, int op)
+{
+    struct ion_flush_data flush_data;
     struct ion_custom_data d;
     switch(op) {
     case CACHE_CLEAN:
@@ -214,18 +373,47 @@ int IonAlloc::clean_buffer(void *base, size_t size, int offset, int fd, int op)
     default:
         d.cmd = ION_IOC_CLEAN_INV_CACHES;
     }
-
     d.arg = (unsigned long int)&flush_data;
 
-    if(ioctl(mIonFd, ION_IOC_CUSTOM, &d)) {
-        err = -errno;
-        ALOGE("%s: ION_IOC_CLEAN_INV_CACHES failed with error - %s",
-
-              __FUNCTION__, strerror(errno));
-        ioctl(mIonFd, ION_IOC_FREE, &handle_data);
-        return err;
+    for (int i = 0; i < count; i++) {
+        flush_data.handle  = handle;
+        flush_data.vaddr   = (char*)base + ranges[i].offset;
+        flush_data.offset  = ranges[i].offset;
+        flush_data.length  = ranges[i].length;
+        if(ioctl(mIonFd, ION_IOC_CUSTOM, &d)) {
+            int err = -errno;
+            ALOGE("%s: ION_IOC_CLEAN_INV_CACHES failed with error - %s",
+                  __FUNCTION__, strerror(errno));
+            return err;
+        }
     }
-    ioctl(mIonFd, ION_IOC_FREE, &handle_data);
     return 0;
 }
 
+int IonAlloc::clean_buffer(void *base, size_t size, int offset, int fd, int op)
+{
+    cache_range range;
+    range.offset = offset;
+    range.length = size;
+    // base already includes the offset
+    return clean_ranges((char*)base - offset, fd, &range, 1, op);
+}
+
+int IonAlloc::clean_ranges(void *base, int fd, const cache_range *ranges,
+                           int count, int op)
+{
+    struct ion_handle* handle;
+    int err = 0;
+
+    err = open_device();
+    if (err)
+        return err;
+
+    // Held across the flush, eviction or release_fd would free the handle
+    Locker::Autolock _l(mImportLock);
+    err = get_import(fd, &handle);
+    if (err)
+        return err;
+
+    return flush_ranges(handle, base, ranges, count, op);
+}
@@ -31,6 +31,7 @@
 #define GRALLOC_IONALLOC_H
 
 #include <linux/msm_ion.h>
+#include <utils/KeyedVector.h>
 #include "memalloc.h"
 #include "gr.h"
 
@@ -41,6 +42,10 @@ class IonAlloc : public IMemAlloc  {
     public:
     virtual int alloc_buffer(alloc_data& data);
 
+    // Allocate without clearing the buffer when zero is false and the
+    // heap hands out zeroed pages
+    int alloc_buffer(alloc_data& data, bool zero);
+
     virtual int free_buffer(void *base, size_t size,
                             int offset, int fd);
 
@@ -53,6 +58,11 @@ class IonAlloc : public IMemAlloc  {
     virtual int clean_buffer(void*base, size_t size,
                              int offset, int fd, int op);
 
+    virtual int clean_ranges(void *base, int fd, const cache_range *ranges,
+                             int count, int op);
+
+    virtual void release_fd(int fd);
+
     IonAlloc() { mIonFd = FD_INIT; }
 
     ~IonAlloc() { close_device(); }
@@ -60,11 +70,32 @@ class IonAlloc : public IMemAlloc  {
     private:
     int mIonFd;
 
+    // Imported ion handles of recently flushed fds, saves the
+    // ION_IOC_IMPORT/ION_IOC_FREE pair on every cache operation. Entries
+    // are dropped by release_fd, which must be called before the fd is
+    // closed, and the inode catches fds reused for another buffer where
+    // dma-bufs have their own inode.
+    struct Import {
+        struct ion_handle* handle;
+        ino_t ino;
+    };
+    android::KeyedVector<int, Import> mImports;
+
     int open_device();
 
     void close_device();
 
+    // Called with mImportLock held, the handle is only valid until the
+    // lock is dropped
+    int get_import(int fd, struct ion_handle** handle);
+
+    void free_import(size_t index);
+
+    int flush_ranges(struct ion_handle* handle, void *base,
+                     const cache_range *ranges, int count, int op);
+
     mutable Locker mLock;
+    mutable Locker mImportLock;
 
 };
 
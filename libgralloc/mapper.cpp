@@ -19,32 +19,150 @@
 #include <errno.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <linux/ashmem.h>
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
 #include <cutils/ashmem.h>
+#include <cutils/properties.h>
 
 #include <hardware/hardware.h>
 #include <hardware/gralloc.h>
 #include <linux/android_pmem.h>
+#include <utils/KeyedVector.h>
 
 #include "gralloc_priv.h"
 #include "gr.h"
 #include "alloc_controller.h"
 #include "memalloc.h"
+#include "alloc_registry.h"
 #include <qdMetaData.h>
 
 using namespace gralloc;
 /*****************************************************************************/
 
+// Byte ranges covered by the current software lock of a buffer, so that
+// the cache maintenance at lock and unlock time is limited to the rect
+struct lock_ranges {
+    cache_range range[3];
+    int count;
+};
+
+static android::KeyedVector<intptr_t, lock_ranges> sLockRanges;
+static pthread_mutex_t sLockRangesLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Range of rows y0..y1 and bytes x0..x1 of a plane
+static cache_range planeRange(size_t planeOffset, size_t pitch,
+                              size_t x0, size_t x1, size_t y0, size_t y1)
+{
+    cache_range range;
+    range.offset = planeOffset + y0 * pitch + x0;
+    range.length = (y1 - 1) * pitch + x1 - (y0 * pitch + x0);
+    return range;
+}
+
+// Fill in the ranges of the buffer touched by the lock rect, one per
+// plane, and return their count. Falls back to the whole buffer for full
+// or invalid rects and layouts that aren't known here.
+static int getLockRanges(private_handle_t* hnd, int l, int t, int w, int h,
+                         cache_range* range)
+{
+    size_t stride = hnd->width;
+    size_t height = hnd->height;
+    int count = 0;
+    int bpp = 0;
+
+    range[0].offset = 0;
+    range[0].length = hnd->size;
+    if (l < 0 || t < 0 || w <= 0 || h <= 0 ||
+        (size_t)(l + w) > stride || (size_t)(t + h) > height ||
+        (l == 0 && t == 0 && (size_t)w == stride && (size_t)h == height))
+        return 1;
+
+    switch (hnd->format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+            bpp = 4;
+            break;
+        case HAL_PIXEL_FORMAT_RGB_888:
+        case HAL_PIXEL_FORMAT_BGR_888:
+            bpp = 3;
+            break;
+        case HAL_PIXEL_FORMAT_RGB_565:
+            bpp = 2;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+        case HAL_PIXEL_FORMAT_YCrCb_422_I:
+            // a macro pixel spans two pixels
+            w = ALIGN(w + (l & 1), 2);
+            l &= ~1;
+            bpp = 2;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            range[count++] = planeRange(0, stride, l, l + w, t, t + h);
+            // interleaved chroma, subsampled by 2 both ways
+            range[count++] = planeRange(stride * height, stride,
+                                        l & ~1, ALIGN(l + w, 2),
+                                        t / 2, (t + h + 1) / 2);
+            break;
+        case HAL_PIXEL_FORMAT_YV12: {
+            size_t cstride = ALIGN(stride / 2, 16);
+            size_t crOffset = stride * height;
+            size_t cbOffset = crOffset + cstride * height / 2;
+            range[count++] = planeRange(0, stride, l, l + w, t, t + h);
+            range[count++] = planeRange(crOffset, cstride, l / 2,
+                                        (l + w + 1) / 2, t / 2,
+                                        (t + h + 1) / 2);
+            range[count++] = planeRange(cbOffset, cstride, l / 2,
+                                        (l + w + 1) / 2, t / 2,
+                                        (t + h + 1) / 2);
+            break;
+        }
+        default:
+            return 1;
+    }
+
+    if (bpp)
+        range[count++] = planeRange(0, stride * bpp, l * bpp,
+                                    (l + w) * bpp, t, t + h);
+
+    for (int i = 0; i < count; i++) {
+        if (range[i].offset + range[i].length > (size_t)hnd->size) {
+            range[0].offset = 0;
+            range[0].length = hnd->size;
+            return 1;
+        }
+    }
+    return count;
+}
+
+static void removeLockRanges(private_handle_t* hnd, lock_ranges* ranges)
+{
+    pthread_mutex_lock(&sLockRangesLock);
+    ssize_t idx = sLockRanges.indexOfKey(intptr_t(hnd));
+    if (idx >= 0) {
+        if (ranges)
+            *ranges = sLockRanges.valueAt(idx);
+        sLockRanges.removeItemsAt(idx);
+    } else if (ranges) {
+        ranges->range[0].offset = 0;
+        ranges->range[0].length = hnd->size;
+        ranges->count = 1;
+    }
+    pthread_mutex_unlock(&sLockRangesLock);
+}
+
 // Return the type of allocator -
 // these are used for mapping/unmapping
 static IMemAlloc* getAllocator(int flags)
@@ -55,36 +173,189 @@ static IMemAlloc* getAllocator(int flags)
     return memalloc;
 }
 
+// Per-process cache of data plane mappings, so that handles of the same
+// buffer share one VMA. Buffers are identified by the inode of their fd,
+// which only works where each dma-buf has its own inode; fds that report
+// the shared anon inode are never cached. Older kernels, 3.4 among them,
+// put every dma-buf on that inode, so persist.gralloc.map_cache is a no-op
+// there.
+struct map_key {
+    dev_t dev;
+    ino_t ino;
+    int offset;
+    bool operator<(const map_key& rhs) const {
+        if (dev != rhs.dev) return dev < rhs.dev;
+        if (ino != rhs.ino) return ino < rhs.ino;
+        return offset < rhs.offset;
+    }
+};
+
+struct map_entry {
+    void *base;
+    size_t size;
+    int refs;
+};
+
+static android::KeyedVector<map_key, map_entry> sMapCache;
+static pthread_mutex_t sMapCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+enum {
+    MAP_LAZY  = 0x1,  // map the data plane on first lock only
+    MAP_CACHE = 0x2,  // share data plane mappings between handles
+};
+
+static int getMapPolicy()
+{
+    static int policy = -1;
+    if (policy < 0) {
+        char property[PROPERTY_VALUE_MAX];
+        int p = 0;
+        if ((property_get("persist.gralloc.lazy_map", property, NULL) > 0) &&
+            (atoi(property) == 1))
+            p |= MAP_LAZY;
+        if ((property_get("persist.gralloc.map_cache", property, NULL) > 0) &&
+            (atoi(property) == 1))
+            p |= MAP_CACHE;
+        policy = p;
+    }
+    return policy;
+}
+
+static bool getMapKey(private_handle_t* hnd, map_key& key)
+{
+    static ino_t anonIno = 0;
+    struct stat st;
+    if (!anonIno) {
+        // eventfds live on the shared anon inode, like old dma-bufs
+        int efd = eventfd(0, 0);
+        if (efd < 0)
+            return false;
+        if (!fstat(efd, &st))
+            anonIno = st.st_ino;
+        close(efd);
+    }
+    if (fstat(hnd->fd, &st))
+        return false;
+    if (st.st_ino == anonIno) {
+        static bool warned = false;
+        ALOGW_IF(!warned, "%s: dma-bufs share the anon inode, "
+                 "persist.gralloc.map_cache has no effect", __FUNCTION__);
+        warned = true;
+        return false;
+    }
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    key.offset = hnd->offset;
+    return true;
+}
+
+static int gralloc_map_data(private_handle_t* hnd, IMemAlloc* memalloc)
+{
+    void *mappedAddress = MAP_FAILED;
+    size_t size = getMappedSize(hnd);
+    map_key key;
+    bool cache = (getMapPolicy() & MAP_CACHE) && getMapKey(hnd, key);
+
+    if (cache) {
+        pthread_mutex_lock(&sMapCacheLock);
+        ssize_t idx = sMapCache.indexOfKey(key);
+        if (idx >= 0 && sMapCache.valueAt(idx).size >= size) {
+            map_entry& entry = sMapCache.editValueAt(idx);
+            entry.refs++;
+            hnd->base = intptr_t(entry.base) + hnd->offset;
+            pthread_mutex_unlock(&sMapCacheLock);
+            return 0;
+        }
+        pthread_mutex_unlock(&sMapCacheLock);
+    }
+
+    int err = memalloc->map_buffer(&mappedAddress, size,
+                                   hnd->offset, hnd->fd);
+    if(err || mappedAddress == MAP_FAILED) {
+        ALOGE("Could not mmap handle %p, fd=%d (%s)",
+              hnd, hnd->fd, strerror(errno));
+        hnd->base = 0;
+        return -errno;
+    }
+    hnd->base = intptr_t(mappedAddress) + hnd->offset;
+
+    if (cache) {
+        pthread_mutex_lock(&sMapCacheLock);
+        if (sMapCache.indexOfKey(key) < 0) {
+            map_entry entry;
+            entry.base = mappedAddress;
+            entry.size = size;
+            entry.refs = 1;
+            sMapCache.add(key, entry);
+        }
+        pthread_mutex_unlock(&sMapCacheLock);
+    }
+    return 0;
+}
+
+// Drop a reference on a cached mapping, returns true while other handles
+// still use it and it must stay mapped
+static bool putCachedMapping(void *base)
+{
+    bool inUse = false;
+    pthread_mutex_lock(&sMapCacheLock);
+    for (size_t i = 0; i < sMapCache.size(); i++) {
+        if (sMapCache.valueAt(i).base == base) {
+            map_entry& entry = sMapCache.editValueAt(i);
+            if (--entry.refs > 0)
+                inUse = true;
+            else
+                sMapCache.removeItemsAt(i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sMapCacheLock);
+    return inUse;
+}
+
+static int gralloc_map_metadata(private_handle_t* hnd, IMemAlloc* memalloc)
+{
+    void *mappedAddress = MAP_FAILED;
+    if (hnd->flags & private_handle_t::PRIV_FLAGS_METADATA_COLOCATED) {
+        // covered by the data plane mapping
+        hnd->base_metadata = hnd->base - hnd->offset + hnd->offset_metadata;
+        return 0;
+    }
+    size_t size = ROUND_UP_PAGESIZE(sizeof(MetaData_t));
+    int err = memalloc->map_buffer(&mappedAddress, size,
+                                   hnd->offset_metadata, hnd->fd_metadata);
+    if(err || mappedAddress == MAP_FAILED) {
+        ALOGE("Could not mmap handle %p, fd=%d (%s)",
+              hnd, hnd->fd_metadata, strerror(errno));
+        hnd->base_metadata = 0;
+        return -errno;
+    }
+    hnd->base_metadata = intptr_t(mappedAddress) + hnd->offset_metadata;
+    return 0;
+}
+
+// Map whatever part of the buffer isn't mapped yet. With lazyData set
+// only the metadata is mapped, the data plane follows on the first lock.
 static int gralloc_map(gralloc_module_t const* module,
-                       buffer_handle_t handle)
+                       buffer_handle_t handle, bool lazyData = false)
 {
     private_handle_t* hnd = (private_handle_t*)handle;
-    void *mappedAddress;
     if (!(hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER) &&
         !(hnd->flags & private_handle_t::PRIV_FLAGS_SECURE_BUFFER)) {
-        size_t size = hnd->size;
         IMemAlloc* memalloc = getAllocator(hnd->flags) ;
-        int err = memalloc->map_buffer(&mappedAddress, size,
-                                       hnd->offset, hnd->fd);
-        if(err || mappedAddress == MAP_FAILED) {
-            ALOGE("Could not mmap handle %p, fd=%d (%s)",
-                  handle, hnd->fd, strerror(errno));
-            hnd->base = 0;
-            return -errno;
-        }
-
-        hnd->base = intptr_t(mappedAddress) + hnd->offset;
-        mappedAddress = MAP_FAILED;
-        size = ROUND_UP_PAGESIZE(sizeof(MetaData_t));
-        err = memalloc->map_buffer(&mappedAddress, size,
-                                       hnd->offset_metadata, hnd->fd_metadata);
-        if(err || mappedAddress == MAP_FAILED) {
-            ALOGE("Could not mmap handle %p, fd=%d (%s)",
-                  handle, hnd->fd_metadata, strerror(errno));
-            hnd->base_metadata = 0;
-            return -errno;
+        int err = 0;
+        // Co-located metadata needs the data plane mapping
+        if (lazyData &&
+            (hnd->flags & private_handle_t::PRIV_FLAGS_METADATA_COLOCATED))
+            lazyData = false;
+        if (!hnd->base && !lazyData) {
+            err = gralloc_map_data(hnd, memalloc);
+            if (err)
+                return err;
         }
-        hnd->base_metadata = intptr_t(mappedAddress) + hnd->offset_metadata;
+        if (!hnd->base_metadata)
+            err = gralloc_map_metadata(hnd, memalloc);
+        return err;
     }
     return 0;
 }
@@ -96,18 +367,26 @@ static int gralloc_unmap(gralloc_module_t const* module,
     if (!(hnd->flags & private_handle_t::PRIV_FLAGS_FRAMEBUFFER)) {
         int err = -EINVAL;
         void* base = (void*)hnd->base;
-        size_t size = hnd->size;
+        size_t size = getMappedSize(hnd);
         IMemAlloc* memalloc = getAllocator(hnd->flags) ;
+        removeLockRanges(hnd, NULL);
         if(memalloc != NULL) {
-            err = memalloc->unmap_buffer(base, size, hnd->offset);
-            if (err) {
-                ALOGE("Could not unmap memory at address %p", base);
+            memalloc->release_fd(hnd->fd);
+            if (base && !putCachedMapping((char*)base - hnd->offset)) {
+                err = memalloc->unmap_buffer(base, size, hnd->offset);
+                if (err) {
+                    ALOGE("Could not unmap memory at address %p", base);
+                }
             }
-            base = (void*)hnd->base_metadata;
-            size = ROUND_UP_PAGESIZE(sizeof(MetaData_t));
-            err = memalloc->unmap_buffer(base, size, hnd->offset_metadata);
-            if (err) {
-                ALOGE("Could not unmap memory at address %p", base);
+            if (hnd->base_metadata && !(hnd->flags &
+                  private_handle_t::PRIV_FLAGS_METADATA_COLOCATED)) {
+                base = (void*)hnd->base_metadata;
+                size = ROUND_UP_PAGESIZE(sizeof(MetaData_t));
+                err = memalloc->unmap_buffer(base, size,
+                                             hnd->offset_metadata);
+                if (err) {
+                    ALOGE("Could not unmap memory at address %p", base);
+                }
             }
         }
     }
@@ -142,7 +421,7 @@ int gralloc_register_buffer(gralloc_module_t const* module,
     private_handle_t* hnd = (private_handle_t*)handle;
     hnd->base = 0;
     hnd->base_metadata = 0;
-    int err = gralloc_map(module, handle);
+    int err = gralloc_map(module, handle, getMapPolicy() & MAP_LAZY);
     if (err) {
         ALOGE("%s: gralloc_map failed", __FUNCTION__);
         return err;
@@ -165,7 +444,7 @@ int gralloc_unregister_buffer(gralloc_module_t const* module,
 
     private_handle_t* hnd = (private_handle_t*)handle;
 
-    if (hnd->base != 0) {
+    if (hnd->base != 0 || hnd->base_metadata != 0) {
         gralloc_unmap(module, handle);
     }
     hnd->base = 0;
@@ -181,12 +460,13 @@ int terminateBuffer(gralloc_module_t const* module,
      * to un-map it. It's an error to be here with a locked buffer.
      */
 
-    if (hnd->base != 0) {
+    if (hnd->base != 0 || hnd->base_metadata != 0) {
         // this buffer was mapped, unmap it now
         if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_PMEM |
                           private_handle_t::PRIV_FLAGS_USES_PMEM_ADSP |
                           private_handle_t::PRIV_FLAGS_USES_ASHMEM |
-                          private_handle_t::PRIV_FLAGS_USES_ION)) {
+                          private_handle_t::PRIV_FLAGS_USES_ION |
+                          private_handle_t::PRIV_FLAGS_USES_MEMFD)) {
                 gralloc_unmap(module, hnd);
         } else {
             ALOGE("terminateBuffer: unmapping a non pmem/ashmem buffer flags = 0x%x",
@@ -215,13 +495,20 @@ static int gralloc_map_and_invalidate (gralloc_module_t const* module,
             err = gralloc_map(module, handle);
             pthread_mutex_unlock(lock);
         }
-        if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION) {
+        if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION |
+                          private_handle_t::PRIV_FLAGS_USES_MEMFD)) {
             //Invalidate if reading in software. No need to do this for the
             //metadata buffer as it is only read/written in software.
+            //Only the locked rect is maintained, here and at unlock.
+            lock_ranges ranges;
+            ranges.count = getLockRanges(hnd, l, t, w, h, ranges.range);
             IMemAlloc* memalloc = getAllocator(hnd->flags) ;
-            err = memalloc->clean_buffer((void*)hnd->base,
-                                         hnd->size, hnd->offset, hnd->fd,
+            err = memalloc->clean_ranges((void*)hnd->base, hnd->fd,
+                                         ranges.range, ranges.count,
                                          CACHE_INVALIDATE);
+            pthread_mutex_lock(&sLockRangesLock);
+            sLockRanges.add(intptr_t(hnd), ranges);
+            pthread_mutex_unlock(&sLockRangesLock);
             if (usage & GRALLOC_USAGE_SW_WRITE_MASK) {
                 // Mark the buffer to be flushed after cpu read/write
                 hnd->flags |= private_handle_t::PRIV_FLAGS_NEEDS_FLUSH;
@@ -266,10 +553,13 @@ int gralloc_unlock(gralloc_module_t const* module,
     private_handle_t* hnd = (private_handle_t*)handle;
     IMemAlloc* memalloc = getAllocator(hnd->flags);
 
-    if (hnd->flags & private_handle_t::PRIV_FLAGS_USES_ION) {
+    if (hnd->flags & (private_handle_t::PRIV_FLAGS_USES_ION |
+                      private_handle_t::PRIV_FLAGS_USES_MEMFD)) {
+        lock_ranges ranges;
+        removeLockRanges(hnd, &ranges);
         if (hnd->flags & private_handle_t::PRIV_FLAGS_NEEDS_FLUSH) {
-            err = memalloc->clean_buffer((void*)hnd->base,
-                                         hnd->size, hnd->offset, hnd->fd,
+            err = memalloc->clean_ranges((void*)hnd->base, hnd->fd,
+                                         ranges.range, ranges.count,
                                          CACHE_CLEAN_AND_INVALIDATE);
             hnd->flags &= ~private_handle_t::PRIV_FLAGS_NEEDS_FLUSH;
         } else if(hnd->flags & private_handle_t::PRIV_FLAGS_DO_NOT_FLUSH) {
@@ -277,8 +567,8 @@ int gralloc_unlock(gralloc_module_t const* module,
         } else {
             //Probably a round about way to do this, but this avoids adding new
             //flags
-            err = memalloc->clean_buffer((void*)hnd->base,
-                                         hnd->size, hnd->offset, hnd->fd,
+            err = memalloc->clean_ranges((void*)hnd->base, hnd->fd,
+                                         ranges.range, ranges.count,
                                          CACHE_INVALIDATE);
         }
     }
@@ -362,6 +652,17 @@ int gralloc_perform(struct gralloc_module_t const* module,
                 }
             } break;
 
+        case GRALLOC_MODULE_PERFORM_DUMP_ALLOCATIONS:
+            {
+                char* buf = va_arg(args, char*);
+                int len = va_arg(args, int);
+                AllocRegistry* registry = AllocRegistry::getInstance();
+                if (buf && registry) {
+                    registry->dump(buf, len);
+                    res = 0;
+                }
+            } break;
+
         default:
             break;
     }
@@ -40,6 +40,12 @@ enum {
     CACHE_CLEAN_AND_INVALIDATE,
 };
 
+// Byte range of a buffer, relative to its mapped base
+struct cache_range {
+    size_t         offset;
+    size_t         length;
+};
+
 struct alloc_data {
     void           *base;
     int            fd;
@@ -76,6 +82,20 @@ class IMemAlloc {
     virtual int clean_buffer(void *base, size_t size,
                              int offset, int fd, int op) = 0;
 
+    // Clean and invalidate several ranges of one buffer
+    virtual int clean_ranges(void *base, int fd, const cache_range *ranges,
+                             int count, int op) {
+        int err = 0;
+        for (int i = 0; i < count && !err; i++) {
+            err = clean_buffer((char*)base + ranges[i].offset,
+                               ranges[i].length, ranges[i].offset, fd, op);
+        }
+        return err;
+    }
+
+    // Drop any per-fd state, called before the fd is closed
+    virtual void release_fd(int fd) {};
+
     // Destructor
     virtual ~IMemAlloc() {};
 
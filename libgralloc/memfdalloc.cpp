@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2016 The Linux Foundation. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of The Linux Foundation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define DEBUG 0
+#include <linux/ioctl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cutils/log.h>
+#include <errno.h>
+#include "gralloc_priv.h"
+#include "memfdalloc.h"
+
+using gralloc::MemfdAlloc;
+
+#define DMA_HEAP_DEVICE "/dev/dma_heap/system"
+
+// From the linux/dma-heap.h and linux/dma-buf.h UAPI, which older kernel
+// headers do not ship.
+#ifndef DMA_HEAP_IOCTL_ALLOC
+struct dma_heap_allocation_data {
+    uint64_t len;
+    uint32_t fd;
+    uint32_t fd_flags;
+    uint64_t heap_flags;
+};
+#define DMA_HEAP_IOC_MAGIC      'H'
+#define DMA_HEAP_IOCTL_ALLOC    _IOWR(DMA_HEAP_IOC_MAGIC, 0x0,\
+                                      struct dma_heap_allocation_data)
+#endif
+
+#ifndef DMA_BUF_IOCTL_SYNC
+struct dma_buf_sync {
+    uint64_t flags;
+};
+#define DMA_BUF_SYNC_READ       (1 << 0)
+#define DMA_BUF_SYNC_WRITE      (2 << 0)
+#define DMA_BUF_SYNC_RW         (DMA_BUF_SYNC_READ | DMA_BUF_SYNC_WRITE)
+#define DMA_BUF_SYNC_START      (0 << 2)
+#define DMA_BUF_SYNC_END        (1 << 2)
+#define DMA_BUF_BASE            'b'
+#define DMA_BUF_IOCTL_SYNC      _IOW(DMA_BUF_BASE, 0, struct dma_buf_sync)
+#endif
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+static int memfd_alloc(size_t size)
+{
+#ifdef __NR_memfd_create
+    int fd = syscall(__NR_memfd_create, "gralloc", MFD_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    if (ftruncate(fd, size)) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    return fd;
+#else
+    return -ENOSYS;
+#endif
+}
+
+int MemfdAlloc::open_device()
+{
+    // The dma-buf heap is optional, only look for it once
+    if (!mHeapChecked) {
+        mHeapChecked = true;
+        mHeapFd = open(DMA_HEAP_DEVICE, O_RDONLY | O_CLOEXEC);
+        if (mHeapFd < 0) {
+            ALOGI("%s: %s not available, using memfd", __FUNCTION__,
+                  DMA_HEAP_DEVICE);
+            mHeapFd = FD_INIT;
+        }
+    }
+    return mHeapFd;
+}
+
+void MemfdAlloc::close_device()
+{
+    if(mHeapFd >= 0)
+        close(mHeapFd);
+    mHeapFd = FD_INIT;
+    mHeapChecked = false;
+}
+
+int MemfdAlloc::alloc_buffer(alloc_data& data)
+{
+    Locker::Autolock _l(mLock);
+    int err = 0;
+    int fd = -1;
+    void *base = 0;
+
+    // Both backends hand out page aligned memory. Larger alignments only
+    // matter for physically contiguous ION heaps, here the size is rounded
+    // up to them so that buffers keep the size ION would have given.
+    size_t align = data.align > (size_t)getpagesize() ?
+                   data.align : getpagesize();
+    size_t size = ALIGN(data.size, align);
+
+    if (open_device() >= 0) {
+        struct dma_heap_allocation_data heapData;
+        memset(&heapData, 0, sizeof(heapData));
+        heapData.len = size;
+        heapData.fd_flags = O_RDWR | O_CLOEXEC;
+        if (ioctl(mHeapFd, DMA_HEAP_IOCTL_ALLOC, &heapData)) {
+            ALOGW("%s: DMA_HEAP_IOCTL_ALLOC failed with error - %s,"
+                  " trying memfd", __FUNCTION__, strerror(errno));
+        } else {
+            fd = heapData.fd;
+        }
+    }
+
+    if (fd < 0) {
+        fd = memfd_alloc(size);
+        if (fd < 0) {
+            err = fd;
+            ALOGE("%s: memfd allocation failed with error - %s",
+                  __FUNCTION__, strerror(-err));
+            return err;
+        }
+    }
+
+    // Memory from either backend is zeroed by the kernel
+    base = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        err = -errno;
+        ALOGE("%s: Failed to map the allocated memory: %s",
+              __FUNCTION__, strerror(errno));
+        close(fd);
+        return err;
+    }
+
+    data.base = base;
+    data.fd = fd;
+    data.size = size;
+    ALOGD_IF(DEBUG, "memfd: Allocated buffer base:%p size:%d fd:%d",
+          data.base, size, data.fd);
+    return 0;
+}
+
+int MemfdAlloc::free_buffer(void* base, size_t size, int offset, int fd)
+{
+    ALOGD_IF(DEBUG, "memfd: Freeing buffer base:%p size:%d fd:%d",
+          base, size, fd);
+    int err = 0;
+    if(base)
+        err = unmap_buffer(base, size, offset);
+    close(fd);
+    return err;
+}
+
+int MemfdAlloc::map_buffer(void **pBase, size_t size, int offset, int fd)
+{
+    int err = 0;
+    void *base = mmap(0, size, PROT_READ| PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    *pBase = base;
+    if(base == MAP_FAILED) {
+        err = -errno;
+        ALOGE("memfd: Failed to map memory in the client: %s",
+              strerror(errno));
+    } else {
+        ALOGD_IF(DEBUG, "memfd: Mapped buffer base:%p size:%d offset:%d fd:%d",
+              base, size, offset, fd);
+    }
+    return err;
+}
+
+int MemfdAlloc::unmap_buffer(void *base, size_t size, int offset)
+{
+    ALOGD_IF(DEBUG, "memfd: Unmapping buffer  base:%p size:%d", base, size);
+    int err = 0;
+    if(munmap(base, size)) {
+        err = -errno;
+        ALOGE("memfd: Failed to unmap memory at %p : %s",
+              base, strerror(errno));
+    }
+    return err;
+}
+
+int MemfdAlloc::clean_buffer(void *base, size_t size, int offset, int fd,
+                             int op)
+{
+    struct dma_buf_sync sync;
+    switch(op) {
+    case CACHE_CLEAN:
+        sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+        break;
+    case CACHE_INVALIDATE:
+        sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+        break;
+    case CACHE_CLEAN_AND_INVALIDATE:
+    default:
+        sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+    }
+
+    // memfd memory is only touched by the CPU and needs no maintenance,
+    // it rejects the dma-buf ioctl with ENOTTY.
+    if(ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) && errno != ENOTTY) {
+        int err = -errno;
+        ALOGE("%s: DMA_BUF_IOCTL_SYNC failed with error - %s",
+              __FUNCTION__, strerror(errno));
+        return err;
+    }
+    return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2016 The Linux Foundation. All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of The Linux Foundation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cutils/log.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __ARM_HAVE_NEON
+#include <arm_neon.h>
+#endif
+#include "gr.h"
+
+// YCbCr_420_SP_TILED stores both planes as 64x32 byte tiles. Tiles are laid
+// out in groups of four, walked in a Z pattern over two tile rows, and the
+// chroma plane starts at the first 8K boundary after the luma tiles.
+#define TILE_W              64
+#define TILE_H              32
+#define TILE_SIZE           (TILE_W * TILE_H)
+#define TILE_GROUP_SIZE     (4 * TILE_SIZE)
+#define MAX_DETILE_THREADS  4
+
+struct DetileArgs {
+    const uint8_t* src;
+    const uint8_t* srcChroma;
+    uint8_t* dstY;
+    uint8_t* dstC;
+    int width;
+    int height;
+    int dstStride;
+    int tileW;          // Tiles per row containing image data
+    int tileWAlign;     // Tiles per row in memory, always even
+    int tileHLuma;
+    int tileHChroma;
+    bool swapUV;
+};
+
+struct DetileBand {
+    const DetileArgs* args;
+    int tileRowStart;
+    int tileRowEnd;
+};
+
+// Index of tile (x, y) in a plane that is w tiles wide and h tiles high
+static size_t tilePos(size_t x, size_t y, size_t w, size_t h)
+{
+    size_t pos = x + (y & ~1) * w;
+    if (y & 1) {
+        pos += (x & ~3) + 2;
+    } else if ((h & 1) == 0 || y != (h - 1)) {
+        pos += (x + 2) & ~3;
+    }
+    return pos;
+}
+
+static inline void copyTileLine(uint8_t* dst, const uint8_t* src, int n)
+{
+#ifdef __ARM_HAVE_NEON
+    if (n == TILE_W) {
+        uint8x16_t q0 = vld1q_u8(src);
+        uint8x16_t q1 = vld1q_u8(src + 16);
+        uint8x16_t q2 = vld1q_u8(src + 32);
+        uint8x16_t q3 = vld1q_u8(src + 48);
+        vst1q_u8(dst, q0);
+        vst1q_u8(dst + 16, q1);
+        vst1q_u8(dst + 32, q2);
+        vst1q_u8(dst + 48, q3);
+        return;
+    }
+#endif
+    memcpy(dst, src, n);
+}
+
+// Copy a line of interleaved chroma swapping Cb and Cr, NV12 to NV21
+static inline void copyTileLineSwapUV(uint8_t* dst, const uint8_t* src, int n)
+{
+    int i = 0;
+#ifdef __ARM_HAVE_NEON
+    for (; i + 16 <= n; i += 16)
+        vst1q_u8(dst + i, vrev16q_u8(vld1q_u8(src + i)));
+#endif
+    for (; i + 1 < n; i += 2) {
+        dst[i] = src[i + 1];
+        dst[i + 1] = src[i];
+    }
+}
+
+static void detileRows(const DetileArgs& a, int tileRowStart, int tileRowEnd)
+{
+    for (int y = tileRowStart; y < tileRowEnd; y++) {
+        int tileHeight = a.height - y * TILE_H;
+        if (tileHeight > TILE_H)
+            tileHeight = TILE_H;
+        // Two luma lines share one chroma line
+        tileHeight /= 2;
+        for (int x = 0; x < a.tileW; x++) {
+            int tileWidth = a.width - x * TILE_W;
+            if (tileWidth > TILE_W)
+                tileWidth = TILE_W;
+
+            const uint8_t* srcY = a.src +
+                    tilePos(x, y, a.tileWAlign, a.tileHLuma) * TILE_SIZE;
+            // Each chroma tile holds the chroma of two luma tile rows
+            const uint8_t* srcC = a.srcChroma +
+                    tilePos(x, y / 2, a.tileWAlign, a.tileHChroma) * TILE_SIZE;
+            if (y & 1)
+                srcC += TILE_SIZE / 2;
+
+            uint8_t* dstY = a.dstY + y * TILE_H * a.dstStride + x * TILE_W;
+            uint8_t* dstC = a.dstC + y * (TILE_H / 2) * a.dstStride +
+                    x * TILE_W;
+            for (int i = 0; i < tileHeight; i++) {
+                copyTileLine(dstY, srcY, tileWidth);
+                dstY += a.dstStride;
+                srcY += TILE_W;
+                copyTileLine(dstY, srcY, tileWidth);
+                dstY += a.dstStride;
+                srcY += TILE_W;
+                if (a.swapUV)
+                    copyTileLineSwapUV(dstC, srcC, tileWidth);
+                else
+                    copyTileLine(dstC, srcC, tileWidth);
+                dstC += a.dstStride;
+                srcC += TILE_W;
+            }
+        }
+    }
+}
+
+static void* detileThread(void* arg)
+{
+    DetileBand* band = (DetileBand*)arg;
+    detileRows(*band->args, band->tileRowStart, band->tileRowEnd);
+    return NULL;
+}
+
+int detileNV12(const uint8_t* src, int width, int height,
+               uint8_t* dstY, uint8_t* dstC, int dstStride,
+               bool swapUV, int numThreads)
+{
+    if (!src || !dstY || !dstC || width <= 0 || height <= 0 ||
+        dstStride < width) {
+        ALOGE("%s: invalid arguments", __FUNCTION__);
+        return -EINVAL;
+    }
+
+    DetileArgs a;
+    a.src = src;
+    a.dstY = dstY;
+    a.dstC = dstC;
+    a.width = width;
+    a.height = height;
+    a.dstStride = dstStride;
+    a.tileW = (width - 1) / TILE_W + 1;
+    a.tileWAlign = (a.tileW + 1) & ~1;
+    a.tileHLuma = (height - 1) / TILE_H + 1;
+    a.tileHChroma = (height / 2 - 1) / TILE_H + 1;
+    a.swapUV = swapUV;
+    a.srcChroma = src + ALIGN(a.tileWAlign * a.tileHLuma * TILE_SIZE,
+                              TILE_GROUP_SIZE);
+
+    if (numThreads <= 0)
+        numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads > MAX_DETILE_THREADS)
+        numThreads = MAX_DETILE_THREADS;
+    if (numThreads > a.tileHLuma)
+        numThreads = a.tileHLuma;
+    if (numThreads < 1)
+        numThreads = 1;
+
+    // Split the tile rows into bands, the caller detiles the first one
+    DetileBand bands[MAX_DETILE_THREADS];
+    pthread_t threads[MAX_DETILE_THREADS];
+    bool started[MAX_DETILE_THREADS];
+    int rowsPerBand = a.tileHLuma / numThreads;
+    int extraRows = a.tileHLuma % numThreads;
+    int row = 0;
+    for (int i = 0; i < numThreads; i++) {
+        bands[i].args = &a;
+        bands[i].tileRowStart = row;
+        row += rowsPerBand + (i < extraRows ? 1 : 0);
+        bands[i].tileRowEnd = row;
+        started[i] = false;
+    }
+
+    for (int i = 1; i < numThreads; i++) {
+        started[i] = (pthread_create(&threads[i], NULL, detileThread,
+                                     &bands[i]) == 0);
+        if (!started[i])
+            detileThread(&bands[i]);
+    }
+    detileThread(&bands[0]);
+    for (int i = 1; i < numThreads; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+    return 0;
+}
@@ -860,6 +860,10 @@ void hwc_dump(struct hwc_composer_device_1* dev, char *buff, int buff_len)
             len = strnlen(buff, buff_len);
             ctx->mMDPComp[dpy]->dump(buff + len, buff_len - len);
         }
+        if(ctx->mCopyBit[dpy]) {
+            len = strnlen(buff, buff_len);
+            ctx->mCopyBit[dpy]->dump(buff + len, buff_len - len);
+        }
     }
     len = strnlen(buff, buff_len);
     if (len >= buff_len - 1) {
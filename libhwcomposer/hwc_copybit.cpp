@@ -40,6 +40,16 @@ struct region_iterator : public copybit_region_t {
         mRegion = region;
         r.end = region.numRects;
         r.current = 0;
+        mClip = (hwc_rect_t){0, 0, 0, 0};
+        this->next = iterate;
+    }
+
+    //Restricts every rect of the region to the clip rect
+    region_iterator(hwc_region_t region, const hwc_rect_t& clip) {
+        mRegion = region;
+        r.end = region.numRects;
+        r.current = 0;
+        mClip = clip;
         this->next = iterate;
     }
 
@@ -52,21 +62,225 @@ private:
 
         region_iterator const* me =
                                   static_cast<region_iterator const*>(self);
-        if (me->r.current != me->r.end) {
-            rect->l = me->mRegion.rects[me->r.current].left;
-            rect->t = me->mRegion.rects[me->r.current].top;
-            rect->r = me->mRegion.rects[me->r.current].right;
-            rect->b = me->mRegion.rects[me->r.current].bottom;
+        while (me->r.current != me->r.end) {
+            hwc_rect_t cur = me->mRegion.rects[me->r.current];
             me->r.current++;
+            if (isValidRect(me->mClip)) {
+                cur = getIntersection(cur, me->mClip);
+                if (!isValidRect(cur))
+                    continue;
+            }
+            rect->l = cur.left;
+            rect->t = cur.top;
+            rect->r = cur.right;
+            rect->b = cur.bottom;
             return 1;
         }
         return 0;
     }
 
     hwc_region_t mRegion;
+    hwc_rect_t mClip;
     mutable range r;
 };
 
+//Dimensions used by the calibration microbenchmark
+#define CALIB_DST_DIM 512
+#define CALIB_ITERATIONS 4
+
+CopyBitCostModel::CopyBitCostModel() : mBlitOverhead(0), mValid(false) {
+    memset(mCost, 0, sizeof(mCost));
+    char value[PROPERTY_VALUE_MAX];
+    //ns per 1000 pixels, the calibration file may override it
+    property_get("debug.hwc.gpuCompCost", value, "2000");
+    mGpuCost = atoi(value);
+}
+
+int CopyBitCostModel::getFormatClass(int format) {
+    switch(format) {
+    case HAL_PIXEL_FORMAT_RGB_565:
+        return FMT_RGB_565;
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+    case HAL_PIXEL_FORMAT_RGBX_8888:
+    case HAL_PIXEL_FORMAT_BGRA_8888:
+        return FMT_RGBA_8888;
+    default:
+        return FMT_YUV;
+    }
+}
+
+int CopyBitCostModel::getScaleClass(const hwc_layer_1_t *layer) {
+    hwc_rect_t crop = integerizeSourceCrop(layer->sourceCropf);
+    const hwc_rect_t& dst = layer->displayFrame;
+    int64_t srcArea = (int64_t)(crop.right - crop.left) *
+            (crop.bottom - crop.top);
+    int64_t dstArea = (int64_t)(dst.right - dst.left) *
+            (dst.bottom - dst.top);
+    //Within ~15% in each direction counts as unscaled
+    if(dstArea * 4 < srcArea * 3)
+        return SCALE_DOWN;
+    if(dstArea * 3 > srcArea * 4)
+        return SCALE_UP;
+    return SCALE_NONE;
+}
+
+nsecs_t CopyBitCostModel::predictLayer(const hwc_layer_1_t *layer) const {
+    private_handle_t *hnd = (private_handle_t *)layer->handle;
+    if(!hnd)
+        return 0;
+    const hwc_rect_t& dst = layer->displayFrame;
+    int64_t area = (int64_t)(dst.right - dst.left) * (dst.bottom - dst.top);
+    int blend = (layer->blending != HWC_BLENDING_NONE) ? BLEND_ON : BLEND_OFF;
+    uint32_t cost = mCost[getFormatClass(hnd->format)]
+            [getScaleClass(layer)][blend];
+    return mBlitOverhead + (area * cost) / 1000;
+}
+
+nsecs_t CopyBitCostModel::predictGpu(unsigned int area) const {
+    return ((int64_t)area * mGpuCost) / 1000;
+}
+
+bool CopyBitCostModel::load(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if(!fp)
+        return false;
+
+    char line[128];
+    int entries = 0;
+    while(fgets(line, sizeof(line), fp)) {
+        unsigned int f, sc, b, val;
+        if(line[0] == '#')
+            continue;
+        if(sscanf(line, "cost %u %u %u %u", &f, &sc, &b, &val) == 4) {
+            if(f < NUM_FMT_CLASSES && sc < NUM_SCALE_CLASSES &&
+                    b < NUM_BLEND_CLASSES) {
+                mCost[f][sc][b] = val;
+                entries++;
+            }
+        } else if(sscanf(line, "overhead %u", &val) == 1) {
+            mBlitOverhead = val;
+        } else if(sscanf(line, "gpu %u", &val) == 1) {
+            mGpuCost = val;
+        }
+    }
+    fclose(fp);
+
+    mValid = (entries ==
+            NUM_FMT_CLASSES * NUM_SCALE_CLASSES * NUM_BLEND_CLASSES);
+    ALOGD_IF(DEBUG_COPYBIT, "%s: %s %d entries, valid %d", __FUNCTION__,
+             path, entries, mValid);
+    return mValid;
+}
+
+bool CopyBitCostModel::save(const char *path) const {
+    FILE *fp = fopen(path, "w");
+    if(!fp) {
+        ALOGE("%s: cannot open %s: %s", __FUNCTION__, path, strerror(errno));
+        return false;
+    }
+    fprintf(fp, "# copybit cost model: ns per 1000 dst pixels\n");
+    fprintf(fp, "# cost <fmt> <scale> <blend> <ns>\n");
+    fprintf(fp, "overhead %u\n", mBlitOverhead);
+    fprintf(fp, "gpu %u\n", mGpuCost);
+    for(int f = 0; f < NUM_FMT_CLASSES; f++)
+        for(int sc = 0; sc < NUM_SCALE_CLASSES; sc++)
+            for(int b = 0; b < NUM_BLEND_CLASSES; b++)
+                fprintf(fp, "cost %d %d %d %u\n", f, sc, b, mCost[f][sc][b]);
+    fclose(fp);
+    return true;
+}
+
+nsecs_t CopyBitCostModel::measureBlit(struct copybit_device_t *engine,
+                                      int dstFormat, int srcFormat,
+                                      int srcDim, int dstDim, int blending) {
+    private_handle_t *srcHnd = NULL, *dstHnd = NULL;
+    nsecs_t elapsed = -1;
+    int usage = GRALLOC_USAGE_PRIVATE_IOMMU_HEAP;
+
+    if(alloc_buffer(&srcHnd, srcDim, srcDim, srcFormat, usage) ||
+            alloc_buffer(&dstHnd, CALIB_DST_DIM, CALIB_DST_DIM,
+                         dstFormat, usage)) {
+        ALOGE("%s: buffer allocation failed", __FUNCTION__);
+    } else {
+        copybit_image_t src = {(uint32_t)srcDim, (uint32_t)srcDim, srcFormat,
+                (void *)srcHnd->base, (native_handle_t *)srcHnd, 0, 0};
+        copybit_image_t dst = {CALIB_DST_DIM, CALIB_DST_DIM, dstFormat,
+                (void *)dstHnd->base, (native_handle_t *)dstHnd, 0, 0};
+        copybit_rect_t srcRect = {0, 0, srcDim, srcDim};
+        copybit_rect_t dstRect = {0, 0, dstDim, dstDim};
+        hwc_rect_t clip = {0, 0, dstDim, dstDim};
+        hwc_region_t region = {1, &clip};
+
+        nsecs_t start = systemTime();
+        int err = 0;
+        for(int i = 0; i < CALIB_ITERATIONS && !err; i++) {
+            region_iterator it(region);
+            engine->set_parameter(engine, COPYBIT_FRAMEBUFFER_WIDTH,
+                                  CALIB_DST_DIM);
+            engine->set_parameter(engine, COPYBIT_FRAMEBUFFER_HEIGHT,
+                                  CALIB_DST_DIM);
+            engine->set_parameter(engine, COPYBIT_TRANSFORM, 0);
+            engine->set_parameter(engine, COPYBIT_PLANE_ALPHA, 255);
+            engine->set_parameter(engine, COPYBIT_BLEND_MODE, blending);
+            err = engine->stretch(engine, &dst, &src, &dstRect, &srcRect, &it);
+            engine->finish(engine);
+        }
+        if(!err)
+            elapsed = (systemTime() - start) / CALIB_ITERATIONS;
+    }
+
+    if(srcHnd)
+        free_buffer(srcHnd);
+    if(dstHnd)
+        free_buffer(dstHnd);
+    return elapsed;
+}
+
+bool CopyBitCostModel::calibrate(struct copybit_device_t *engine,
+                                 int dstFormat) {
+    static const int srcFormats[NUM_FMT_CLASSES] = {
+        HAL_PIXEL_FORMAT_RGBA_8888,
+        HAL_PIXEL_FORMAT_RGB_565,
+        HAL_PIXEL_FORMAT_YCbCr_420_SP,
+    };
+    //Source dimension for downscale, unscaled and upscale blits
+    static const int srcDims[NUM_SCALE_CLASSES] = {
+        CALIB_DST_DIM * 2, CALIB_DST_DIM, CALIB_DST_DIM / 2,
+    };
+    static const int blendModes[NUM_BLEND_CLASSES] = {
+        COPYBIT_BLENDING_NONE, COPYBIT_BLENDING_PREMULT,
+    };
+
+    if(!engine)
+        return false;
+
+    mValid = false;
+    //Fixed cost of a blit, from a tiny unscaled one
+    nsecs_t overhead = measureBlit(engine, dstFormat,
+            HAL_PIXEL_FORMAT_RGBA_8888, 16, 16, COPYBIT_BLENDING_NONE);
+    if(overhead < 0)
+        return false;
+    mBlitOverhead = (uint32_t)overhead;
+
+    const int64_t kpixels = (CALIB_DST_DIM * CALIB_DST_DIM) / 1000;
+    for(int f = 0; f < NUM_FMT_CLASSES; f++) {
+        for(int sc = 0; sc < NUM_SCALE_CLASSES; sc++) {
+            for(int b = 0; b < NUM_BLEND_CLASSES; b++) {
+                nsecs_t t = measureBlit(engine, dstFormat, srcFormats[f],
+                        srcDims[sc], CALIB_DST_DIM, blendModes[b]);
+                if(t < 0)
+                    return false;
+                t = (t > overhead) ? (t - overhead) : 0;
+                mCost[f][sc][b] = (uint32_t)(t / kpixels);
+                ALOGI("%s: fmt %d scale %d blend %d: %u ns/kpx", __FUNCTION__,
+                      f, sc, b, mCost[f][sc][b]);
+            }
+        }
+    }
+    mValid = true;
+    return true;
+}
+
 void CopyBit::reset() {
     mIsModeOn = false;
     mCopyBitDraw = false;
@@ -86,7 +300,29 @@ bool CopyBit::canUseCopybitForRGB(hwc_context_t *ctx,
     int compositionType = qdutils::QCCompositionType::
                                     getInstance().getCompositionType();
 
-    if (compositionType & qdutils::COMPOSITION_TYPE_DYN) {
+    if ((compositionType & qdutils::COMPOSITION_TYPE_DYN) &&
+            mCostModel.isValid()) {
+        // DYN Composition with a calibrated cost model:
+        // use copybit only if it is predicted to be faster than the GPU
+        nsecs_t copybitTime = 0;
+        unsigned int renderArea = 0;
+        unsigned int w = 0, h = 0;
+        for (unsigned int i = 0; i < (list->numHwLayers) - 1; i++) {
+            private_handle_t *hnd =
+                    (private_handle_t *)list->hwLayers[i].handle;
+            if (hnd && BUFFER_TYPE_UI == hnd->bufferType) {
+                copybitTime += mCostModel.predictLayer(&list->hwLayers[i]);
+                getLayerResolution(&list->hwLayers[i], w, h);
+                renderArea += (w*h);
+            }
+        }
+        nsecs_t gpuTime = mCostModel.predictGpu(renderArea);
+        ALOGD_IF (DEBUG_COPYBIT, "%s: predicted copybit %lld ns, gpu %lld ns",
+                  __FUNCTION__, (long long)copybitTime, (long long)gpuTime);
+        if (copybitTime < gpuTime) {
+            return true;
+        }
+    } else if (compositionType & qdutils::COMPOSITION_TYPE_DYN) {
         // DYN Composition:
         // use copybit, if (TotalRGBRenderArea < threashold * FB Area)
         // this is done based on perf inputs in ICS
@@ -174,9 +410,6 @@ bool CopyBit::prepare(hwc_context_t *ctx, hwc_display_contents_1_t *list,
                                      HAL_PIXEL_FORMAT_RGBA_8888);
         if (ret < 0) {
             return false;
-        } else {
-            mCurRenderBufferIndex = (mCurRenderBufferIndex + 1) %
-                NUM_RENDER_BUFFERS;
         }
     }
 
@@ -214,6 +447,14 @@ bool CopyBit::prepare(hwc_context_t *ctx, hwc_display_contents_1_t *list,
             break;
         }
     }
+
+    mPredictedTime = 0;
+    if (mCopyBitDraw && mCostModel.isValid()) {
+        for (int i = 0; i < ctx->listStats[dpy].numAppLayers; i++) {
+            if (layerProp[i].mFlags & HWC_COPYBIT)
+                mPredictedTime += mCostModel.predictLayer(&list->hwLayers[i]);
+        }
+    }
     return true;
 }
 
@@ -245,40 +486,96 @@ bool CopyBit::draw(hwc_context_t *ctx, hwc_display_contents_1_t *list,
     LayerProp *layerProp = ctx->layerProp[dpy];
     private_handle_t *renderBuffer;
 
-    if(mCopyBitDraw == false) // there is no layer marked for copybit
+    if(mCopyBitDraw == false) { // there is no layer marked for copybit
+        //The next copybit frame can't be diffed against this one, and the
+        //render buffers missed whatever changed meanwhile
+        mPrevLayerCount = -1;
+        hwc_rect_t fbFrame =
+                list->hwLayers[list->numHwLayers - 1].displayFrame;
+        for (int i = 0; i < mNumRenderBuffers; i++)
+            mDirtyRect[i] = fbFrame;
         return false ;
+    }
+
+    updateMeasuredTime();
 
+    nsecs_t waitStart = systemTime();
+    bool blocked = false;
     //render buffer
     if (ctx->mMDP.version <= qdutils::MDP_V4_3) {
         last = list->numHwLayers - 1;
         renderBuffer = (private_handle_t *)list->hwLayers[last].handle;
+        if(list->hwLayers[last].acquireFenceFd >=0) {
+            sync_wait(list->hwLayers[last].acquireFenceFd, 1000);
+            close(list->hwLayers[last].acquireFenceFd);
+            list->hwLayers[last].acquireFenceFd = -1;
+            blocked = true;
+        }
     } else {
+        //Pick a render buffer that is no longer being scanned out
+        int prevIndex = mCurRenderBufferIndex;
+        mCurRenderBufferIndex = getFreeRenderBufferIndex();
+        blocked = (mRelFd[mCurRenderBufferIndex] >= 0);
+        if(blocked) {
+            //None of them is free, wait for the oldest one
+            sync_wait(mRelFd[mCurRenderBufferIndex], 1000);
+            close(mRelFd[mCurRenderBufferIndex]);
+            mRelFd[mCurRenderBufferIndex] = -1;
+        }
+        ALOGD_IF(DEBUG_COPYBIT, "%s: render buffer %d -> %d blocked %d",
+                 __FUNCTION__, prevIndex, mCurRenderBufferIndex, blocked);
+        mRenderBufferSeq[mCurRenderBufferIndex] = mFrameCount;
         renderBuffer = getCurrentRenderBuffer();
     }
+
+    //Only the area that changed since this buffer was last drawn into needs
+    //to be recomposed. The FB target on older MDPs has unknown contents.
+    hwc_rect_t fbFrame = list->hwLayers[list->numHwLayers - 1].displayFrame;
+    hwc_rect_t dirtyRect = fbFrame;
+    hwc_rect_t damage = getFrameDamage(ctx, list, dpy);
+    if (ctx->mMDP.version > qdutils::MDP_V4_3) {
+        for (int i = 0; i < mNumRenderBuffers; i++)
+            mDirtyRect[i] = getUnion(mDirtyRect[i], damage);
+        dirtyRect = getIntersection(mDirtyRect[mCurRenderBufferIndex],
+                                    fbFrame);
+        mDirtyRect[mCurRenderBufferIndex] = (hwc_rect_t){0, 0, 0, 0};
+    }
+    ALOGD_IF(DEBUG_COPYBIT, "%s: dirtyRect [%d %d %d %d]", __FUNCTION__,
+             dirtyRect.left, dirtyRect.top, dirtyRect.right, dirtyRect.bottom);
+
+    mLastFenceWaitTime = systemTime() - waitStart;
+    mTotalFenceWaitTime += mLastFenceWaitTime;
+    if(mLastFenceWaitTime > mMaxFenceWaitTime)
+        mMaxFenceWaitTime = mLastFenceWaitTime;
+    if(blocked)
+        mBlockedFrameCount++;
+    mFrameCount++;
+
     if (!renderBuffer) {
         ALOGE("%s: Render buffer layer handle is NULL", __FUNCTION__);
         return false;
     }
 
-    if (ctx->mMDP.version > qdutils::MDP_V4_3) {
-        //Wait for the previous frame to complete before rendering onto it
-        if(mRelFd[mCurRenderBufferIndex] >=0) {
-            sync_wait(mRelFd[mCurRenderBufferIndex], 1000);
-            close(mRelFd[mCurRenderBufferIndex]);
-            mRelFd[mCurRenderBufferIndex] = -1;
-        }
-    } else {
-        if(list->hwLayers[last].acquireFenceFd >=0) {
-            sync_wait(list->hwLayers[last].acquireFenceFd, 1000);
-            close(list->hwLayers[last].acquireFenceFd);
-            list->hwLayers[last].acquireFenceFd = -1;
-        }
-    }
+    //Bytes per pixel of the render buffer, for the write statistics
+    uint64_t bpp = (renderBuffer->format == HAL_PIXEL_FORMAT_RGB_565) ? 2 : 4;
+    mLastBytesWritten = 0;
+
+    //Nothing changed since this buffer was last composed, it is up to date.
+    //The acquire fences are left for closeAcquireFds.
+    if (!isValidRect(dirtyRect))
+        return true;
 
     //Clear the transparent or left out region on the render buffer
     hwc_rect_t clearRegion = {0,0,0,0};
-    if(CBUtils::getuiClearRegion(list, clearRegion, layerProp))
-        clear(renderBuffer, clearRegion);
+    if(CBUtils::getuiClearRegion(list, clearRegion, layerProp)) {
+        clearRegion = getIntersection(clearRegion, dirtyRect);
+        if(isValidRect(clearRegion)) {
+            clear(renderBuffer, clearRegion);
+            mLastBytesWritten += bpp *
+                    (clearRegion.right - clearRegion.left) *
+                    (clearRegion.bottom - clearRegion.top);
+        }
+    }
     // numAppLayers-1, as we iterate from 0th layer index with HWC_COPYBIT flag
     for (int i = 0; i <= (ctx->listStats[dpy].numAppLayers-1); i++) {
         hwc_layer_1_t *layer = &list->hwLayers[i];
@@ -286,20 +583,34 @@ bool CopyBit::draw(hwc_context_t *ctx, hwc_display_contents_1_t *list,
             ALOGD_IF(DEBUG_COPYBIT, "%s: Not Marked for copybit", __FUNCTION__);
             continue;
         }
+        hwc_rect_t drawRect = getIntersection(layer->displayFrame, dirtyRect);
+        if(!isValidRect(drawRect)) {
+            ALOGD_IF(DEBUG_COPYBIT, "%s: layer %d outside dirty rect",
+                     __FUNCTION__, i);
+            continue;
+        }
         int ret = -1;
         if (list->hwLayers[i].acquireFenceFd != -1 ) {
-            // Wait for acquire Fence on the App buffers.
-            ret = sync_wait(list->hwLayers[i].acquireFenceFd, 1000);
-            if(ret < 0) {
-                ALOGE("%s: sync_wait error!! error no = %d err str = %s",
-                                    __FUNCTION__, errno, strerror(errno));
+            if (mEngine->set_sync) {
+                // Let copybit wait on it just before the draw is submitted
+                mEngine->set_sync(mEngine, list->hwLayers[i].acquireFenceFd);
+            } else {
+                // Wait for acquire Fence on the App buffers.
+                ret = sync_wait(list->hwLayers[i].acquireFenceFd, 1000);
+                if(ret < 0) {
+                    ALOGE("%s: sync_wait error!! error no = %d err str = %s",
+                                        __FUNCTION__, errno, strerror(errno));
+                }
+                close(list->hwLayers[i].acquireFenceFd);
             }
-            close(list->hwLayers[i].acquireFenceFd);
             list->hwLayers[i].acquireFenceFd = -1;
         }
         retVal = drawLayerUsingCopybit(ctx, &(list->hwLayers[i]),
-                                                    renderBuffer, dpy);
+                                                    renderBuffer, dpy,
+                                                    dirtyRect);
         copybitLayerCount++;
+        mLastBytesWritten += bpp * (drawRect.right - drawRect.left) *
+                (drawRect.bottom - drawRect.top);
         if(retVal < 0) {
             ALOGE("%s : drawLayerUsingCopybit failed", __FUNCTION__);
         }
@@ -308,13 +619,71 @@ bool CopyBit::draw(hwc_context_t *ctx, hwc_display_contents_1_t *list,
     if (copybitLayerCount) {
         copybit_device_t *copybit = getCopyBitDevice();
         // Async mode
+        mSubmitTime = systemTime();
         copybit->flush_get_fence(copybit, fd);
+        if (*fd >= 0 && mCostModel.isValid()) {
+            mMeasureFd = dup(*fd);
+            mSubmitPredictedTime = mPredictedTime;
+        }
     }
+    mTotalBytesWritten += mLastBytesWritten;
     return true;
 }
 
+hwc_rect_t CopyBit::getFrameDamage(hwc_context_t *ctx,
+                                   const hwc_display_contents_1_t *list,
+                                   int dpy) {
+    const int numAppLayers = ctx->listStats[dpy].numAppLayers;
+    const LayerProp *layerProp = ctx->layerProp[dpy];
+    hwc_rect_t fbFrame = list->hwLayers[list->numHwLayers - 1].displayFrame;
+    hwc_rect_t damage = {0, 0, 0, 0};
+    // A change in the layer stack or its geometry invalidates everything.
+    bool fullDamage = !mSwapRectOn || (numAppLayers != mPrevLayerCount) ||
+            (list->flags & HWC_GEOMETRY_CHANGED);
+
+    for (int i = 0; i < numAppLayers; i++) {
+        const hwc_layer_1_t *layer = &list->hwLayers[i];
+        LayerState &prev = mPrevLayerState[i];
+        bool isCopybit = (layerProp[i].mFlags & HWC_COPYBIT);
+        hwc_rect_t crop = integerizeSourceCrop(layer->sourceCropf);
+
+        if (!fullDamage) {
+            if (isCopybit != prev.isCopybit) {
+                fullDamage = true;
+            } else if (isCopybit) {
+                const hwc_rect_t& df = layer->displayFrame;
+                bool geometryChanged =
+                        memcmp(&df, &prev.displayFrame, sizeof(df)) ||
+                        memcmp(&crop, &prev.sourceCrop, sizeof(crop)) ||
+                        (layer->transform != prev.transform) ||
+                        (layer->blending != prev.blending) ||
+                        (layer->planeAlpha != prev.planeAlpha);
+                if (geometryChanged) {
+                    damage = getUnion(damage, prev.displayFrame);
+                    damage = getUnion(damage, df);
+                } else if (layer->handle != prev.handle) {
+                    // A new buffer was latched for this layer
+                    damage = getUnion(damage, df);
+                }
+            }
+        }
+
+        prev.handle = layer->handle;
+        prev.displayFrame = layer->displayFrame;
+        prev.sourceCrop = crop;
+        prev.transform = layer->transform;
+        prev.blending = layer->blending;
+        prev.planeAlpha = layer->planeAlpha;
+        prev.isCopybit = isCopybit;
+    }
+    mPrevLayerCount = numAppLayers;
+
+    return fullDamage ? fbFrame : damage;
+}
+
 int  CopyBit::drawLayerUsingCopybit(hwc_context_t *dev, hwc_layer_1_t *layer,
-                                     private_handle_t *renderBuffer, int dpy)
+                                     private_handle_t *renderBuffer, int dpy,
+                                     const hwc_rect_t& dirtyRect)
 {
     hwc_context_t* ctx = (hwc_context_t*)(dev);
     int err = 0;
@@ -480,9 +849,9 @@ int  CopyBit::drawLayerUsingCopybit(hwc_context_t *dev, hwc_layer_1_t *layer,
             srcRect = tmp_rect;
       }
     }
-    // Copybit region
+    // Copybit region, scissored to the area that needs recomposition
     hwc_region_t region = layer->visibleRegionScreen;
-    region_iterator copybitRegion(region);
+    region_iterator copybitRegion(region, dirtyRect);
 
     copybit->set_parameter(copybit, COPYBIT_FRAMEBUFFER_WIDTH,
                                           renderBuffer->width);
@@ -538,11 +907,13 @@ bool CopyBit::validateParams(hwc_context_t *ctx,
 int CopyBit::allocRenderBuffers(int w, int h, int f)
 {
     int ret = 0;
-    for (int i = 0; i < NUM_RENDER_BUFFERS; i++) {
+    for (int i = 0; i < mNumRenderBuffers; i++) {
         if (mRenderBuffer[i] == NULL) {
             ret = alloc_buffer(&mRenderBuffer[i],
                                w, h, f,
                                GRALLOC_USAGE_PRIVATE_IOMMU_HEAP);
+            //Contents of a new buffer are undefined
+            mDirtyRect[i] = (hwc_rect_t){0, 0, w, h};
         }
         if(ret < 0) {
             freeRenderBuffers();
@@ -554,7 +925,7 @@ int CopyBit::allocRenderBuffers(int w, int h, int f)
 
 void CopyBit::freeRenderBuffers()
 {
-    for (int i = 0; i < NUM_RENDER_BUFFERS; i++) {
+    for (int i = 0; i < mNumRenderBuffers; i++) {
         if(mRenderBuffer[i]) {
             //Since we are freeing buffer close the fence if it has a valid one.
             if(mRelFd[i] >= 0) {
@@ -571,18 +942,102 @@ private_handle_t * CopyBit::getCurrentRenderBuffer() {
     return mRenderBuffer[mCurRenderBufferIndex];
 }
 
+void CopyBit::updateMeasuredTime() {
+    if (mMeasureFd < 0)
+        return;
+    //The previous draw has normally completed by now; if not, skip it rather
+    //than block.
+    if (sync_wait(mMeasureFd, 0) == 0) {
+        struct sync_fence_info_data *info = sync_fence_info(mMeasureFd);
+        if (info) {
+            uint64_t doneTime = 0;
+            struct sync_pt_info *pt = NULL;
+            while ((pt = sync_pt_info(info, pt)) != NULL) {
+                if (pt->timestamp_ns > doneTime)
+                    doneTime = pt->timestamp_ns;
+            }
+            sync_fence_info_free(info);
+            if (doneTime > (uint64_t)mSubmitTime) {
+                mMeasuredPredictedTime = mSubmitPredictedTime;
+                mMeasuredTime = doneTime - mSubmitTime;
+                ALOGD_IF(DEBUG_COPYBIT, "%s: predicted %lld ns measured %lld ns",
+                         __FUNCTION__, (long long)mMeasuredPredictedTime,
+                         (long long)mMeasuredTime);
+            }
+        }
+    }
+    close(mMeasureFd);
+    mMeasureFd = -1;
+}
+
+int CopyBit::getFreeRenderBufferIndex() {
+    // The current buffer is still on screen, so it is never a candidate.
+    // Among the others take the first one whose release fence has already
+    // signaled; if none has, fall back to the least recently used one.
+    int oldest = -1;
+    for (int n = 1; n < mNumRenderBuffers; n++) {
+        int i = (mCurRenderBufferIndex + n) % mNumRenderBuffers;
+        if(mRelFd[i] < 0)
+            return i;
+        if(sync_wait(mRelFd[i], 0) == 0) {
+            close(mRelFd[i]);
+            mRelFd[i] = -1;
+            return i;
+        }
+        if(oldest < 0 ||
+                (int32_t)(mRenderBufferSeq[i] - mRenderBufferSeq[oldest]) < 0)
+            oldest = i;
+    }
+    return oldest;
+}
+
 void CopyBit::setReleaseFd(int fd) {
     if(mRelFd[mCurRenderBufferIndex] >=0)
         close(mRelFd[mCurRenderBufferIndex]);
     mRelFd[mCurRenderBufferIndex] = dup(fd);
 }
 
+void CopyBit::dump(char *buff, int buff_len)
+{
+    if ((buff == NULL) || (buff_len <= 0)) {
+        ALOGE("%s: invalid parameters: buff=0x%x, buff_len=%d\n",
+                __FUNCTION__, (uint32_t)buff, buff_len);
+        return;
+    }
+    nsecs_t avgWait = mFrameCount ? (mTotalFenceWaitTime / mFrameCount) : 0;
+    uint64_t avgBytes = mFrameCount ? (mTotalBytesWritten / mFrameCount) : 0;
+    int ret = snprintf(buff, buff_len, "CopyBit: renderBuffers:%d "
+            "frames:%u blocked:%u fenceWait(us) last:%lld avg:%lld max:%lld\n"
+            "  swapRect:%s bytesWritten last:%llu avg:%llu\n"
+            "  costModel:%s predicted(us):%lld measured(us):%lld\n",
+            mNumRenderBuffers, mFrameCount, mBlockedFrameCount,
+            (long long)ns2us(mLastFenceWaitTime), (long long)ns2us(avgWait),
+            (long long)ns2us(mMaxFenceWaitTime),
+            mSwapRectOn ? "ON" : "OFF",
+            (unsigned long long)mLastBytesWritten,
+            (unsigned long long)avgBytes,
+            mCostModel.isValid() ? "ON" : "OFF",
+            (long long)ns2us(mMeasuredPredictedTime),
+            (long long)ns2us(mMeasuredTime));
+    if ((ret >= buff_len) || (ret < 0)) {
+        ALOGE("%s: snprintf error: ret=%d, available buffer length=%d",
+                __FUNCTION__, ret, buff_len);
+    }
+}
+
 struct copybit_device_t* CopyBit::getCopyBitDevice() {
     return mEngine;
 }
 
-CopyBit::CopyBit(hwc_context_t *ctx, const int& dpy) : mIsModeOn(false),
-        mCopyBitDraw(false), mCurRenderBufferIndex(0) {
+CopyBit::CopyBit(hwc_context_t *ctx, const int& dpy) : mEngine(NULL),
+        mIsModeOn(false),
+        mCopyBitDraw(false), mNumRenderBuffers(MIN_RENDER_BUFFERS),
+        mCurRenderBufferIndex(0), mPrevLayerCount(-1), mSwapRectOn(true),
+        mFrameCount(0), mBlockedFrameCount(0),
+        mLastFenceWaitTime(0), mMaxFenceWaitTime(0), mTotalFenceWaitTime(0),
+        mLastBytesWritten(0), mTotalBytesWritten(0),
+        mPredictedTime(0), mMeasuredPredictedTime(0), mMeasuredTime(0),
+        mMeasureFd(-1), mSubmitTime(0), mSubmitPredictedTime(0) {
 
     getBufferSizeAndDimensions(ctx->dpyAttr[dpy].xres,
             ctx->dpyAttr[dpy].yres,
@@ -591,15 +1046,27 @@ CopyBit::CopyBit(hwc_context_t *ctx, const int& dpy) : mIsModeOn(false),
             mAlignedFBHeight);
 
     hw_module_t const *module;
-    for (int i = 0; i < NUM_RENDER_BUFFERS; i++) {
+    for (int i = 0; i < MAX_RENDER_BUFFERS; i++) {
         mRenderBuffer[i] = NULL;
         mRelFd[i] = -1;
+        mRenderBufferSeq[i] = 0;
+        mDirtyRect[i] = (hwc_rect_t){0, 0, 0, 0};
     }
 
     char value[PROPERTY_VALUE_MAX];
     property_get("debug.hwc.dynThreshold", value, "2");
     mDynThreshold = atof(value);
 
+    property_get("debug.hwc.numRenderBuffers", value, "2");
+    mNumRenderBuffers = atoi(value);
+    if(mNumRenderBuffers < MIN_RENDER_BUFFERS)
+        mNumRenderBuffers = MIN_RENDER_BUFFERS;
+    else if(mNumRenderBuffers > MAX_RENDER_BUFFERS)
+        mNumRenderBuffers = MAX_RENDER_BUFFERS;
+
+    property_get("debug.hwc.copybitSwapRect", value, "1");
+    mSwapRectOn = (atoi(value) != 0);
+
     if (hw_get_module(COPYBIT_HARDWARE_MODULE_ID, &module) == 0) {
         if(copybit_open(module, &mEngine) < 0) {
             ALOGE("FATAL ERROR: copybit open failed.");
@@ -607,10 +1074,21 @@ CopyBit::CopyBit(hwc_context_t *ctx, const int& dpy) : mIsModeOn(false),
     } else {
         ALOGE("FATAL ERROR: copybit hw module not found");
     }
+
+    //Load the copybit cost model, calibrating it first if requested
+    if (mEngine && !mCostModel.load(COPYBIT_COST_FILE)) {
+        property_get("debug.hwc.copybitCalibrate", value, "0");
+        if (atoi(value) &&
+                mCostModel.calibrate(mEngine, HAL_PIXEL_FORMAT_RGBA_8888)) {
+            mCostModel.save(COPYBIT_COST_FILE);
+        }
+    }
 }
 
 CopyBit::~CopyBit()
 {
+    if (mMeasureFd >= 0)
+        close(mMeasureFd);
     freeRenderBuffers();
     if(mEngine)
     {
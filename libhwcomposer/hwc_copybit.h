@@ -21,10 +21,51 @@
 #define HWC_COPYBIT_H
 #include "hwc_utils.h"
 
-#define NUM_RENDER_BUFFERS 2
+//Number of intermediate render buffers, configurable between the min and max
+//through debug.hwc.numRenderBuffers
+#define MIN_RENDER_BUFFERS 2
+#define MAX_RENDER_BUFFERS 3
+
+//Throughput tables produced by CopyBitCostModel::calibrate
+#define COPYBIT_COST_FILE "/data/copybit_cost.cfg"
 
 namespace qhwc {
 
+// Predicts how long copybit takes to compose a layer, from throughput tables
+// indexed by source format, scale factor and blending. The tables are
+// measured on the device by calibrate() and stored in COPYBIT_COST_FILE.
+class CopyBitCostModel {
+public:
+    enum { FMT_RGBA_8888, FMT_RGB_565, FMT_YUV, NUM_FMT_CLASSES };
+    enum { SCALE_DOWN, SCALE_NONE, SCALE_UP, NUM_SCALE_CLASSES };
+    enum { BLEND_OFF, BLEND_ON, NUM_BLEND_CLASSES };
+
+    CopyBitCostModel();
+    bool load(const char *path);
+    bool save(const char *path) const;
+    // Runs a blit microbenchmark on the engine to fill the tables
+    bool calibrate(struct copybit_device_t *engine, int dstFormat);
+    bool isValid() const { return mValid; }
+    // Predicted copybit time for a layer, in ns
+    nsecs_t predictLayer(const hwc_layer_1_t *layer) const;
+    // Predicted GPU composition time for the given pixel area, in ns
+    nsecs_t predictGpu(unsigned int area) const;
+
+private:
+    static int getFormatClass(int format);
+    static int getScaleClass(const hwc_layer_1_t *layer);
+    nsecs_t measureBlit(struct copybit_device_t *engine, int dstFormat,
+                        int srcFormat, int srcDim, int dstDim, int blending);
+
+    // ns per 1000 destination pixels
+    uint32_t mCost[NUM_FMT_CLASSES][NUM_SCALE_CLASSES][NUM_BLEND_CLASSES];
+    // Fixed cost per blit in ns
+    uint32_t mBlitOverhead;
+    // GPU composition cost, ns per 1000 pixels
+    uint32_t mGpuCost;
+    bool mValid;
+};
+
 class CopyBit {
 public:
     CopyBit(hwc_context_t *ctx, const int& dpy);
@@ -44,17 +85,23 @@ public:
 
     void setReleaseFd(int fd);
 
+    /* dumpsys */
+    void dump(char *buff, int buff_len);
+
 private:
     // holds the copybit device
     struct copybit_device_t *mEngine;
     // Helper functions for copybit composition
     int  drawLayerUsingCopybit(hwc_context_t *dev, hwc_layer_1_t *layer,
-                                       private_handle_t *renderBuffer, int dpy);
+                                       private_handle_t *renderBuffer, int dpy,
+                                       const hwc_rect_t& dirtyRect);
     bool canUseCopybitForYUV (hwc_context_t *ctx);
     bool canUseCopybitForRGB (hwc_context_t *ctx,
                                      hwc_display_contents_1_t *list, int dpy);
     bool validateParams (hwc_context_t *ctx,
                                 const hwc_display_contents_1_t *list);
+    // Reads back the completion time of the previous copybit draw
+    void updateMeasuredTime();
     //Flags if this feature is on.
     bool mIsModeOn;
     // flag that indicates whether CopyBit composition is enabled for this cycle
@@ -72,16 +119,73 @@ private:
 
     int clear (private_handle_t* hnd, hwc_rect_t& rect);
 
-    private_handle_t* mRenderBuffer[NUM_RENDER_BUFFERS];
+    // Picks the render buffer to draw into, preferring one whose release
+    // fence has already signaled. Blocks only if none of them is free.
+    int getFreeRenderBufferIndex();
+
+    // Swap rect: returns the area that changed since the last frame drawn
+    // by copybit and remembers the current layer state for the next one.
+    // Frames not composed by copybit reset the state in draw.
+    hwc_rect_t getFrameDamage(hwc_context_t *ctx,
+                              const hwc_display_contents_1_t *list, int dpy);
+
+    private_handle_t* mRenderBuffer[MAX_RENDER_BUFFERS];
+
+    // Number of intermediate render buffers in use
+    int mNumRenderBuffers;
 
     // Index of the current intermediate render buffer
     int mCurRenderBufferIndex;
 
     // Release FDs of the intermediate render buffer
-    int mRelFd[NUM_RENDER_BUFFERS];
-
-    //Dynamic composition threshold for deciding copybit usage.
+    int mRelFd[MAX_RENDER_BUFFERS];
+
+    // Frame count at which each render buffer was last drawn into
+    uint32_t mRenderBufferSeq[MAX_RENDER_BUFFERS];
+
+    // Area of each render buffer that is stale since it was last drawn into
+    hwc_rect_t mDirtyRect[MAX_RENDER_BUFFERS];
+
+    // Layer state of the last frame composed by copybit
+    struct LayerState {
+        buffer_handle_t handle;
+        hwc_rect_t displayFrame;
+        hwc_rect_t sourceCrop;
+        uint32_t transform;
+        int32_t blending;
+        uint8_t planeAlpha;
+        bool isCopybit;
+    };
+    LayerState mPrevLayerState[MAX_NUM_APP_LAYERS];
+    // -1 when there is no valid previous state
+    int mPrevLayerCount;
+    // Flags if only the damaged area is recomposed
+    bool mSwapRectOn;
+
+    // Fence wait statistics, reported in dumpsys
+    uint32_t mFrameCount;
+    uint32_t mBlockedFrameCount;
+    nsecs_t mLastFenceWaitTime;
+    nsecs_t mMaxFenceWaitTime;
+    nsecs_t mTotalFenceWaitTime;
+
+    // Bytes written into the render buffer, reported in dumpsys
+    uint64_t mLastBytesWritten;
+    uint64_t mTotalBytesWritten;
+
+    //Dynamic composition threshold for deciding copybit usage, used when
+    //there is no calibrated cost model.
     double mDynThreshold;
+    CopyBitCostModel mCostModel;
+    //Predicted copybit time of the frame being prepared
+    nsecs_t mPredictedTime;
+    //Predicted and measured copybit time of the last measured frame
+    nsecs_t mMeasuredPredictedTime;
+    nsecs_t mMeasuredTime;
+    //Fence, submit time and prediction of the last draw, for measuring it
+    int mMeasureFd;
+    nsecs_t mSubmitTime;
+    nsecs_t mSubmitPredictedTime;
     int mAlignedFBWidth;
     int mAlignedFBHeight;
 };
@@ -33,9 +33,11 @@
 #define LOG_NDEBUG 0
 #include <hwc_utils.h>
 #include <hwc_dump_layers.h>
+#include <format_info.h>
 #include <cutils/log.h>
 #include <sys/stat.h>
 #include <comptype.h>
+#include <gr.h>
 #include <SkBitmap.h>
 #include <SkImageEncoder.h>
 
@@ -306,6 +308,8 @@ void HwcDebug::dumpLayer(size_t layerIndex, hwc_layer_1_t hwLayers[])
     }
 
     getHalPixelFormatStr(hnd->format, pixFormatStr);
+    // The data plane may not be mapped yet with persist.gralloc.lazy_map
+    mapBufferData(hnd);
 
 #if 0
     if (needDumpPng && hnd->base) {
@@ -350,15 +354,32 @@ void HwcDebug::dumpLayer(size_t layerIndex, hwc_layer_1_t hwLayers[])
     if (needDumpRaw && hnd->base) {
         char dumpFilename[PATH_MAX];
         bool bResult = false;
+        void *dumpBase = (void*)hnd->base;
+        size_t dumpSize = hnd->size;
+        uint8_t *linear = NULL;
+        if (hnd->format == HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED) {
+            // Tiled buffers are not viewable as is, dump them as linear NV12
+            size_t lumaSize = hnd->width * hnd->height;
+            linear = (uint8_t *)malloc(lumaSize + lumaSize / 2);
+            if (linear && !detileNV12((const uint8_t *)hnd->base, hnd->width,
+                    hnd->height, linear, linear + lumaSize, hnd->width,
+                    false, 0)) {
+                dumpBase = linear;
+                dumpSize = lumaSize + lumaSize / 2;
+                getHalPixelFormatStr(HAL_PIXEL_FORMAT_YCbCr_420_SP,
+                                     pixFormatStr);
+            }
+        }
         snprintf(dumpFilename, PATH_MAX, "%s/sfdump%03d.layer%d.%dx%d.%s.%s.raw",
             mDumpDirRaw, mDumpCntrRaw,
             layerIndex, hnd->width, hnd->height,
             pixFormatStr, mDisplayName);
         FILE* fp = fopen(dumpFilename, "w+");
         if (NULL != fp) {
-            bResult = (bool) fwrite((void*)hnd->base, hnd->size, 1, fp);
+            bResult = (bool) fwrite(dumpBase, dumpSize, 1, fp);
             fclose(fp);
         }
+        free(linear);
         ALOGI("Display[%s] Layer[%d] %s Dump to %s: %s",
             mDisplayName, layerIndex, dumpLogStrRaw,
             dumpFilename, bResult ? "Success" : "Fail");
@@ -370,68 +391,11 @@ void HwcDebug::getHalPixelFormatStr(int format, char pixFormatStr[])
     if (!pixFormatStr)
         return;
 
-    switch(format) {
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-            strlcpy(pixFormatStr, "RGBA_8888", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-            strlcpy(pixFormatStr, "RGBX_8888", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_RGB_888:
-            strlcpy(pixFormatStr, "RGB_888", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_BGR_888:
-            strlcpy(pixFormatStr, "BGR_888", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_RGB_565:
-            strlcpy(pixFormatStr, "RGB_565", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-            strlcpy(pixFormatStr, "BGRA_8888", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_YV12:
-            strlcpy(pixFormatStr, "YV12", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
-            strlcpy(pixFormatStr, "YCbCr_422_SP_NV16", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-            strlcpy(pixFormatStr, "YCrCb_420_SP_NV21", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_422_I:
-            strlcpy(pixFormatStr, "YCbCr_422_I_YUY2", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_NV12_ENCODEABLE:
-            strlcpy(pixFormatStr, "NV12_ENCODEABLE", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED:
-            strlcpy(pixFormatStr, "YCbCr_420_SP_TILED_TILE_4x2", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
-            strlcpy(pixFormatStr, "YCbCr_420_SP", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP_ADRENO:
-            strlcpy(pixFormatStr, "YCrCb_420_SP_ADRENO", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_YCrCb_422_SP:
-            strlcpy(pixFormatStr, "YCrCb_422_SP", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_R_8:
-            strlcpy(pixFormatStr, "R_8", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_RG_88:
-            strlcpy(pixFormatStr, "RG_88", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_INTERLACE:
-            strlcpy(pixFormatStr, "INTERLACE", PIXEL_FMRT_LEN);
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP_VENUS:
-            strlcpy(pixFormatStr, "YCbCr_420_SP_VENUS", PIXEL_FMRT_LEN);
-            break;
-        default:
-            snprintf(pixFormatStr, PIXEL_FMRT_LEN, "Unknown0x%X", format);
-            break;
-    }
+    const format_info *info = getFormatInfo(format);
+    if (info)
+        strlcpy(pixFormatStr, info->name, PIXEL_FMRT_LEN);
+    else
+        snprintf(pixFormatStr, PIXEL_FMRT_LEN, "Unknown0x%X", format);
 }
 
 } // namespace qhwc
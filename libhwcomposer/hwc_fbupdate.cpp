@@ -73,15 +73,21 @@ bool FBUpdateLowRes::preRotateExtDisplay(hwc_context_t *ctx,
     ovutils::eTransform orient = static_cast<ovutils::eTransform >(extOrient);
 
     if(mDpy && (extOrient & HWC_TRANSFORM_ROT_90)) {
-        mRot = ctx->mRotMgr->getNext();
+        bool secure = (mdpFlags & ovutils::OV_MDP_SECURE_OVERLAY_SESSION);
+        mRot = ctx->mRotMgr->getNext(info, orient, secure);
         if(mRot == NULL) return false;
         Whf origWhf(mAlignedFBWidth, mAlignedFBHeight,
                     getMdpFormat(HAL_PIXEL_FORMAT_RGBA_8888));
         //Configure rotator for pre-rotation
         if(configRotator(mRot, info, origWhf, mdpFlags, orient, 0) < 0) {
-            ALOGE("%s: configRotator Failed!", __FUNCTION__);
-            mRot = NULL;
-            return false;
+            //Rotate on the CPU if the hardware rotator can't
+            mRot = ctx->mRotMgr->getSwFallback(mRot, info, orient, secure);
+            if(mRot == NULL || configRotator(mRot, info, origWhf, mdpFlags,
+                    orient, 0) < 0) {
+                ALOGE("%s: configRotator Failed!", __FUNCTION__);
+                mRot = NULL;
+                return false;
+            }
         }
        ctx->mLayerRotMap[mDpy]->add(layer, mRot);
         info.format = (mRot)->getDstFormat();
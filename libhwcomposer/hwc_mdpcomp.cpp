@@ -365,10 +365,6 @@ bool MDPComp::isValidDimension(hwc_context_t *ctx, hwc_layer_1_t *layer) {
 
     int crop_w = crop.right - crop.left;
     int crop_h = crop.bottom - crop.top;
-    int dst_w = dst.right - dst.left;
-    int dst_h = dst.bottom - dst.top;
-    float w_dscale = ceilf((float)crop_w / (float)dst_w);
-    float h_dscale = ceilf((float)crop_h / (float)dst_h);
 
     //Workaround for MDP HW limitation in DSI command mode panels where
     //FPS will not go beyond 30 if buffers on RGB pipes are of width < 5
@@ -376,18 +372,63 @@ bool MDPComp::isValidDimension(hwc_context_t *ctx, hwc_layer_1_t *layer) {
     if((crop_w < 5)||(crop_h < 5))
         return false;
 
-    if(ctx->mMDP.version >= qdutils::MDSS_V5) {
-        /* Workaround for downscales larger than 4x.
-         * Will be removed once decimator block is enabled for MDSS
-         */
-        if(w_dscale > 4.0f || h_dscale > 4.0f)
-            return false;
-    } else {
-        if(w_dscale > 8.0f || h_dscale > 8.0f)
-            // MDP 4 supports 1/8 downscale
+    if(hw_w <= MAX_DISPLAY_DIM)
+        return isValidPipeConfig(layer, crop, dst);
+
+    //High res panels use a pipe per mixer for the parts of the layer on
+    //each half of the screen. Split the way configureHighRes does: in the
+    //pre-rotated source for YUV layers with a 90 component, with the flips
+    //left to the rotator or the MDP.
+    bool preRotated = isYuvBuffer(hnd) && has90Transform(layer);
+    if(preRotated) {
+        ovutils::eTransform orient =
+                static_cast<ovutils::eTransform>(layer->transform);
+        ovutils::Whf whf(getWidth(hnd), getHeight(hnd),
+                getMdpFormat(hnd->format), hnd->size);
+        updateSource(orient, whf, crop);
+    }
+    for(int i = 0; i < 2; i++) {
+        hwc_rect_t tmpCrop = crop;
+        hwc_rect_t tmpDst = dst;
+        hwc_rect_t scissor = {i * hw_w / 2, 0, (i + 1) * hw_w / 2, hw_h};
+        if(dst.right <= scissor.left || dst.left >= scissor.right)
+            continue;
+        qhwc::calculate_crop_rects(tmpCrop, tmpDst, scissor, 0);
+        if(!isValidPipeConfig(layer, tmpCrop, tmpDst, preRotated))
             return false;
     }
+    return true;
+}
+
+bool MDPComp::isValidPipeConfig(hwc_layer_1_t *layer, const hwc_rect_t& crop,
+        const hwc_rect_t& dst, bool cropRotated) {
+    private_handle_t *hnd = (private_handle_t *)layer->handle;
+    int format = getMdpFormat(hnd->format);
+    if(format < 0)
+        return false;
 
+    ovutils::PipeArgs args;
+    args.whf = ovutils::Whf(getWidth(hnd), getHeight(hnd), format,
+            hnd->size);
+    ovutils::Dim cropDim(crop.left, crop.top, crop.right - crop.left,
+            crop.bottom - crop.top);
+    ovutils::Dim dstDim(dst.left, dst.top, dst.right - dst.left,
+            dst.bottom - dst.top);
+    //The rotator pre-rotates YUV layers with a 90 component
+    if(isYuvBuffer(hnd) && has90Transform(layer)) {
+        args.rotFlags = ovutils::ROT_PREROTATED;
+        ovutils::swap(args.whf.w, args.whf.h);
+        if(!cropRotated)
+            ovutils::swap(cropDim.w, cropDim.h);
+    }
+    ovutils::eMdpPipeType type = isYuvBuffer(hnd) ?
+            ovutils::OV_MDP_PIPE_VG : ovutils::OV_MDP_PIPE_ANY;
+    if(!ovutils::isSupportedConfig(type, args, cropDim, dstDim)) {
+        ALOGD_IF(isDebug(), "%s: crop %dx%d dst %dx%d format %d not "
+                "supported by MDP", __FUNCTION__, cropDim.w, cropDim.h,
+                dstDim.w, dstDim.h, format);
+        return false;
+    }
     return true;
 }
 
@@ -588,12 +629,7 @@ bool MDPComp::fullMDPComp(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
         return false;
     }
 
-    int numPipesNeeded = pipesNeeded(ctx, list);
-    int availPipes = getAvailablePipes(ctx);
-
-    if(numPipesNeeded > availPipes) {
-        ALOGD_IF(isDebug(), "%s: Insufficient MDP pipes, needed %d, avail %d",
-                __FUNCTION__, numPipesNeeded, availPipes);
+    if(!arePipesAvailable(ctx, list)) {
         return false;
     }
 
@@ -645,12 +681,7 @@ bool MDPComp::partialMDPComp(hwc_context_t *ctx, hwc_display_contents_1_t* list)
         return false;
     }
 
-    int numPipesNeeded = pipesNeeded(ctx, list);
-    int availPipes = getAvailablePipes(ctx);
-
-    if(numPipesNeeded > availPipes) {
-        ALOGD_IF(isDebug(), "%s: Insufficient MDP pipes, needed %d, avail %d",
-                __FUNCTION__, numPipesNeeded, availPipes);
+    if(!arePipesAvailable(ctx, list)) {
         return false;
     }
 
@@ -677,11 +708,7 @@ bool MDPComp::isOnlyVideoDoable(hwc_context_t *ctx,
         return false;
     }
 
-    int numPipesNeeded = pipesNeeded(ctx, list);
-    int availPipes = getAvailablePipes(ctx);
-    if(numPipesNeeded > availPipes) {
-        ALOGD_IF(isDebug(), "%s: Insufficient MDP pipes, needed %d, avail %d",
-                __FUNCTION__, numPipesNeeded, availPipes);
+    if(!arePipesAvailable(ctx, list)) {
         return false;
     }
 
@@ -736,10 +763,12 @@ bool MDPComp::isYUVDoable(hwc_context_t* ctx, hwc_layer_1_t* layer) {
 bool MDPComp::batchLayers(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
     /* Idea is to keep as many contiguous non-updating(cached) layers in FB and
      * send rest of them through MDP. NEVER mark an updating layer for caching.
-     * But cached ones can be marked for MDP*/
+     * But cached ones can be marked for MDP. The batch saving the most pipes
+     * wins, which is the longest one unless layers take several pipes*/
 
     int maxBatchStart = -1;
     int maxBatchCount = 0;
+    int maxBatchPipes = 0;
 
     /* All or Nothing is cached. No batching needed */
     if(!mCurrentFrame.fbCount) {
@@ -755,10 +784,13 @@ bool MDPComp::batchLayers(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
     int i = 0;
     while (i < mCurrentFrame.layerCount) {
         int count = 0;
+        int pipes = 0;
         while(mCurrentFrame.isFBComposed[i] && i < mCurrentFrame.layerCount) {
+            pipes += pipesForLayer(ctx, &list->hwLayers[i]);
             count++; i++;
         }
-        if(count > maxBatchCount) {
+        if(pipes > maxBatchPipes) {
+            maxBatchPipes = pipes;
             maxBatchCount = count;
             maxBatchStart = i - count;
             mCurrentFrame.fbZ = maxBatchStart;
@@ -832,6 +864,19 @@ void MDPComp::updateLayerCache(hwc_context_t* ctx,
             mCurrentFrame.mdpCount, mCurrentFrame.fbCount);
 }
 
+bool MDPComp::arePipesAvailable(hwc_context_t *ctx,
+        hwc_display_contents_1_t* list) {
+    int numPipesNeeded = pipesNeeded(ctx, list);
+    int availPipes = getAvailablePipes(ctx);
+
+    if(numPipesNeeded > availPipes) {
+        ALOGD_IF(isDebug(), "%s: Insufficient MDP pipes, needed %d, avail %d",
+                __FUNCTION__, numPipesNeeded, availPipes);
+        return false;
+    }
+    return true;
+}
+
 int MDPComp::getAvailablePipes(hwc_context_t* ctx) {
     int numDMAPipes = qdutils::MDPVersion::getInstance().getDMAPipes();
     overlay::Overlay& ov = *ctx->mOverlay;
@@ -882,6 +927,8 @@ bool MDPComp::programMDP(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
         return false;
     }
 
+    //Pipe sets of the frame go to the driver together
+    ctx->mOverlay->beginBatch(mDpy);
     bool fbBatch = false;
     for (int index = 0, mdpNextZOrder = 0; index < mCurrentFrame.layerCount;
             index++) {
@@ -895,6 +942,7 @@ bool MDPComp::programMDP(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
             if(configure(ctx, layer, mCurrentFrame.mdpToLayer[mdpIndex]) != 0 ){
                 ALOGD_IF(isDebug(), "%s: Failed to configure overlay for \
                          layer %d",__FUNCTION__, index);
+                ctx->mOverlay->abortBatch(mDpy);
                 return false;
             }
         } else if(fbBatch == false) {
@@ -903,7 +951,7 @@ bool MDPComp::programMDP(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
         }
     }
 
-    return true;
+    return ctx->mOverlay->flushBatch(mDpy);
 }
 
 bool MDPComp::programYUV(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
@@ -913,6 +961,7 @@ bool MDPComp::programYUV(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
     }
     //If we are in this block, it means we have yuv + rgb layers both
     int mdpIdx = 0;
+    ctx->mOverlay->beginBatch(mDpy);
     for (int index = 0; index < mCurrentFrame.layerCount; index++) {
         if(!mCurrentFrame.isFBComposed[index]) {
             hwc_layer_1_t* layer = &list->hwLayers[index];
@@ -925,11 +974,12 @@ bool MDPComp::programYUV(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
                         mCurrentFrame.mdpToLayer[mdpIndex]) != 0 ){
                 ALOGD_IF(isDebug(), "%s: Failed to configure overlay for \
                         layer %d",__FUNCTION__, index);
+                ctx->mOverlay->abortBatch(mDpy);
                 return false;
             }
         }
     }
-    return true;
+    return ctx->mOverlay->flushBatch(mDpy);
 }
 
 int MDPComp::prepare(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
@@ -1259,102 +1309,152 @@ bool MDPCompLowRes::draw(hwc_context_t *ctx, hwc_display_contents_1_t* list) {
 
 //=============MDPCompHighRes===================================================
 
+int MDPCompHighRes::getSplitMask(hwc_context_t *ctx, hwc_layer_1_t *layer) {
+    int mid = ctx->dpyAttr[mDpy].xres / 2;
+    hwc_rect_t dst = layer->displayFrame;
+    //Left mixer covers [0, mid), right one [mid, xres)
+    if(dst.right <= mid)
+        return SPLIT_LEFT;
+    if(dst.left >= mid)
+        return SPLIT_RIGHT;
+    return SPLIT_LEFT | SPLIT_RIGHT;
+}
+
+int MDPCompHighRes::pipesForLayer(hwc_context_t *ctx, hwc_layer_1_t *layer) {
+    return (getSplitMask(ctx, layer) == (SPLIT_LEFT | SPLIT_RIGHT)) ? 2 : 1;
+}
+
+MDPComp::ePipeType MDPCompHighRes::getPipeType(hwc_context_t *ctx,
+                                               hwc_layer_1_t *layer) {
+    private_handle_t *hnd = (private_handle_t *)layer->handle;
+    if(isYuvBuffer(hnd))
+        return MDPCOMP_OV_VG;
+    if(!qhwc::needsScaling(ctx,layer,mDpy) && !ctx->mNeedsRotator
+       && ctx->mMDP.version >= qdutils::MDSS_V5)
+        return MDPCOMP_OV_DMA;
+    return MDPCOMP_OV_ANY;
+}
+
+void MDPCompHighRes::getPipeDemand(hwc_context_t *ctx,
+                                   hwc_display_contents_1_t* list,
+                                   int demand[MDPCOMP_OV_ANY + 1]) {
+    memset(demand, 0, sizeof(int) * (MDPCOMP_OV_ANY + 1));
+    for(int i = 0; i < mCurrentFrame.layerCount; ++i) {
+        if(!mCurrentFrame.isFBComposed[i]) {
+            hwc_layer_1_t* layer = &list->hwLayers[i];
+            demand[getPipeType(ctx, layer)] += pipesForLayer(ctx, layer);
+        }
+    }
+}
+
 int MDPCompHighRes::pipesNeeded(hwc_context_t *ctx,
                                 hwc_display_contents_1_t* list) {
     int pipesNeeded = 0;
-    int hw_w = ctx->dpyAttr[mDpy].xres;
 
     for(int i = 0; i < mCurrentFrame.layerCount; ++i) {
         if(!mCurrentFrame.isFBComposed[i]) {
-            hwc_layer_1_t* layer = &list->hwLayers[i];
-            hwc_rect_t dst = layer->displayFrame;
-            if(dst.left > hw_w/2) {
-                pipesNeeded++;
-            } else if(dst.right <= hw_w/2) {
-                pipesNeeded++;
-            } else {
-                pipesNeeded += 2;
-            }
+            pipesNeeded += pipesForLayer(ctx, &list->hwLayers[i]);
         }
     }
     return pipesNeeded;
 }
 
+bool MDPCompHighRes::arePipesAvailable(hwc_context_t *ctx,
+                                       hwc_display_contents_1_t* list) {
+    if(!MDPComp::arePipesAvailable(ctx, list))
+        return false;
+
+    //A layer half never exceeds its mixer half, so only the display split
+    //has to fit the mixers
+    int xres = ctx->dpyAttr[mDpy].xres;
+    int maxMixerWidth =
+            qdutils::MDPVersion::getInstance().getCaps().maxMixerWidth;
+    if(xres - xres / 2 > maxMixerWidth) {
+        ALOGD_IF(isDebug(), "%s: xres %d too wide for 2 mixers of %d",
+                __FUNCTION__, xres, maxMixerWidth);
+        return false;
+    }
+
+    //Pipes are taken for video first, then for the scaling layers, the
+    //unscaled ones get DMA or whatever is left. The FB target follows
+    //with RGB, then VG pipes. Check each step fits.
+    overlay::Overlay& ov = *ctx->mOverlay;
+    int demand[MDPCOMP_OV_ANY + 1];
+    getPipeDemand(ctx, list, demand);
+
+    int availVG = ov.availablePipes(mDpy, ovutils::OV_MDP_PIPE_VG);
+    if(demand[MDPCOMP_OV_VG] > availVG) {
+        ALOGD_IF(isDebug(), "%s: Insufficient VG pipes, needed %d, avail %d",
+                __FUNCTION__, demand[MDPCOMP_OV_VG], availVG);
+        return false;
+    }
+
+    int availDMA = ov.availablePipes(mDpy, ovutils::OV_MDP_PIPE_DMA);
+    int spill = demand[MDPCOMP_OV_ANY];
+    if(demand[MDPCOMP_OV_DMA] > availDMA)
+        spill += demand[MDPCOMP_OV_DMA] - availDMA;
+    if(mCurrentFrame.fbCount)
+        spill += pipesForFB();
+    int availScaling = availVG - demand[MDPCOMP_OV_VG] +
+            ov.availablePipes(mDpy, ovutils::OV_MDP_PIPE_RGB);
+    if(spill > availScaling) {
+        ALOGD_IF(isDebug(), "%s: Insufficient RGB/VG pipes, needed %d, "
+                "avail %d", __FUNCTION__, spill, availScaling);
+        return false;
+    }
+    return true;
+}
+
 bool MDPCompHighRes::acquireMDPPipes(hwc_context_t *ctx, hwc_layer_1_t* layer,
                                      MdpPipeInfoHighRes& pipe_info,
                                      ePipeType type) {
-    int hw_w = ctx->dpyAttr[mDpy].xres;
+    int split = getSplitMask(ctx, layer);
 
-    hwc_rect_t dst = layer->displayFrame;
-    if(dst.left > hw_w/2) {
-        pipe_info.lIndex = ovutils::OV_INVALID;
+    pipe_info.lIndex = ovutils::OV_INVALID;
+    pipe_info.rIndex = ovutils::OV_INVALID;
+    if(split & SPLIT_RIGHT) {
         pipe_info.rIndex = getMdpPipe(ctx, type);
         if(pipe_info.rIndex == ovutils::OV_INVALID)
             return false;
-    } else if (dst.right <= hw_w/2) {
-        pipe_info.rIndex = ovutils::OV_INVALID;
+    }
+    if(split & SPLIT_LEFT) {
         pipe_info.lIndex = getMdpPipe(ctx, type);
         if(pipe_info.lIndex == ovutils::OV_INVALID)
             return false;
-    } else {
-        pipe_info.rIndex = getMdpPipe(ctx, type);
-        pipe_info.lIndex = getMdpPipe(ctx, type);
-        if(pipe_info.rIndex == ovutils::OV_INVALID ||
-           pipe_info.lIndex == ovutils::OV_INVALID)
-            return false;
     }
     return true;
 }
 
 bool MDPCompHighRes::allocLayerPipes(hwc_context_t *ctx,
                                      hwc_display_contents_1_t* list) {
-    overlay::Overlay& ov = *ctx->mOverlay;
-    int layer_count = ctx->listStats[mDpy].numAppLayers;
+    //Same order arePipesAvailable planned with, so the scarce types go to
+    //the layers that can't do without them
+    const ePipeType order[] = { MDPCOMP_OV_VG, MDPCOMP_OV_ANY, MDPCOMP_OV_DMA };
 
-    if(isYuvPresent(ctx, mDpy)) {
-        int nYuvCount = ctx->listStats[mDpy].yuvCount;
+    for(int pass = 0; pass < (int)(sizeof(order) / sizeof(order[0])); pass++) {
+        for(int index = 0; index < mCurrentFrame.layerCount; index++) {
+            if(mCurrentFrame.isFBComposed[index])
+                continue;
 
-        for(int index = 0; index < nYuvCount; index ++) {
-            int nYuvIndex = ctx->listStats[mDpy].yuvIndices[index];
-            hwc_layer_1_t* layer = &list->hwLayers[nYuvIndex];
-            PipeLayerPair& info = mCurrentFrame.mdpToLayer[nYuvIndex];
+            hwc_layer_1_t* layer = &list->hwLayers[index];
+            ePipeType type = getPipeType(ctx, layer);
+            if(type != order[pass])
+                continue;
+
+            int mdpIndex = mCurrentFrame.layerToMDP[index];
+            PipeLayerPair& info = mCurrentFrame.mdpToLayer[mdpIndex];
             info.pipeInfo = new MdpPipeInfoHighRes;
             info.rot = NULL;
             MdpPipeInfoHighRes& pipe_info = *(MdpPipeInfoHighRes*)info.pipeInfo;
-            if(!acquireMDPPipes(ctx, layer, pipe_info,MDPCOMP_OV_VG)) {
-                ALOGD_IF(isDebug(),"%s: Unable to get pipe for videos",
-                         __FUNCTION__);
+
+            if(!acquireMDPPipes(ctx, layer, pipe_info, type)) {
+                ALOGD_IF(isDebug(), "%s: Unable to get pipe for layer %d "
+                         "type %d", __FUNCTION__, index, type);
                 //TODO: windback pipebook data on fail
                 return false;
             }
-            pipe_info.zOrder = nYuvIndex;
-        }
-    }
-
-    for(int index = 0 ; index < layer_count ; index++ ) {
-        hwc_layer_1_t* layer = &list->hwLayers[index];
-        private_handle_t *hnd = (private_handle_t *)layer->handle;
-
-        if(isYuvBuffer(hnd))
-            continue;
-
-        PipeLayerPair& info = mCurrentFrame.mdpToLayer[index];
-        info.pipeInfo = new MdpPipeInfoHighRes;
-        info.rot = NULL;
-        MdpPipeInfoHighRes& pipe_info = *(MdpPipeInfoHighRes*)info.pipeInfo;
-
-        ePipeType type = MDPCOMP_OV_ANY;
-
-        if(!qhwc::needsScaling(ctx,layer,mDpy) && !ctx->mNeedsRotator
-           && ctx->mMDP.version >= qdutils::MDSS_V5)
-            type = MDPCOMP_OV_DMA;
-
-        if(!acquireMDPPipes(ctx, layer, pipe_info, type)) {
-            ALOGD_IF(isDebug(), "%s: Unable to get pipe for UI", __FUNCTION__);
-            //TODO: windback pipebook data on fail
-            return false;
+            pipe_info.zOrder = index;
         }
-        pipe_info.zOrder = index;
     }
     return true;
 }
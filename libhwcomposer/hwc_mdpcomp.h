@@ -124,6 +124,13 @@ protected:
     /* calculates pipes needed for the panel */
     virtual int pipesNeeded(hwc_context_t *ctx,
                             hwc_display_contents_1_t* list) = 0;
+    /* pipes a layer takes on the panel */
+    virtual int pipesForLayer(hwc_context_t *ctx, hwc_layer_1_t *layer) {
+        return 1;
+    };
+    /* checks the pipes needed for the frame against the available ones */
+    virtual bool arePipesAvailable(hwc_context_t *ctx,
+                                   hwc_display_contents_1_t* list);
     /* allocates pipe from pipe book */
     virtual bool allocLayerPipes(hwc_context_t *ctx,
                                  hwc_display_contents_1_t* list) = 0;
@@ -158,6 +165,10 @@ protected:
     static bool isEnabled() { return sEnabled; };
     /* checks for mdp comp dimension limitation */
     bool isValidDimension(hwc_context_t *ctx, hwc_layer_1_t *layer);
+    /* checks the pipe config for a part of a layer against the mdp caps,
+     * cropRotated if the crop is in the pre-rotated source already */
+    bool isValidPipeConfig(hwc_layer_1_t *layer, const hwc_rect_t& crop,
+            const hwc_rect_t& dst, bool cropRotated = false);
     /* tracks non updating layers*/
     void updateLayerCache(hwc_context_t* ctx, hwc_display_contents_1_t* list);
     /* gets available pipes for mdp comp */
@@ -217,6 +228,7 @@ public:
     virtual bool draw(hwc_context_t *ctx, hwc_display_contents_1_t *list);
 private:
     enum {MAX_PIPES_PER_LAYER = 2};
+    enum { SPLIT_LEFT = 0x1, SPLIT_RIGHT = 0x2 };
     struct MdpPipeInfoHighRes : public MdpPipeInfo {
         ovutils::eDest lIndex;
         ovutils::eDest rIndex;
@@ -225,6 +237,17 @@ private:
 
     bool acquireMDPPipes(hwc_context_t *ctx, hwc_layer_1_t* layer,
                          MdpPipeInfoHighRes& pipe_info, ePipeType type);
+    /* mixers the layer lands on, SPLIT_LEFT and/or SPLIT_RIGHT */
+    int getSplitMask(hwc_context_t *ctx, hwc_layer_1_t *layer);
+    /* pipe type the layer asks for */
+    ePipeType getPipeType(hwc_context_t *ctx, hwc_layer_1_t *layer);
+    /* pipes of the types needed by the MDP layers, per ePipeType */
+    void getPipeDemand(hwc_context_t *ctx, hwc_display_contents_1_t* list,
+                       int demand[MDPCOMP_OV_ANY + 1]);
+
+    virtual int pipesForLayer(hwc_context_t *ctx, hwc_layer_1_t *layer);
+    virtual bool arePipesAvailable(hwc_context_t *ctx,
+                                   hwc_display_contents_1_t* list);
 
     virtual int pipesForFB() { return 2; };
     /* configure's overlay pipes for the frame */
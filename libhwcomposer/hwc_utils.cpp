@@ -1301,6 +1301,26 @@ int hwc_sync(hwc_context_t *ctx, hwc_display_contents_1_t* list, int dpy,
     if(dpy)
        isExtAnimating = ctx->listStats[dpy].isDisplayAnimating;
 
+    //Software rotators read the layer and MDP reads their output, which
+    //is rotated only after this, when the layers are queued.
+    for(uint32_t i = 0; i < ctx->mLayerRotMap[dpy]->getCount(); i++) {
+        hwc_layer_1_t *pLayer = ctx->mLayerRotMap[dpy]->getLayer(i);
+        overlay::Rotator *pRot = ctx->mLayerRotMap[dpy]->getRot(i);
+        if(!pLayer || !pRot || !pRot->isSoftware())
+            continue;
+        pRot->setAcquireFence(pLayer->acquireFenceFd);
+        int outFence = pRot->getOutputFence();
+        if(outFence < 0)
+            continue;
+        if(pLayer->acquireFenceFd >= 0)
+            close(pLayer->acquireFenceFd);
+        pLayer->acquireFenceFd = outFence;
+        //The layer buffer is free once it has been rotated
+        pLayer->releaseFenceFd = dup(outFence);
+        //Waiting on it would wait for the queueing that follows
+        data.flags &= ~MDP_BUF_SYNC_FLAG_WAIT;
+    }
+
 #ifndef MDSS_TARGET
     //Send acquireFenceFds to rotator
     if(mdpVersion < qdutils::MDSS_V5) {
@@ -1312,6 +1332,8 @@ int hwc_sync(hwc_context_t *ctx, hwc_display_contents_1_t* list, int dpy,
             hwc_layer_1_t *pLayer = ctx->mLayerRotMap[dpy]->getLayer(i);
             overlay::Rotator *pRot = ctx->mLayerRotMap[dpy]->getRot(i);
             memset(&rotData, 0, sizeof(rotData));
+            if(pRot && pRot->isSoftware())
+                continue;
             if (pLayer && pRot) {
                 int& acquireFenceFd = pLayer->acquireFenceFd;
                 rotData.acq_fen_fd = acquireFenceFd;
@@ -1381,6 +1403,11 @@ int hwc_sync(hwc_context_t *ctx, hwc_display_contents_1_t* list, int dpy,
                 (layerProp[i].mFlags & HWC_MDPCOMP)) ||
                 list->hwLayers[i].compositionType == HWC_FRAMEBUFFER_TARGET) {
             //Populate releaseFenceFds.
+            if(UNLIKELY(swapzero) || isExtAnimating) {
+                //Rotators may have populated it already
+                if(list->hwLayers[i].releaseFenceFd >= 0)
+                    close(list->hwLayers[i].releaseFenceFd);
+            }
             if(UNLIKELY(swapzero)) {
                 list->hwLayers[i].releaseFenceFd = -1;
             } else if(isExtAnimating) {
@@ -1406,6 +1433,8 @@ int hwc_sync(hwc_context_t *ctx, hwc_display_contents_1_t* list, int dpy,
     if(mdpVersion < qdutils::MDSS_V5) {
         //Signals when MDP finishes reading rotator buffers.
         ctx->mLayerRotMap[dpy]->setReleaseFd(releaseFd);
+    } else {
+        ctx->mLayerRotMap[dpy]->setSwReleaseFd(releaseFd);
     }
 
     // if external is animating, close the relaseFd
@@ -1671,19 +1700,35 @@ int configureLowRes(hwc_context_t *ctx, hwc_layer_1_t *layer,
     calcExtDisplayPosition(ctx, hnd, dpy, crop, dst, transform, orient);
 
     bool forceRot = false;
+    DownscalePlan dsPlan;
     if(isYuvBuffer(hnd) && ctx->mMDP.version >= qdutils::MDP_V4_2 &&
        ctx->mMDP.version < qdutils::MDSS_V5) {
-        downscale =  getDownscaleFactor(
-            crop.right - crop.left,
-            crop.bottom - crop.top,
-            dst.right - dst.left,
-            dst.bottom - dst.top);
+        forceRot = needToForceRotator(ctx, dpy, (uint32_t)getWidth(hnd),
+                (uint32_t)getHeight(hnd), transform);
+
+        //Split the downscale between the rotator and MDP. The source is
+        //what MDP sees, after any rotation.
+        DownscaleParams dsParams;
+        dsParams.srcW = crop.right - crop.left;
+        dsParams.srcH = crop.bottom - crop.top;
+        if(transform & HWC_TRANSFORM_ROT_90)
+            swap(dsParams.srcW, dsParams.srcH);
+        dsParams.dstW = dst.right - dst.left;
+        dsParams.dstH = dst.bottom - dst.top;
+        dsParams.format = whf.format;
+        if(ctx->dpyAttr[dpy].vsync_period)
+            dsParams.fps = 1000000000 / ctx->dpyAttr[dpy].vsync_period;
+        dsParams.panelW = ctx->dpyAttr[dpy].xres;
+        dsParams.panelH = ctx->dpyAttr[dpy].yres;
+        //MDP4 runs video layers direct, the planner accounts for the
+        //switch to BLT a large MDP downscale causes
+        dsParams.blt = false;
+        dsParams.rotRequired = (transform & HWC_TRANSFORM_ROT_90) || forceRot;
+        dsPlan = planDownscale(dsParams);
+        downscale = dsPlan.rotDownscale;
         if(downscale) {
             rotFlags = ROT_DOWNSCALE_ENABLED;
         }
-
-        forceRot = needToForceRotator(ctx, dpy, (uint32_t)getWidth(hnd),
-                (uint32_t)getHeight(hnd), transform);
     }
 
     setMdpFlags(layer, mdpFlags, downscale, transform);
@@ -1691,14 +1736,20 @@ int configureLowRes(hwc_context_t *ctx, hwc_layer_1_t *layer,
 
     if(isYuvBuffer(hnd) && //if 90 component or downscale, use rot
             ((transform & HWC_TRANSFORM_ROT_90) || downscale || forceRot)) {
-        *rot = ctx->mRotMgr->getNext();
+        bool secure = (mdpFlags & ovutils::OV_MDP_SECURE_OVERLAY_SESSION);
+        *rot = ctx->mRotMgr->getNext(whf, orient, secure);
         if(*rot == NULL) return -1;
         Whf origWhf(hnd->width, hnd->height,
                     getMdpFormat(hnd->format), hnd->size);
-        if(configRotator(*rot, whf, origWhf,  mdpFlags, orient, downscale) < 0) {
         //Configure rotator for pre-rotation
-            ALOGE("%s: configRotator failed!", __FUNCTION__);
-            return -1;
+        if(configRotator(*rot, whf, origWhf,  mdpFlags, orient, downscale) < 0) {
+            //Rotate on the CPU if the hardware rotator can't
+            *rot = ctx->mRotMgr->getSwFallback(*rot, whf, orient, secure);
+            if(*rot == NULL || configRotator(*rot, whf, origWhf, mdpFlags,
+                    orient, downscale) < 0) {
+                ALOGE("%s: configRotator failed!", __FUNCTION__);
+                return -1;
+            }
         }
         ctx->mLayerRotMap[dpy]->add(layer, *rot);
         whf.format = (*rot)->getDstFormat();
@@ -1713,6 +1764,7 @@ int configureLowRes(hwc_context_t *ctx, hwc_layer_1_t *layer,
     PipeArgs parg(mdpFlags, whf, z, isFg,
                   static_cast<eRotFlags>(rotFlags), layer->planeAlpha,
                   (ovutils::eBlending) getBlending(layer->blending));
+    parg.dsPlan = dsPlan;
 
     if(configMdp(ctx->mOverlay, parg, orient, crop, dst, metadata, dest) < 0) {
         ALOGE("%s: commit failed for low res panel", __FUNCTION__);
@@ -1755,14 +1807,20 @@ int configureHighRes(hwc_context_t *ctx, hwc_layer_1_t *layer,
     trimLayer(ctx, dpy, transform, crop, dst);
 
     if(isYuvBuffer(hnd) && ((transform & HWC_TRANSFORM_ROT_90) || forceRot)) {
-        (*rot) = ctx->mRotMgr->getNext();
+        bool secure = (mdpFlagsL & ovutils::OV_MDP_SECURE_OVERLAY_SESSION);
+        (*rot) = ctx->mRotMgr->getNext(whf, orient, secure);
         if((*rot) == NULL) return -1;
         Whf origWhf(hnd->width, hnd->height,
                     getMdpFormat(hnd->format), hnd->size);
-        if(configRotator(*rot, whf, origWhf, mdpFlagsL, orient, downscale) < 0) {
         //Configure rotator for pre-rotation
-            ALOGE("%s: configRotator failed!", __FUNCTION__);
-            return -1;
+        if(configRotator(*rot, whf, origWhf, mdpFlagsL, orient, downscale) < 0) {
+            //Rotate on the CPU if the hardware rotator can't
+            (*rot) = ctx->mRotMgr->getSwFallback(*rot, whf, orient, secure);
+            if((*rot) == NULL || configRotator(*rot, whf, origWhf, mdpFlagsL,
+                    orient, downscale) < 0) {
+                ALOGE("%s: configRotator failed!", __FUNCTION__);
+                return -1;
+            }
         }
         ctx->mLayerRotMap[dpy]->add(layer, *rot);
         whf.format = (*rot)->getDstFormat();
@@ -1861,7 +1919,9 @@ void LayerRotMap::reset() {
 }
 
 void LayerRotMap::clear() {
-    RotMgr::getInstance()->markUnusedTop(mCount);
+    for(uint32_t i = 0; i < mCount; i++) {
+        RotMgr::getInstance()->markUnused(mRot[i]);
+    }
     reset();
 }
 
@@ -1871,6 +1931,13 @@ void LayerRotMap::setReleaseFd(const int& fence) {
     }
 }
 
+void LayerRotMap::setSwReleaseFd(const int& fence) {
+    for(uint32_t i = 0; i < mCount; i++) {
+        if(mRot[i]->isSoftware())
+            mRot[i]->setReleaseFd(dup(fence));
+    }
+}
+
 int getSocIdFromSystem() {
     FILE *device = NULL;
     int soc_id = 0;
@@ -150,7 +150,7 @@ enum {
 class LayerRotMap {
 public:
     LayerRotMap() { reset(); }
-    enum { MAX_SESS = 3 };
+    enum { MAX_SESS = 5 }; //RotMgr::MAX_ROT_SLOTS
     void add(hwc_layer_1_t* layer, overlay::Rotator *rot);
     //Resets the mapping of layer to rotator
     void reset();
@@ -161,6 +161,8 @@ public:
     hwc_layer_1_t* getLayer(uint32_t index) const;
     overlay::Rotator* getRot(uint32_t index) const;
     void setReleaseFd(const int& fence);
+    //Same, for the software rotators only
+    void setSwReleaseFd(const int& fence);
 private:
     hwc_layer_1_t* mLayer[MAX_SESS];
     overlay::Rotator* mRot[MAX_SESS];
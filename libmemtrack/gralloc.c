@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <hardware/memtrack.h>
+
+#include "memtrack_msm.h"
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+
+static struct memtrack_record gralloc_record_template = {
+    .flags = MEMTRACK_FLAG_SMAPS_UNACCOUNTED |
+             MEMTRACK_FLAG_SHARED |
+             MEMTRACK_FLAG_NONSECURE,
+};
+
+/*
+ * CPU mappings of gralloc buffers in a process. ION and dma-heap buffers
+ * show up as dma-buf files in the maps, memfd backed ones by their name.
+ */
+int gralloc_memtrack_get_memory(pid_t pid, enum memtrack_type type,
+                                struct memtrack_record *records,
+                                size_t *num_records)
+{
+    size_t allocated_records = min(*num_records, 1);
+    FILE *fp;
+    char line[1024];
+    char tmp[128];
+    size_t mapped_size = 0;
+
+    *num_records = 1;
+
+    /* fastpath to return the necessary number of records */
+    if (allocated_records == 0) {
+        return 0;
+    }
+
+    memcpy(records, &gralloc_record_template, sizeof(struct memtrack_record));
+
+    snprintf(tmp, sizeof(tmp), "/proc/%d/maps", pid);
+    fp = fopen(tmp, "r");
+    if (fp == NULL) {
+        return -errno;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long start;
+        unsigned long end;
+
+        if (!strstr(line, "dmabuf") && !strstr(line, "memfd:gralloc")) {
+            continue;
+        }
+        if (sscanf(line, "%lx-%lx", &start, &end) == 2) {
+            mapped_size += end - start;
+        }
+    }
+
+    records[0].size_in_bytes = mapped_size;
+
+    fclose(fp);
+
+    return 0;
+}
@@ -35,6 +35,11 @@ int msm_memtrack_get_memory(const struct memtrack_module *module,
         return kgsl_memtrack_get_memory(pid, type, records, num_records);
     }
 
+    /* CPU mapped gralloc buffers */
+    if (type == MEMTRACK_TYPE_OTHER) {
+        return gralloc_memtrack_get_memory(pid, type, records, num_records);
+    }
+
     return -EINVAL;
 }
 
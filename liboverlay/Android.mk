@@ -9,6 +9,9 @@ LOCAL_C_INCLUDES              := $(common_includes) $(kernel_includes)
 LOCAL_SHARED_LIBRARIES        := $(common_libs) libqdutils libmemalloc libsync
 LOCAL_CFLAGS                  := $(common_flags) -DLOG_TAG=\"qdoverlay\"
 LOCAL_ADDITIONAL_DEPENDENCIES := $(common_deps)
+ifeq ($(TARGET_SWROT_USES_NEON),true)
+    LOCAL_CFLAGS += -DSWROT_USE_NEON
+endif
 LOCAL_SRC_FILES := \
       overlay.cpp \
       overlayUtils.cpp \
@@ -16,6 +19,8 @@ LOCAL_SRC_FILES := \
       overlayRotator.cpp \
       overlayMdpRot.cpp \
       overlayMdssRot.cpp \
+      overlaySwRot.cpp \
+      overlayTrace.cpp \
       pipes/overlayGenPipe.cpp
 
 include $(BUILD_SHARED_LIBRARY)
@@ -63,6 +63,11 @@ bool rotate(int fd, msm_rotator_data_info& rot);
 /* MSMFB_OVERLAY_SET */
 bool setOverlay(int fd, mdp_overlay& ov);
 
+#ifdef MSMFB_OVERLAY_PREPARE
+/* MSMFB_OVERLAY_PREPARE, returns 0 or the errno */
+int validateAndSet(int fd, mdp_overlay_list& list);
+#endif
+
 /* MSM_ROTATOR_IOCTL_FINISH */
 bool endRotator(int fd, int sessionId);
 
@@ -155,6 +160,18 @@ inline bool setOverlay(int fd, mdp_overlay& ov) {
     return true;
 }
 
+#ifdef MSMFB_OVERLAY_PREPARE
+inline int validateAndSet(int fd, mdp_overlay_list& list) {
+    if (ioctl(fd, MSMFB_OVERLAY_PREPARE, &list) < 0) {
+        int err = errno;
+        ALOGE("Failed to call ioctl MSMFB_OVERLAY_PREPARE err=%s",
+                strerror(err));
+        return err;
+    }
+    return 0;
+}
+#endif
+
 inline bool endRotator(int fd, uint32_t sessionId) {
     if (ioctl(fd, MSM_ROTATOR_IOCTL_FINISH, &sessionId) < 0) {
         ALOGE("Failed to call ioctl MSM_ROTATOR_IOCTL_FINISH err=%s",
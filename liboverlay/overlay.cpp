@@ -29,10 +29,13 @@
 
 #include "overlay.h"
 #include "pipes/overlayGenPipe.h"
+#include "overlayMdp.h"
 #include "mdp_version.h"
 #include "qdMetaData.h"
 
 #define PIPE_DEBUG 0
+//Pipe history records shown in dumpsys
+#define DUMP_HISTORY 32
 #define REVERSE_CAMERA_PATH "/sys/class/switch/reverse/state"
 #define UNLIKELY( exp )     (__builtin_expect( (exp) != 0, false ))
 
@@ -45,8 +48,7 @@ Overlay::Overlay() {
     for(int i = 0; i < PipeBook::NUM_PIPES; i++) {
         mPipeBook[i].init();
     }
-
-    mDumpStr[0] = '\0';
+    mBatch = new MdpBatch[DPY_MAX];
 }
 
 Overlay::~Overlay() {
@@ -54,38 +56,37 @@ Overlay::~Overlay() {
         mPipeBook[i].destroy();
     }
     delete[] mPipeBook;
+    delete[] mBatch;
 }
 
 void Overlay::configBegin() {
-    for(int i = 0; i < PipeBook::NUM_PIPES; i++) {
-        //Mark as available for this round.
-        PipeBook::resetUse(i);
-        PipeBook::resetAllocation(i);
+    //Mark as available for this round.
+    PipeBook::resetAll();
+    for(int i = 0; i < DPY_MAX; i++) {
+        mBatch[i].newFrame();
     }
-    mDumpStr[0] = '\0';
+    mTrace.newFrame();
 }
 
 void Overlay::configDone() {
-    const int TMP_STR_BUF_SIZE = 32;
     mWaitForCommitFinish = false;
     if(PipeBook::pipeUsageUnchanged()) return;
 
-    for(int i = 0; i < PipeBook::NUM_PIPES; i++) {
-        if(PipeBook::isNotUsed(i)) {
-            //Forces UNSET on pipes, flushes rotator memory and session, closes
-            //fds
-            if(mPipeBook[i].valid()) {
-                char str[TMP_STR_BUF_SIZE];
-                snprintf(str, TMP_STR_BUF_SIZE, "Unset pipe=%s dpy=%d; ",
-                        PipeBook::getDestStr((eDest)i), mPipeBook[i].mDisplay);
-                strlcat(mDumpStr, str, DUMP_STR_MAX);
-            }
-            mPipeBook[i].destroy();
-            // Need to wait for commit to finish when unset layers.
-            // Otherwise, kernel resources may not released yet for next set.
-            if (!mWaitForCommitFinish) {
-                mWaitForCommitFinish = true;
-            }
+    int notUsed = PipeBook::getNotUsedMask();
+    while(notUsed) {
+        int i = PipeBook::popPipe(notUsed);
+        //Forces UNSET on pipes, flushes rotator memory and session, closes
+        //fds
+        if(mPipeBook[i].valid()) {
+            mTrace.add(OverlayTrace::EV_UNSET, i, mPipeBook[i].mDisplay,
+                    PipeBook::getPipeType((eDest)i));
+        }
+        mPipeBook[i].destroy();
+        PipeBook::setDisplay(i, DPY_UNUSED);
+        // Need to wait for commit to finish when unset layers.
+        // Otherwise, kernel resources may not released yet for next set.
+        if (!mWaitForCommitFinish) {
+            mWaitForCommitFinish = true;
         }
     }
     dump();
@@ -94,47 +95,25 @@ void Overlay::configDone() {
 
 eDest Overlay::nextPipe(eMdpPipeType type, int dpy) {
     eDest dest = OV_INVALID;
-
-    for(int i = 0; i < PipeBook::NUM_PIPES; i++) {
-        //Match requested pipe type
-        if(type == OV_MDP_PIPE_ANY || type == PipeBook::getPipeType((eDest)i)) {
-            //Check if the pipe is used by the requested display
-            //already in previous round.
-            if(mPipeBook[i].mDisplay == dpy &&
-                    PipeBook::isNotAllocated(i)) {
-                dest = (eDest)i;
-                PipeBook::setAllocation(i);
-                break;
-            }
-        }
-    }
-
-    if(dest == OV_INVALID) {
-        for(int i = 0; i < PipeBook::NUM_PIPES; i++) {
-            //Match requested pipe type
-            if(type == OV_MDP_PIPE_ANY || type == PipeBook::getPipeType((eDest)i)) {
-                //Check if the pipe is not allocated to any display
-                if(mPipeBook[i].mDisplay == DPY_UNUSED &&
-                   PipeBook::isNotAllocated(i)) {
-                    dest = (eDest)i;
-                    PipeBook::setAllocation(i);
-                    break;
-                }
-            }
-        }
-    }
-
-    if(dest != OV_INVALID) {
-        int index = (int)dest;
+    int avail = PipeBook::getTypeMask(type) & PipeBook::getNotAllocatedMask();
+    //Prefer a pipe used by the requested display already in previous round,
+    //then one not allocated to any display
+    int mask = avail & PipeBook::getDisplayMask(dpy);
+    if(!mask)
+        mask = avail & PipeBook::getDisplayMask(DPY_UNUSED);
+
+    if(mask) {
+        int index = PipeBook::popPipe(mask);
+        dest = (eDest)index;
+        PipeBook::setAllocation(index);
         //If the pipe is not registered with any display OR if the pipe is
         //requested again by the same display using it, then go ahead.
         mPipeBook[index].mDisplay = dpy;
+        PipeBook::setDisplay(index, dpy);
         if(not mPipeBook[index].valid()) {
             mPipeBook[index].mPipe = new GenericPipe(dpy);
-            char str[32];
-            snprintf(str, 32, "Set pipe=%s dpy=%d; ",
-                     PipeBook::getDestStr(dest), dpy);
-            strlcat(mDumpStr, str, DUMP_STR_MAX);
+            mTrace.add(OverlayTrace::EV_SET, index, dpy,
+                    PipeBook::getPipeType(dest));
         }
     } else {
         ALOGD_IF(PIPE_DEBUG, "Pipe unavailable type=%d display=%d",
@@ -148,9 +127,14 @@ bool Overlay::commit(utils::eDest dest) {
     bool ret = false;
     int index = (int)dest;
     validate(index);
+    int dpy = mPipeBook[index].mDisplay;
+    GenericPipe *pipe = mPipeBook[index].mPipe;
 
-    if(mPipeBook[index].mPipe->commit()) {
+    if(pipe->commit(&mBatch[dpy])) {
         ret = true;
+        mTrace.add(OverlayTrace::EV_COMMIT, index, dpy,
+                PipeBook::getPipeType(dest), pipe->getArgs(),
+                pipe->getCrop(), pipe->getPosition());
         PipeBook::setUse((int)dest);
         /* Since Tertiary display goes to DMA_S, which has no scaling
          * capability, it always use GPU compositin and parameters, such
@@ -161,15 +145,11 @@ bool Overlay::commit(utils::eDest dest) {
         if (mPipeBook[index].mDisplay == DPY_TERTIARY)
             mPipeBook[index].mPipe->forceSet();
     } else {
-        int dpy = mPipeBook[index].mDisplay;
-        for(int i = 0; i < PipeBook::NUM_PIPES; i++)
-            if (mPipeBook[i].mDisplay == dpy) {
-                PipeBook::resetAllocation(i);
-                PipeBook::resetUse(i);
-                if(mPipeBook[i].valid()) {
-                    mPipeBook[i].mPipe->forceSet();
-                }
-            }
+        mTrace.add(OverlayTrace::EV_FAIL, index, dpy,
+                PipeBook::getPipeType(dest), pipe->getArgs(),
+                pipe->getCrop(), pipe->getPosition());
+        mBatch[dpy].abort();
+        clear(dpy);
     }
     return ret;
 }
@@ -181,11 +161,32 @@ bool Overlay::queueBuffer(int fd, uint32_t offset,
     validate(index);
     //Queue only if commit() has succeeded (and the bit set)
     if(PipeBook::isUsed((int)dest)) {
+        mBatch[mPipeBook[index].mDisplay].countPlay();
         ret = mPipeBook[index].mPipe->queueBuffer(fd, offset);
     }
     return ret;
 }
 
+void Overlay::beginBatch(int dpy) {
+    OVASSERT(dpy >= 0 && dpy < DPY_MAX, "Invalid dpy %d", dpy);
+    mBatch[dpy].begin();
+}
+
+bool Overlay::flushBatch(int dpy) {
+    OVASSERT(dpy >= 0 && dpy < DPY_MAX, "Invalid dpy %d", dpy);
+    if(!mBatch[dpy].flush()) {
+        ALOGE("%s: batched commit failed for dpy %d", __FUNCTION__, dpy);
+        clear(dpy);
+        return false;
+    }
+    return true;
+}
+
+void Overlay::abortBatch(int dpy) {
+    OVASSERT(dpy >= 0 && dpy < DPY_MAX, "Invalid dpy %d", dpy);
+    mBatch[dpy].abort();
+}
+
 void Overlay::setCrop(const utils::Dim& d,
         utils::eDest dest) {
     int index = (int)dest;
@@ -289,6 +290,7 @@ int Overlay::initOverlay() {
     for(int X = 0; X < (int)OV_MDP_PIPE_ANY; X++) { //iterate over types
         for(int j = 0; j < numPipesXType[X]; j++) { //iterate over num
             PipeBook::pipeTypeLUT[index] = (utils::eMdpPipeType)X;
+            PipeBook::sTypeBitmap[X] |= (1 << index);
             index++;
         }
     }
@@ -394,8 +396,8 @@ bool Overlay::displayCommit(const int& fd, uint32_t wait_for_finish) {
 }
 
 void Overlay::dump() const {
-    if(strlen(mDumpStr)) { //dump only on state change
-        ALOGD_IF(PIPE_DEBUG, "%s\n", mDumpStr);
+    if(PIPE_DEBUG) { //dump only on state change
+        mTrace.logFrame();
     }
 }
 
@@ -415,17 +417,21 @@ void Overlay::getDump(char *buf, size_t len) {
     char str_pipes[64] = {'\0'};
     snprintf(str_pipes, 64, "Pipes used=%d\n\n", totalPipes);
     strlcat(buf, str_pipes, len);
+    for(int i = 0; i < DPY_MAX; i++) {
+        mBatch[i].getDump(buf, len, i);
+    }
+    mTrace.getDump(buf, len, DUMP_HISTORY);
 }
 
 void Overlay::clear(int dpy) {
-    for(int i = 0; i < PipeBook::NUM_PIPES; i++) {
-        if (mPipeBook[i].mDisplay == dpy) {
-            // Mark as available for this round
-            PipeBook::resetUse(i);
-            PipeBook::resetAllocation(i);
-            if(mPipeBook[i].valid()) {
-                mPipeBook[i].mPipe->forceSet();
-            }
+    int mask = PipeBook::getDisplayMask(dpy);
+    while(mask) {
+        int i = PipeBook::popPipe(mask);
+        // Mark as available for this round
+        PipeBook::resetUse(i);
+        PipeBook::resetAllocation(i);
+        if(mPipeBook[i].valid()) {
+            mPipeBook[i].mPipe->forceSet();
         }
     }
 }
@@ -451,6 +457,9 @@ int Overlay::PipeBook::NUM_PIPES = 0;
 int Overlay::PipeBook::sPipeUsageBitmap = 0;
 int Overlay::PipeBook::sLastUsageBitmap = 0;
 int Overlay::PipeBook::sAllocatedBitmap = 0;
+int Overlay::PipeBook::sDpyBitmap[DPY_MAX] = {0};
+int Overlay::PipeBook::sAssignedBitmap = 0;
+int Overlay::PipeBook::sTypeBitmap[utils::OV_MDP_PIPE_ANY] = {0};
 utils::eMdpPipeType Overlay::PipeBook::pipeTypeLUT[utils::OV_MAX] =
     {utils::OV_MDP_PIPE_ANY};
 
@@ -31,14 +31,14 @@
 #define OVERLAY_H
 
 #include "overlayUtils.h"
+#include "overlayTrace.h"
 #include "utils/threads.h"
 
-#define DUMP_STR_MAX 256
-
 struct MetaData_t;
 
 namespace overlay {
 class GenericPipe;
+class MdpBatch;
 
 class Overlay : utils::NoCopy {
 public:
@@ -79,6 +79,14 @@ public:
     bool commit(utils::eDest dest);
     bool queueBuffer(int fd, uint32_t offset, utils::eDest dest);
 
+    /* Commits of the display's pipes after beginBatch are sent to the driver
+     * together by flushBatch. A failed flush resets the display's pipes like
+     * a failed commit. abortBatch drops the pending commits.
+     */
+    void beginBatch(int dpy);
+    bool flushBatch(int dpy);
+    void abortBatch(int dpy);
+
     /* Closes open pipes, called during startup */
     static int initOverlay();
 
@@ -87,6 +95,8 @@ public:
     static Overlay* getInstance();
     /* Returns available ("unallocated") pipes for a display */
     int availablePipes(int dpy);
+    /* Returns available pipes of a type for a display */
+    int availablePipes(int dpy, utils::eMdpPipeType type);
     /* Returns pipe dump. Expects a NULL terminated buffer of big enough size
      * to populate.
      */
@@ -129,12 +139,28 @@ private:
         static void resetAllocation(int index);
         static bool isAllocated(int index);
         static bool isNotAllocated(int index);
+        /* Clears the usage and allocation of all pipes */
+        static void resetAll();
+
+        /* Moves the pipe to dpy, DPY_UNUSED frees it */
+        static void setDisplay(int index, int dpy);
+        /* Pipes of the display, DPY_UNUSED for the free ones */
+        static int getDisplayMask(int dpy);
+        /* Pipes of the type, OV_MDP_PIPE_ANY for all */
+        static int getTypeMask(utils::eMdpPipeType type);
+        /* Unused pipes which still have a pipe object or display */
+        static int getNotUsedMask();
+        static int getNotAllocatedMask();
+        /* Returns the lowest pipe in mask and clears it, mask must be set */
+        static int popPipe(int& mask);
 
         static utils::eMdpPipeType getPipeType(utils::eDest dest);
         static const char* getDestStr(utils::eDest dest);
 
         static int NUM_PIPES;
         static utils::eMdpPipeType pipeTypeLUT[utils::OV_MAX];
+        //Pipes of each type, filled along with the LUT
+        static int sTypeBitmap[utils::OV_MDP_PIPE_ANY];
 
 
     private:
@@ -149,12 +175,17 @@ private:
         //3 pipe objects in one shot and proceed with config only if it gets all
         //3. The bitmap helps allocate different pipe objects on each request.
         static int sAllocatedBitmap;
+        //Pipes assigned to each display, and to any display
+        static int sDpyBitmap[DPY_MAX];
+        static int sAssignedBitmap;
     };
 
     PipeBook *mPipeBook;
+    /* Per display batch of pipe commits */
+    MdpBatch *mBatch;
 
-    /* Dump string */
-    char mDumpStr[DUMP_STR_MAX];
+    /* Pipe state history */
+    OverlayTrace mTrace;
 
     /* Singleton Instance*/
     static Overlay *sInstance;
@@ -171,14 +202,14 @@ inline void Overlay::validate(int index) {
 }
 
 inline int Overlay::availablePipes(int dpy) {
-     int avail = 0;
-     for(int i = 0; i < PipeBook::NUM_PIPES; i++) {
-       if((mPipeBook[i].mDisplay == DPY_UNUSED ||
-           mPipeBook[i].mDisplay == dpy) && PipeBook::isNotAllocated(i)) {
-                avail++;
-        }
-    }
-    return avail;
+    return __builtin_popcount((PipeBook::getDisplayMask(DPY_UNUSED) |
+            PipeBook::getDisplayMask(dpy)) & PipeBook::getNotAllocatedMask());
+}
+
+inline int Overlay::availablePipes(int dpy, utils::eMdpPipeType type) {
+    return __builtin_popcount((PipeBook::getDisplayMask(DPY_UNUSED) |
+            PipeBook::getDisplayMask(dpy)) & PipeBook::getNotAllocatedMask() &
+            PipeBook::getTypeMask(type));
 }
 
 inline int Overlay::getFbForDpy(const int& dpy) {
@@ -230,6 +261,47 @@ inline bool Overlay::PipeBook::isNotAllocated(int index) {
     return !isAllocated(index);
 }
 
+inline void Overlay::PipeBook::resetAll() {
+    sPipeUsageBitmap = 0;
+    sAllocatedBitmap = 0;
+}
+
+inline void Overlay::PipeBook::setDisplay(int index, int dpy) {
+    for(int i = 0; i < DPY_MAX; i++)
+        sDpyBitmap[i] &= ~(1 << index);
+    sAssignedBitmap &= ~(1 << index);
+    if(dpy >= 0 && dpy < DPY_MAX) {
+        sDpyBitmap[dpy] |= (1 << index);
+        sAssignedBitmap |= (1 << index);
+    }
+}
+
+inline int Overlay::PipeBook::getDisplayMask(int dpy) {
+    if(dpy >= 0 && dpy < DPY_MAX)
+        return sDpyBitmap[dpy];
+    return getTypeMask(utils::OV_MDP_PIPE_ANY) & ~sAssignedBitmap;
+}
+
+inline int Overlay::PipeBook::getTypeMask(utils::eMdpPipeType type) {
+    if(type >= 0 && type < utils::OV_MDP_PIPE_ANY)
+        return sTypeBitmap[type];
+    return (1 << NUM_PIPES) - 1;
+}
+
+inline int Overlay::PipeBook::getNotUsedMask() {
+    return getTypeMask(utils::OV_MDP_PIPE_ANY) & ~sPipeUsageBitmap;
+}
+
+inline int Overlay::PipeBook::getNotAllocatedMask() {
+    return getTypeMask(utils::OV_MDP_PIPE_ANY) & ~sAllocatedBitmap;
+}
+
+inline int Overlay::PipeBook::popPipe(int& mask) {
+    int index = __builtin_ctz(mask);
+    mask &= mask - 1;
+    return index;
+}
+
 inline utils::eMdpPipeType Overlay::PipeBook::getPipeType(utils::eDest dest) {
     return pipeTypeLUT[(int)dest];
 }
@@ -68,7 +68,7 @@ public:
     /* set mdp visual params using metadata */
     bool setVisualParams(const MetaData_t &metadata);
     /* mdp set overlay/commit changes */
-    bool commit();
+    bool commit(MdpBatch *batch = NULL);
 
     /* ctrl id */
     int  getPipeId() const;
@@ -189,8 +189,8 @@ inline void Ctrl::dump() const {
     ALOGE("== Dump Ctrl end ==");
 }
 
-inline bool Ctrl::commit() {
-    if(!mMdp.set()) {
+inline bool Ctrl::commit(MdpBatch *batch) {
+    if(!mMdp.set(batch)) {
         ALOGE("Ctrl commit failed set overlay");
         return false;
     }
@@ -43,6 +43,59 @@ static void normalizeCrop(uint32_t& xy, uint32_t& wh) {
     }
 }
 
+#ifdef USES_POST_PROCESSING
+//Each ctrl holds at most its current and last known good lut
+#define MAX_IGC_LUTS (2 * utils::OV_MAX)
+
+struct IgcLut {
+    uint32_t hash;
+    int refs;
+    uint32_t *data;
+};
+
+static IgcLut sIgcLuts[MAX_IGC_LUTS];
+
+uint32_t* acquireIgcLut(uint32_t hash) {
+    int freeSlot = -1;
+    for(int i = 0; i < MAX_IGC_LUTS; i++) {
+        if(sIgcLuts[i].refs && sIgcLuts[i].hash == hash) {
+            sIgcLuts[i].refs++;
+            return sIgcLuts[i].data;
+        }
+        if(!sIgcLuts[i].refs && freeSlot < 0)
+            freeSlot = i;
+    }
+    if(freeSlot < 0) {
+        ALOGE("%s: no free IGC lut", __FUNCTION__);
+        return NULL;
+    }
+    uint32_t *data =
+            (uint32_t *)malloc(2 * MAX_IGC_LUT_ENTRIES * sizeof(uint32_t));
+    if(!data) {
+        ALOGE("IGC storage allocated failed");
+        return NULL;
+    }
+    sIgcLuts[freeSlot].hash = hash;
+    sIgcLuts[freeSlot].refs = 1;
+    sIgcLuts[freeSlot].data = data;
+    return data;
+}
+
+void releaseIgcLut(uint32_t *lut) {
+    if(!lut)
+        return;
+    for(int i = 0; i < MAX_IGC_LUTS; i++) {
+        if(sIgcLuts[i].refs && sIgcLuts[i].data == lut) {
+            if(--sIgcLuts[i].refs == 0) {
+                free(sIgcLuts[i].data);
+                sIgcLuts[i].data = NULL;
+            }
+            return;
+        }
+    }
+}
+#endif
+
 bool MdpCtrl::init(uint32_t fbnum) {
     // FD init
     if(!utils::openDev(mFd, fbnum,
@@ -63,6 +116,7 @@ void MdpCtrl::reset() {
     mForceSet = false;
 #ifdef USES_POST_PROCESSING
     mPPChanged = false;
+    mIgcHash = 0;
     memset(&mParams, 0, sizeof(struct compute_params));
     mParams.params.conv_params.order = hsic_order_hsc_i;
     mParams.params.conv_params.interface = interface_rec601;
@@ -82,8 +136,7 @@ bool MdpCtrl::close() {
     }
 #ifdef USES_POST_PROCESSING
     /* free allocated memory in PP */
-    if (mOVInfo.overlay_pp_cfg.igc_cfg.c0_c1_data)
-            free(mOVInfo.overlay_pp_cfg.igc_cfg.c0_c1_data);
+    releaseIgcLuts();
 #endif
     reset();
 
@@ -140,7 +193,7 @@ void MdpCtrl::doDownscale() {
     mOVInfo.src_rect.h >>= mDownscale;
 }
 
-bool MdpCtrl::set() {
+bool MdpCtrl::set(MdpBatch *batch) {
     //deferred calcs, so APIs could be called in any order.
     doTransform();
     doDownscale();
@@ -154,20 +207,29 @@ bool MdpCtrl::set() {
 
     if(this->ovChanged() || mForceSet) {
         mForceSet = false;
-        if(!mdp_wrapper::setOverlay(mFd.getArbFD(), mOVInfo)) {
-            ALOGE("MdpCtrl failed to setOverlay, restoring last known "
-                  "good ov info");
-            mdp_wrapper::dump("== Bad OVInfo is: ", mOVInfo);
-            mdp_wrapper::dump("== Last good known OVInfo is: ", mLkgo);
-            this->restore();
-            return false;
-        }
-        this->save();
+        if(batch && batch->add(this))
+            return true;
+        if(batch)
+            batch->countSet();
+        return apply();
     }
 
     return true;
 }
 
+bool MdpCtrl::apply() {
+    if(!mdp_wrapper::setOverlay(mFd.getArbFD(), mOVInfo)) {
+        ALOGE("MdpCtrl failed to setOverlay, restoring last known "
+              "good ov info");
+        mdp_wrapper::dump("== Bad OVInfo is: ", mOVInfo);
+        mdp_wrapper::dump("== Last good known OVInfo is: ", mLkgo);
+        this->restore();
+        return false;
+    }
+    this->save();
+    return true;
+}
+
 bool MdpCtrl::get() {
     mdp_overlay ov;
     ov.id = mOVInfo.id;
@@ -197,6 +259,107 @@ void MdpCtrl::getDump(char *buf, size_t len) {
     ovutils::getDump(buf, len, "Ctrl(mdp_overlay)", mOVInfo);
 }
 
+//============MdpBatch=========================
+
+bool MdpBatch::sSupported = false;
+bool MdpBatch::sProbed = false;
+
+MdpBatch::MdpBatch() : mCount(0), mOpen(false), mSets(0), mPrepares(0),
+        mPlays(0), mLastSets(0), mLastPrepares(0), mLastPlays(0) {
+#ifdef MSMFB_OVERLAY_PREPARE
+    //Only MDSS validates lists, MDP4 drivers reject them with EINVAL.
+    //Decided once, a later ENOTTY still turns batching off for good.
+    if(!sProbed) {
+        sSupported = qdutils::MDPVersion::getInstance().getMDPVersion() >=
+                qdutils::MDSS_V5;
+        sProbed = true;
+    }
+#endif
+}
+
+void MdpBatch::newFrame() {
+    mLastSets = mSets;
+    mLastPrepares = mPrepares;
+    mLastPlays = mPlays;
+    mSets = mPrepares = mPlays = 0;
+}
+
+void MdpBatch::begin() {
+    if(mCount)
+        abort();
+    mOpen = true;
+}
+
+bool MdpBatch::add(MdpCtrl *ctrl) {
+    if(!mOpen || !sSupported || mCount >= MAX_SETS)
+        return false;
+    mCtrls[mCount++] = ctrl;
+    return true;
+}
+
+bool MdpBatch::flush() {
+    bool ret = true;
+    mOpen = false;
+    if(!mCount)
+        return true;
+
+#ifdef MSMFB_OVERLAY_PREPARE
+    if(sSupported) {
+        mdp_overlay *list[MAX_SETS];
+        for(uint32_t i = 0; i < mCount; i++)
+            list[i] = &mCtrls[i]->mOVInfo;
+        mdp_overlay_list ovList;
+        memset(&ovList, 0, sizeof(ovList));
+        ovList.num_overlays = mCount;
+        ovList.overlay_list = list;
+        mPrepares++;
+        int err = mdp_wrapper::validateAndSet(mCtrls[0]->mFd.getArbFD(),
+                ovList);
+        if(err == ENOTTY) {
+            //Old driver, set them one by one from now on
+            sSupported = false;
+        } else {
+            //The driver stops at the first config it rejects
+            uint32_t done = err ? ovList.processed_overlays : mCount;
+            for(uint32_t i = 0; i < mCount; i++) {
+                if(i < done) {
+                    mCtrls[i]->save();
+                } else {
+                    mdp_wrapper::dump("== Bad OVInfo is: ",
+                            mCtrls[i]->mOVInfo);
+                    mCtrls[i]->restore();
+                }
+            }
+            mCount = 0;
+            return err == 0;
+        }
+    }
+#endif
+
+    for(uint32_t i = 0; i < mCount; i++) {
+        mSets++;
+        if(!mCtrls[i]->apply())
+            ret = false;
+    }
+    mCount = 0;
+    return ret;
+}
+
+void MdpBatch::abort() {
+    for(uint32_t i = 0; i < mCount; i++)
+        mCtrls[i]->restore();
+    mCount = 0;
+    mOpen = false;
+}
+
+void MdpBatch::getDump(char *buf, size_t len, int dpy) const {
+    char str[128] = {'\0'};
+    snprintf(str, 128, "dpy=%d last frame ioctls: set=%d prepare=%d "
+            "play=%d batched=%d\n", dpy, mLastSets, mLastPrepares,
+            mLastPlays, sSupported);
+    strlcat(buf, str, len);
+}
+
 void MdpData::dump() const {
     ALOGE("== Dump MdpData start ==");
     mFd.dump();
@@ -291,29 +454,29 @@ bool MdpCtrl::setVisualParams(const MetaData_t& data) {
     }
 
     if (data.operation & PP_PARAM_IGC) {
-        if (mOVInfo.overlay_pp_cfg.igc_cfg.c0_c1_data == NULL){
-            uint32_t *igcData
-                = (uint32_t *)malloc(2 * MAX_IGC_LUT_ENTRIES * sizeof(uint32_t));
+        //Older metadata writers leave the hash 0
+        uint32_t hash = data.igcHash ? data.igcHash :
+                getIgcHash(&data.igcData);
+        if (hash != mIgcHash) {
+            uint32_t *igcData = acquireIgcLut(hash);
             if (!igcData) {
-                ALOGE("IGC storage allocated failed");
                 return false;
             }
-            mOVInfo.overlay_pp_cfg.igc_cfg.c0_c1_data = igcData;
-            mOVInfo.overlay_pp_cfg.igc_cfg.c2_data
-                = igcData + MAX_IGC_LUT_ENTRIES;
+            setIgcLut(igcData);
+
+            memcpy(mParams.params.igc_lut_params.c0,
+                data.igcData.c0, sizeof(uint16_t) * MAX_IGC_LUT_ENTRIES);
+            memcpy(mParams.params.igc_lut_params.c1,
+                data.igcData.c1, sizeof(uint16_t) * MAX_IGC_LUT_ENTRIES);
+            memcpy(mParams.params.igc_lut_params.c2,
+                data.igcData.c2, sizeof(uint16_t) * MAX_IGC_LUT_ENTRIES);
+
+            mParams.params.igc_lut_params.ops
+                = MDP_PP_OPS_WRITE | MDP_PP_OPS_ENABLE;
+            mParams.operation |= PP_OP_IGC;
+            mIgcHash = hash;
+            needUpdate = true;
         }
-
-        memcpy(mParams.params.igc_lut_params.c0,
-            data.igcData.c0, sizeof(uint16_t) * MAX_IGC_LUT_ENTRIES);
-        memcpy(mParams.params.igc_lut_params.c1,
-            data.igcData.c1, sizeof(uint16_t) * MAX_IGC_LUT_ENTRIES);
-        memcpy(mParams.params.igc_lut_params.c2,
-            data.igcData.c2, sizeof(uint16_t) * MAX_IGC_LUT_ENTRIES);
-
-        mParams.params.igc_lut_params.ops
-            = MDP_PP_OPS_WRITE | MDP_PP_OPS_ENABLE;
-        mParams.operation |= PP_OP_IGC;
-        needUpdate = true;
     }
 
     if (data.operation & PP_PARAM_VID_INTFC) {
@@ -330,4 +493,29 @@ bool MdpCtrl::setVisualParams(const MetaData_t& data) {
     return true;
 }
 
+#ifdef USES_POST_PROCESSING
+void MdpCtrl::setIgcLut(uint32_t *lut) {
+    uint32_t *old = mOVInfo.overlay_pp_cfg.igc_cfg.c0_c1_data;
+    uint32_t *lkgo = mLkgo.overlay_pp_cfg.igc_cfg.c0_c1_data;
+    //The current and last good config share one reference, drop the one
+    //just taken if either already holds this lut
+    if(lut == old || lut == lkgo)
+        releaseIgcLut(lut);
+    if(lut == old)
+        return;
+    if(old != lkgo)
+        releaseIgcLut(old);
+    mOVInfo.overlay_pp_cfg.igc_cfg.c0_c1_data = lut;
+    mOVInfo.overlay_pp_cfg.igc_cfg.c2_data = lut + MAX_IGC_LUT_ENTRIES;
+}
+
+void MdpCtrl::releaseIgcLuts() {
+    uint32_t *cur = mOVInfo.overlay_pp_cfg.igc_cfg.c0_c1_data;
+    uint32_t *lkgo = mLkgo.overlay_pp_cfg.igc_cfg.c0_c1_data;
+    releaseIgcLut(cur);
+    if(lkgo != cur)
+        releaseIgcLut(lkgo);
+}
+#endif
+
 } // overlay
@@ -29,6 +29,14 @@
 
 namespace overlay{
 
+class MdpBatch;
+
+#ifdef USES_POST_PROCESSING
+/* Computed IGC luts, shared by the pipes having the same input lut */
+uint32_t* acquireIgcLut(uint32_t hash);
+void releaseIgcLut(uint32_t *lut);
+#endif
+
 /*
 * Mdp Ctrl holds corresponding fd and MDP related struct.
 * It is simple wrapper to MDP services
@@ -48,8 +56,9 @@ public:
     /* calls overlay set
      * Set would always consult last good known ov instance.
      * Only if it is different, set would actually exectue ioctl.
-     * On a sucess ioctl. last good known ov instance is updated */
-    bool set();
+     * On a sucess ioctl. last good known ov instance is updated
+     * With an open batch the ioctl is left to the batch flush */
+    bool set(MdpBatch *batch = NULL);
     /* Sets the source total width, height, format */
     void setSource(const utils::PipeArgs& pargs);
     /*
@@ -122,6 +131,8 @@ private:
     void save();
     /* restore last known good ov to be the current */
     void restore();
+    /* ioctl the current ov, restoring last known good on failure */
+    bool apply();
 
     utils::eTransform mOrientation; //Holds requested orientation
     /* last good known ov info */
@@ -138,7 +149,51 @@ private:
     struct compute_params mParams;
     /* indicate if PP params have been changed */
     bool mPPChanged;
+    /* hash of the IGC LUT in mParams, 0 if none */
+    uint32_t mIgcHash;
+    /* point the current ov at lut, dropping its previous one */
+    void setIgcLut(uint32_t *lut);
+    /* drop the luts of the current and last known good ov */
+    void releaseIgcLuts();
 #endif
+    friend class MdpBatch;
+};
+
+/*
+* Batch of the MdpCtrl sets of a display for one frame. Where the driver
+* has MSMFB_OVERLAY_PREPARE they are validated and applied in one ioctl at
+* flush, otherwise each is set on its own right away. Also counts the
+* overlay ioctls of the display per frame.
+* */
+class MdpBatch {
+public:
+    enum { MAX_SETS = utils::OV_MAX };
+    explicit MdpBatch();
+    /* Keeps the counts of the frame as the last frame ones */
+    void newFrame();
+    /* Starts batching sets */
+    void begin();
+    /* Takes a set to send at flush, false if it must be set right away */
+    bool add(MdpCtrl *ctrl);
+    /* Sends the batched sets. Sets that fail go back to their last known
+     * good config */
+    bool flush();
+    /* Drops the batched sets, going back to the last known good configs */
+    void abort();
+    bool isOpen() const { return mOpen; }
+    void countSet() { mSets++; }
+    void countPlay() { mPlays++; }
+    void getDump(char *buf, size_t len, int dpy) const;
+private:
+    MdpCtrl *mCtrls[MAX_SETS];
+    uint32_t mCount;
+    bool mOpen;
+    //ioctls of this frame and of the last one
+    uint32_t mSets, mPrepares, mPlays;
+    uint32_t mLastSets, mLastPrepares, mLastPlays;
+    //Set for MDSS, cleared if the driver lacks MSMFB_OVERLAY_PREPARE
+    static bool sSupported;
+    static bool sProbed;
 };
 
 
@@ -286,6 +341,13 @@ inline void MdpCtrl::save() {
         ALOGE("MdpCtrl current ov has id -1, will not save");
         return;
     }
+#ifdef USES_POST_PROCESSING
+    //The driver has the PP config now, lkgo lut is not needed anymore
+    uint32_t *lkgoLut = mLkgo.overlay_pp_cfg.igc_cfg.c0_c1_data;
+    if(lkgoLut != mOVInfo.overlay_pp_cfg.igc_cfg.c0_c1_data)
+        releaseIgcLut(lkgoLut);
+    mPPChanged = false;
+#endif
     mLkgo = mOVInfo;
 }
 
@@ -294,6 +356,14 @@ inline void MdpCtrl::restore() {
         ALOGE("MdpCtrl Lkgo ov has id -1, will not restore");
         return;
     }
+#ifdef USES_POST_PROCESSING
+    //Rejected lut goes away, have it recomputed with the next metadata
+    uint32_t *curLut = mOVInfo.overlay_pp_cfg.igc_cfg.c0_c1_data;
+    if(curLut != mLkgo.overlay_pp_cfg.igc_cfg.c0_c1_data) {
+        releaseIgcLut(curLut);
+        mIgcHash = 0;
+    }
+#endif
     mOVInfo = mLkgo;
 }
 
@@ -204,9 +204,10 @@ bool MdpRot::close() {
 }
 
 bool MdpRot::remap(uint32_t numbufs) {
-    // if current size changed, remap
+    // if current size or the buffer count changed, remap
     uint32_t opBufSize = calcOutputBufSize();
-    if(opBufSize == mMem.curr().size()) {
+    if(opBufSize == mMem.curr().size() &&
+            numbufs == mMem.curr().m.numBufs()) {
         ALOGE_IF(DEBUG_OVERLAY, "%s: same size %d", __FUNCTION__, opBufSize);
         return true;
     }
@@ -216,6 +217,8 @@ bool MdpRot::remap(uint32_t numbufs) {
 
     // ++mMem will make curr to be prev, and prev will be curr
     ++mMem;
+    mMem.curr().closeFences();
+    mMem.curr().mCurrOffset = 0;
     if(!open_i(numbufs, opBufSize)) {
         ALOGE("%s Error could not open", __FUNCTION__);
         return false;
@@ -242,13 +245,10 @@ bool MdpRot::queueBuffer(int fd, uint32_t offset) {
         mRotDataInfo.src.memory_id = fd;
         mRotDataInfo.src.offset = offset;
 
-        remap(RotMem::Mem::ROT_NUM_BUFS);
+        remap(mMem.mNumBufs);
         OVASSERT(mMem.curr().m.numBufs(),
                 "queueBuffer numbufs is 0");
-        mRotDataInfo.dst.offset =
-                mMem.curr().mRotOffset[mMem.curr().mCurrOffset];
-        mMem.curr().mCurrOffset =
-                (mMem.curr().mCurrOffset + 1) % mMem.curr().m.numBufs();
+        mRotDataInfo.dst.offset = mMem.nextOffset();
 
         if(!overlay::mdp_wrapper::rotate(mFd.getFD(), mRotDataInfo)) {
             ALOGE("MdpRot failed rotate");
@@ -132,13 +132,10 @@ bool MdssRot::queueBuffer(int fd, uint32_t offset) {
         mRotData.data.memory_id = fd;
         mRotData.data.offset = offset;
 
-        remap(RotMem::Mem::ROT_NUM_BUFS);
+        remap(mMem.mNumBufs);
         OVASSERT(mMem.curr().m.numBufs(), "queueBuffer numbufs is 0");
 
-        mRotData.dst_data.offset =
-                mMem.curr().mRotOffset[mMem.curr().mCurrOffset];
-        mMem.curr().mCurrOffset =
-                (mMem.curr().mCurrOffset + 1) % mMem.curr().m.numBufs();
+        mRotData.dst_data.offset = mMem.nextOffset();
 
         if(!overlay::mdp_wrapper::play(mFd.getArbFD(), mRotData)) {
             ALOGE("MdssRot play failed!");
@@ -184,8 +181,9 @@ bool MdssRot::open_i(uint32_t numbufs, uint32_t bufsz)
 bool MdssRot::remap(uint32_t numbufs) {
     // Calculate the size based on rotator's dst format, w and h.
     uint32_t opBufSize = calcOutputBufSize();
-    // If current size changed, remap
-    if(opBufSize == mMem.curr().size()) {
+    // If current size or the buffer count changed, remap
+    if(opBufSize == mMem.curr().size() &&
+            numbufs == mMem.curr().m.numBufs()) {
         ALOGE_IF(DEBUG_OVERLAY, "%s: same size %d", __FUNCTION__, opBufSize);
         return true;
     }
@@ -195,6 +193,8 @@ bool MdssRot::remap(uint32_t numbufs) {
 
     // ++mMem will make curr to be prev, and prev will be curr
     ++mMem;
+    mMem.curr().closeFences();
+    mMem.curr().mCurrOffset = 0;
     if(!open_i(numbufs, opBufSize)) {
         ALOGE("%s Error could not open", __FUNCTION__);
         return false;
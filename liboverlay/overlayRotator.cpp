@@ -17,6 +17,7 @@
  * limitations under the License.
 */
 
+#include <cutils/properties.h>
 #include "overlayRotator.h"
 #include "overlayUtils.h"
 #include "mdp_version.h"
@@ -51,6 +52,23 @@ uint32_t Rotator::calcOutputBufSize(const utils::Whf& destWhf) {
             destWhf.w, destWhf.h, halFormat, alW, alH);
 }
 
+void Rotator::setBufferDepth(uint32_t numBufs) {
+    if(numBufs < RotMem::Mem::ROT_MIN_BUFS)
+        numBufs = RotMem::Mem::ROT_MIN_BUFS;
+    if(numBufs > RotMem::Mem::ROT_MAX_BUFS)
+        numBufs = RotMem::Mem::ROT_MAX_BUFS;
+    mMem.mNumBufs = numBufs;
+}
+
+void Rotator::getStatsDump(char *buf, size_t len) const {
+    char str[128] = {'\0'};
+    snprintf(str, 128, "RotBufs: depth=%d stalls=%d stall_us=%lld "
+            "max_stall_us=%lld\n", mMem.mNumBufs, mMem.mStalls,
+            (long long)ns2us(mMem.mStallTime),
+            (long long)ns2us(mMem.mMaxStall));
+    strlcat(buf, str, len);
+}
+
 int Rotator::getRotatorHwType() {
     int mdpVersion = qdutils::MDPVersion::getInstance().getMDPVersion();
     if (mdpVersion == qdutils::MDSS_V5)
@@ -75,36 +93,86 @@ bool RotMem::close() {
     return ret;
 }
 
-RotMem::Mem::Mem() : mCurrOffset(0) {
+RotMem::Mem::Mem() : mQueueSeq(0), mCurrOffset(0) {
     utils::memset0(mRotOffset);
-    for(int i = 0; i < ROT_NUM_BUFS; i++) {
+    for(int i = 0; i < ROT_MAX_BUFS; i++) {
         mRelFence[i] = -1;
+        mQueued[i] = 0;
     }
 }
 
 RotMem::Mem::~Mem() {
-    for(int i = 0; i < ROT_NUM_BUFS; i++) {
-        ::close(mRelFence[i]);
+    closeFences();
+}
+
+void RotMem::Mem::closeFences() {
+    for(int i = 0; i < ROT_MAX_BUFS; i++) {
+        if(mRelFence[i] >= 0)
+            ::close(mRelFence[i]);
         mRelFence[i] = -1;
     }
 }
 
-void RotMem::Mem::setReleaseFd(const int& fence) {
-    int ret = 0;
-
-    if(mRelFence[mCurrOffset] >= 0) {
-        //Wait for previous usage of this buffer to be over.
-        //Can happen if rotation takes > vsync and a fast producer. i.e queue
-        //happens in subsequent vsyncs either because content is 60fps or
-        //because the producer is hasty sometimes.
-        ret = sync_wait(mRelFence[mCurrOffset], 1000);
-        if(ret < 0) {
+uint32_t RotMem::Mem::nextSlot(nsecs_t& stall) {
+    uint32_t numBufs = m.numBufs();
+    uint32_t start = (mCurrOffset + 1) % numBufs;
+    uint32_t slot = start;
+    bool found = false;
+    stall = 0;
+
+    //Take the first slot whose last frame is off the screen already,
+    //polling the fences doesn't block.
+    for(uint32_t i = 0; i < numBufs; i++) {
+        uint32_t s = (start + i) % numBufs;
+        if(mRelFence[s] < 0 || sync_wait(mRelFence[s], 0) == 0) {
+            slot = s;
+            found = true;
+            break;
+        }
+    }
+
+    if(!found) {
+        //Every slot is still in use. Can happen if rotation takes > vsync
+        //and a fast producer, wait for the least recently queued one, it
+        //is released first.
+        for(uint32_t s = 0; s < numBufs; s++) {
+            if((int32_t)(mQueued[s] - mQueued[slot]) < 0)
+                slot = s;
+        }
+        nsecs_t waitStart = systemTime();
+        if(sync_wait(mRelFence[slot], 1000) < 0) {
             ALOGE("%s: sync_wait error!! error no = %d err str = %s",
                 __FUNCTION__, errno, strerror(errno));
         }
-        ::close(mRelFence[mCurrOffset]);
+        stall = systemTime() - waitStart;
     }
+
+    if(mRelFence[slot] >= 0) {
+        ::close(mRelFence[slot]);
+        mRelFence[slot] = -1;
+    }
+    mCurrOffset = slot;
+    return mRotOffset[slot];
+}
+
+void RotMem::Mem::setReleaseFd(const int& fence) {
+    //The slot of the last rotation is free once this frame is replaced
+    if(mRelFence[mCurrOffset] >= 0)
+        ::close(mRelFence[mCurrOffset]);
     mRelFence[mCurrOffset] = fence;
+    mQueued[mCurrOffset] = ++mQueueSeq;
+}
+
+uint32_t RotMem::nextOffset() {
+    nsecs_t stall = 0;
+    uint32_t offset = curr().nextSlot(stall);
+    if(stall) {
+        mStalls++;
+        mStallTime += stall;
+        if(stall > mMaxStall)
+            mMaxStall = stall;
+    }
+    return offset;
 }
 
 //============RotMgr=========================
@@ -118,11 +186,33 @@ RotMgr* RotMgr::getInstance() {
 }
 
 RotMgr::RotMgr() {
-    for(int i = 0; i < MAX_ROT_SESS; i++) {
+    for(int i = 0; i < MAX_ROT_SLOTS; i++) {
         mRot[i] = 0;
+        mSess[i].inUse = false;
     }
     mUseCount = 0;
     mRotDevFd = -1;
+    mBufDepth = RotMem::Mem::ROT_MIN_BUFS;
+    mKeepFrames = 8;
+    mKeepTime = ms2ns(500);
+    mFrame = 0;
+    mCreated = mDestroyed = mReused = 0;
+    mStatsStart = systemTime();
+    char property[PROPERTY_VALUE_MAX];
+    if(property_get("debug.hwc.rotator.bufs", property, NULL) > 0) {
+        mBufDepth = atoi(property);
+    }
+    //CPU rotation when the hardware rotator is busy or can't take a source
+    mSwEnabled = false;
+    if(property_get("debug.hwc.rotator.sw", property, NULL) > 0) {
+        mSwEnabled = (atoi(property) == 1);
+    }
+    if(property_get("debug.hwc.rotator.keep_frames", property, NULL) > 0) {
+        mKeepFrames = atoi(property);
+    }
+    if(property_get("debug.hwc.rotator.keep_ms", property, NULL) > 0) {
+        mKeepTime = ms2ns(atoi(property));
+    }
 }
 
 RotMgr::~RotMgr() {
@@ -132,37 +222,144 @@ RotMgr::~RotMgr() {
 void RotMgr::configBegin() {
     //Reset the number of objects used
     mUseCount = 0;
+    mFrame++;
+    for(int i = 0; i < MAX_ROT_SLOTS; i++) {
+        mSess[i].inUse = false;
+    }
 }
 
 void RotMgr::configDone() {
-    //Remove the top most unused objects. Videos come and go.
-    for(int i = mUseCount; i < MAX_ROT_SESS; i++) {
-        if(mRot[i]) {
-            delete mRot[i];
-            mRot[i] = 0;
+    //Videos come and go. Sessions unused this frame are kept for a while,
+    //a rotated layer often drops out for a frame or two during transitions
+    //and GPU fallbacks.
+    nsecs_t now = systemTime();
+    for(int i = 0; i < MAX_ROT_SLOTS; i++) {
+        if(!mRot[i])
+            continue;
+        if(mSess[i].inUse) {
+            mSess[i].lastFrame = mFrame;
+            mSess[i].lastTime = now;
+        } else if(mFrame - mSess[i].lastFrame >= mKeepFrames ||
+                now - mSess[i].lastTime >= mKeepTime) {
+            destroy(i);
         }
     }
 }
 
-Rotator* RotMgr::getNext() {
-    //Return a rot object, creating one if necessary
-    overlay::Rotator *rot = NULL;
-    if(mUseCount >= MAX_ROT_SESS) {
+Rotator* RotMgr::getNext(const utils::Whf& whf,
+        const utils::eTransform& rot, bool secure) {
+    bool match = false;
+    int index = findSlot(0, MAX_ROT_SESS, whf, rot, secure, match);
+    if(index < 0 && mSwEnabled && !secure &&
+            SwRot::isFormatSupported(whf.format)) {
+        //Hardware sessions are all taken, rotate this one on the CPU
+        index = findSlot(MAX_ROT_SESS, MAX_ROT_SLOTS, whf, rot, secure,
+                match);
+    }
+    if(index < 0) {
         ALOGE("%s, MAX rotator sessions reached", __func__);
+        return NULL;
+    }
+    return useSlot(index, match, whf, rot, secure);
+}
+
+Rotator* RotMgr::getSwFallback(overlay::Rotator *failed,
+        const utils::Whf& whf, const utils::eTransform& rot, bool secure) {
+    if(!mSwEnabled || secure || !SwRot::isFormatSupported(whf.format))
+        return NULL;
+    for(int i = 0; i < MAX_ROT_SESS; i++) {
+        //The hardware session can't take this source, don't keep it around
+        if(failed && mRot[i] == failed) {
+            if(mSess[i].inUse)
+                mUseCount--;
+            destroy(i);
+            break;
+        }
+    }
+    bool match = false;
+    int index = findSlot(MAX_ROT_SESS, MAX_ROT_SLOTS, whf, rot, secure,
+            match);
+    if(index < 0) {
+        ALOGE("%s, MAX sw rotator sessions reached", __func__);
+        return NULL;
+    }
+    return useSlot(index, match, whf, rot, secure);
+}
+
+int RotMgr::findSlot(int first, int last, const utils::Whf& whf,
+        const utils::eTransform& rot, bool secure, bool& match) {
+    //Prefer an idle session set up for the same source. Otherwise use an
+    //empty slot, or the least recently used idle session.
+    int empty = -1, lru = -1;
+    match = false;
+    for(int i = first; i < last; i++) {
+        if(!mRot[i]) {
+            if(empty < 0)
+                empty = i;
+            continue;
+        }
+        if(mSess[i].inUse)
+            continue;
+        if(mSess[i].whf == whf && mSess[i].rot == rot &&
+                mSess[i].secure == secure) {
+            match = true;
+            return i;
+        }
+        if(lru < 0 || mSess[i].lastTime < mSess[lru].lastTime)
+            lru = i;
+    }
+    return (empty >= 0) ? empty : lru;
+}
+
+Rotator* RotMgr::useSlot(int index, bool match, const utils::Whf& whf,
+        const utils::eTransform& rot, bool secure) {
+    if(match) {
+        mReused++;
     } else {
-        if(mRot[mUseCount] == NULL)
-            mRot[mUseCount] = overlay::Rotator::getRotator();
-        rot = mRot[mUseCount++];
+        if(mRot[index])
+            destroy(index);
+        if(index < MAX_ROT_SESS)
+            mRot[index] = overlay::Rotator::getRotator();
+        else
+            mRot[index] = new SwRot();
+        if(mRot[index] == NULL)
+            return NULL;
+        mRot[index]->setBufferDepth(mBufDepth);
+        mCreated++;
+    }
+
+    mSess[index].whf = whf;
+    mSess[index].rot = rot;
+    mSess[index].secure = secure;
+    mSess[index].inUse = true;
+    mSess[index].lastFrame = mFrame;
+    mSess[index].lastTime = systemTime();
+    mUseCount++;
+    return mRot[index];
+}
+
+void RotMgr::markUnused(overlay::Rotator *rot) {
+    for(int i = 0; i < MAX_ROT_SLOTS; i++) {
+        if(rot && mRot[i] == rot && mSess[i].inUse) {
+            mSess[i].inUse = false;
+            mUseCount--;
+            break;
+        }
     }
-    return rot;
+}
+
+void RotMgr::destroy(int index) {
+    delete mRot[index];
+    mRot[index] = 0;
+    mSess[index].inUse = false;
+    mDestroyed++;
 }
 
 void RotMgr::clear() {
     //Brute force obj destruction, helpful in suspend.
-    for(int i = 0; i < MAX_ROT_SESS; i++) {
+    for(int i = 0; i < MAX_ROT_SLOTS; i++) {
         if(mRot[i]) {
-            delete mRot[i];
-            mRot[i] = 0;
+            destroy(i);
         }
     }
     mUseCount = 0;
@@ -171,12 +368,21 @@ void RotMgr::clear() {
 }
 
 void RotMgr::getDump(char *buf, size_t len) {
-    for(int i = 0; i < MAX_ROT_SESS; i++) {
+    for(int i = 0; i < MAX_ROT_SLOTS; i++) {
         if(mRot[i]) {
             mRot[i]->getDump(buf, len);
+            mRot[i]->getStatsDump(buf, len);
         }
     }
-    char str[32] = {'\0'};
+    char str[160] = {'\0'};
+    //Rates are per minute since the manager was created
+    uint64_t secs = ns2s(systemTime() - mStatsStart);
+    if(secs == 0)
+        secs = 1;
+    snprintf(str, 160, "RotSessions: created=%d (%d/min) destroyed=%d "
+            "(%d/min) reused=%d\n", mCreated, (int)(mCreated * 60ULL / secs),
+            mDestroyed, (int)(mDestroyed * 60ULL / secs), mReused);
+    strlcat(buf, str, len);
     snprintf(str, 32, "\n================\n");
     strlcat(buf, str, len);
 }
@@ -31,11 +31,13 @@
 #define OVERlAY_ROTATOR_H
 
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "mdpWrapper.h"
 #include "overlayUtils.h"
 #include "overlayMem.h"
 #include "sync/sync.h"
+#include <utils/Timers.h>
 
 namespace overlay {
 
@@ -57,31 +59,49 @@ struct RotMem {
         bool close() { return m.close(); }
         uint32_t size() const { return m.bufSz(); }
         void setReleaseFd(const int& fence);
-        // Max rotator buffers
-        enum { ROT_NUM_BUFS = 2 };
+        /* Picks the slot for the next rotation, returns its offset and the
+         * time spent blocked, if any */
+        uint32_t nextSlot(nsecs_t& stall);
+        /* Drops the fences of a previous allocation */
+        void closeFences();
+        // Rotator buffers per session
+        enum { ROT_MIN_BUFS = 2, ROT_MAX_BUFS = 4 };
         // rotator data info dst offset
-        uint32_t mRotOffset[ROT_NUM_BUFS];
-        int mRelFence[ROT_NUM_BUFS];
-        // current offset slot from mRotOffset
+        uint32_t mRotOffset[ROT_MAX_BUFS];
+        // release fence of the last frame that used each slot
+        int mRelFence[ROT_MAX_BUFS];
+        // queue order of each slot's fence, from mQueueSeq
+        uint32_t mQueued[ROT_MAX_BUFS];
+        uint32_t mQueueSeq;
+        // slot of the last rotation, from mRotOffset
         uint32_t mCurrOffset;
         OvMem m;
     };
 
-    RotMem() : _curr(0) {}
+    RotMem() : _curr(0), mNumBufs(Mem::ROT_MIN_BUFS), mStalls(0),
+            mStallTime(0), mMaxStall(0) {}
     Mem& curr() { return m[_curr % MAX_ROT_MEM]; }
     const Mem& curr() const { return m[_curr % MAX_ROT_MEM]; }
     Mem& prev() { return m[(_curr+1) % MAX_ROT_MEM]; }
     RotMem& operator++() { ++_curr; return *this; }
     void setReleaseFd(const int& fence) { curr().setReleaseFd(fence); }
+    /* Offset of the buffer to rotate into next */
+    uint32_t nextOffset();
     bool close();
     uint32_t _curr;
     Mem m[MAX_ROT_MEM];
+    // Buffers to allocate on the next remap
+    uint32_t mNumBufs;
+    // Rotations that had to wait for a slot to be released
+    uint32_t mStalls;
+    nsecs_t mStallTime;
+    nsecs_t mMaxStall;
 };
 
 class Rotator
 {
 public:
-    enum { TYPE_MDP, TYPE_MDSS };
+    enum { TYPE_MDP, TYPE_MDSS, TYPE_SW };
     virtual ~Rotator();
     virtual void setSource(const utils::Whf& wfh) = 0;
     virtual void setSource(const utils::Whf& awhf, const utils::Whf& owhf) = 0;
@@ -96,7 +116,21 @@ public:
     virtual bool queueBuffer(int fd, uint32_t offset) = 0;
     virtual void dump() const = 0;
     virtual void getDump(char *buf, size_t len) const = 0;
+    /* Rotators that read the source with the CPU need its acquire fence
+     * before queueBuffer. getOutputFence returns a fence that signals when
+     * the next queueBuffer has been rotated, it is called before queueing
+     * since MDP gets its fences first. The caller owns the fence, -1 when
+     * there is none. */
+    virtual void setAcquireFence(int /*fence*/) {}
+    virtual int getOutputFence() { return -1; }
+    virtual bool isSoftware() const { return false; }
     void setReleaseFd(const int& fence) { mMem.setReleaseFd(fence); }
+    /* Number of rotator buffers of this session, applied on the next
+     * (re)allocation. More buffers let the rotator run further ahead of
+     * the display. */
+    void setBufferDepth(uint32_t numBufs);
+    /* Appends the buffer depth and stall counters */
+    void getStatsDump(char *buf, size_t len) const;
     static Rotator *getRotator();
 
 protected:
@@ -222,20 +256,130 @@ private:
     friend Rotator* Rotator::getRotator();
 };
 
+/*
+* SwRot rotates and flips on the CPU, as a fallback when the hardware
+* rotator has no free session or can't take the source. Rotation runs on a
+* worker thread of the session, the output is guarded by a sw_sync fence.
+* */
+class SwRot : public Rotator {
+public:
+    virtual ~SwRot();
+    virtual void setSource(const utils::Whf& wfh);
+    virtual void setSource(const utils::Whf& awhf, const utils::Whf& owhf);
+    virtual void setFlags(const utils::eMdpFlags& flags);
+    virtual void setTransform(const utils::eTransform& rot);
+    virtual bool commit();
+    virtual void setDownscale(int ds);
+    virtual int getDstMemId() const;
+    virtual uint32_t getDstOffset() const;
+    virtual uint32_t getDstFormat() const;
+    virtual uint32_t getSessId() const;
+    virtual bool queueBuffer(int fd, uint32_t offset);
+    virtual void dump() const;
+    virtual void getDump(char *buf, size_t len) const;
+    virtual void setAcquireFence(int fence);
+    virtual int getOutputFence();
+    virtual bool isSoftware() const { return true; }
+
+    /* True if a source of this format can be rotated in software */
+    static bool isFormatSupported(uint32_t format);
+
+    /* One plane of a buffer, strides and widths in elements */
+    struct Plane {
+        uint32_t offset;
+        uint32_t stride;
+        uint32_t w;
+        uint32_t h;
+        uint32_t bpp;
+    };
+    enum { MAX_PLANES = 3 };
+
+    /* Plane layout of a w x h buffer of the given MDP format, as MDP reads
+     * it. Returns the number of planes, 0 for unsupported formats. */
+    static int getPlanes(uint32_t format, uint32_t w, uint32_t h,
+            Plane *planes, uint32_t *size);
+
+    /* Copies src into dst applying the MDP flip and rotation flags */
+    static void transformPlane(const uint8_t *src, const Plane& sp,
+            uint8_t *dst, const Plane& dp, int orient);
+
+private:
+    explicit SwRot();
+    void reset();
+    bool remap(uint32_t numbufs);
+    /* A rotation with the session state it was queued with */
+    struct Job {
+        int srcFd;
+        uint32_t srcOffset;
+        utils::Whf whf;
+        uint32_t srcSize;
+        int orientation;
+        uint8_t *dst;
+        int acquireFence;
+    };
+
+    void rotate(const Job& job);
+    void setupJob(Job& job, int srcFd, uint32_t srcOffset);
+    /* Hands a rotation to the worker, srcFd -1 only advances the
+     * timeline */
+    void pushJob(int srcFd, uint32_t srcOffset);
+    /* Waits until the worker has no pending rotations */
+    void drain();
+    static void *workerThread(void *arg);
+    void workerLoop();
+
+    utils::Whf mWhf;
+    utils::Whf mOrigWhf;
+    int mOrientation;
+    bool mEnabled;
+    bool mSecure;
+    int mDownscale;
+    uint32_t mDstOffset;
+    int mAcquireFence;
+
+    /* sw_sync timeline signalled as rotations complete, -1 when rotating
+     * synchronously */
+    int mTimeline;
+    uint32_t mQueued;
+    // An output fence was handed out for a rotation not yet queued
+    bool mFencePending;
+    Job mJobs[RotMem::Mem::ROT_MAX_BUFS];
+    uint32_t mJobHead;
+    uint32_t mJobCount;
+    bool mExit;
+    pthread_t mThread;
+    pthread_mutex_t mLock;
+    pthread_cond_t mCond;
+
+    friend class RotMgr;
+};
+
 // Holder of rotator objects. Manages lifetimes
 class RotMgr {
 public:
     //Maximum sessions based on VG pipes, since rotator is used only for videos.
     //Even though we can have 4 mixer stages, that much may be unnecessary.
     enum { MAX_ROT_SESS = 3 };
+    //Software sessions, used only with debug.hwc.rotator.sw=1
+    enum { MAX_SW_ROT_SESS = 2 };
+    enum { MAX_ROT_SLOTS = MAX_ROT_SESS + MAX_SW_ROT_SESS };
 
     ~RotMgr();
     void configBegin();
     void configDone();
-    overlay::Rotator *getNext();
+    /* Returns a rot object for a layer with the given source, transform and
+     * security. An idle session configured the same way is preferred, so
+     * that the rotator doesn't have to be set up again. */
+    overlay::Rotator *getNext(const utils::Whf& whf,
+            const utils::eTransform& rot, bool secure);
+    /* Returns a software rot object to use instead of a hardware one that
+     * failed to configure, which is released. NULL if there is none. */
+    overlay::Rotator *getSwFallback(overlay::Rotator *failed,
+            const utils::Whf& whf, const utils::eTransform& rot,
+            bool secure);
     void clear(); //Removes all instances
-    //Resets the usage of top count objects, making them available for reuse
-    void markUnusedTop(const uint32_t& count) { mUseCount -= count; }
+    //Resets the usage of an object, making it available for reuse
+    void markUnused(overlay::Rotator *rot);
     /* Returns rot dump.
      * Expects a NULL terminated buffer of big enough size.
      */
@@ -248,9 +392,43 @@ private:
     RotMgr();
     static RotMgr *sRotMgr;
 
-    overlay::Rotator *mRot[MAX_ROT_SESS];
+    // What a session was last configured for, and when it was last used
+    struct Session {
+        utils::Whf whf;
+        utils::eTransform rot;
+        bool secure;
+        bool inUse;
+        uint32_t lastFrame;
+        nsecs_t lastTime;
+    };
+
+    /* Slot in [first, last) for the source, match tells if the session
+     * there is already set up for it. -1 if all are in use. */
+    int findSlot(int first, int last, const utils::Whf& whf,
+            const utils::eTransform& rot, bool secure, bool& match);
+    overlay::Rotator *useSlot(int index, bool match, const utils::Whf& whf,
+            const utils::eTransform& rot, bool secure);
+    void destroy(int index);
+
+    //Hardware sessions first, then the software ones
+    overlay::Rotator *mRot[MAX_ROT_SLOTS];
+    Session mSess[MAX_ROT_SLOTS];
     uint32_t mUseCount;
     int mRotDevFd; //A-fam
+    // Buffer depth of new sessions, debug.hwc.rotator.bufs
+    uint32_t mBufDepth;
+    // debug.hwc.rotator.sw
+    bool mSwEnabled;
+    // Idle sessions are kept for up to this many frames and this long,
+    // debug.hwc.rotator.keep_frames and debug.hwc.rotator.keep_ms
+    uint32_t mKeepFrames;
+    nsecs_t mKeepTime;
+    uint32_t mFrame;
+    // Session churn, for the dump
+    uint32_t mCreated;
+    uint32_t mDestroyed;
+    uint32_t mReused;
+    nsecs_t mStatsStart;
 };
 
 
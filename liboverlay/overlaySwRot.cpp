@@ -0,0 +1,620 @@
+/*
+ * Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of The Linux Foundation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <stddef.h>
+#include <hardware/hardware.h>
+#include <sync/sync.h>
+//The NEON transpose is not verified on target yet, it is opt-in through
+//TARGET_SWROT_USES_NEON until it is checked bit-exact against copyRect
+#if defined(__ARM_HAVE_NEON) && defined(SWROT_USE_NEON)
+#include <arm_neon.h>
+#endif
+#include "overlayUtils.h"
+#include "overlayRotator.h"
+#include "gralloc_priv.h"
+#include "memalloc.h"
+#include "alloc_controller.h"
+
+// Rotating walks the source by columns. Tiles of TILE_BYTES x TILE_BYTES
+// bytes keep the source lines of a tile in the cache while the output is
+// written row by row, which the uncached output memory needs.
+#define TILE_BYTES 64
+
+namespace ovutils = overlay::utils;
+
+namespace overlay {
+
+//Copies output rows [y0, y1) and columns [x0, x1) element by element.
+//origin is the source of output (0, 0), dx and dy the source steps along
+//an output row and down an output column.
+template <typename T>
+static void copyRect(const T *origin, ptrdiff_t dx, ptrdiff_t dy,
+        T *out, uint32_t outStride, uint32_t x0, uint32_t x1,
+        uint32_t y0, uint32_t y1) {
+    const uint32_t tile = TILE_BYTES / sizeof(T) * 2;
+    for(uint32_t ty = y0; ty < y1; ty += tile) {
+        uint32_t yEnd = (ty + tile < y1) ? ty + tile : y1;
+        for(uint32_t tx = x0; tx < x1; tx += tile) {
+            uint32_t xEnd = (tx + tile < x1) ? tx + tile : x1;
+            for(uint32_t oy = ty; oy < yEnd; oy++) {
+                const T *s = origin + (ptrdiff_t)tx * dx + (ptrdiff_t)oy * dy;
+                T *d = out + oy * outStride + tx;
+                uint32_t n = xEnd - tx;
+                //Unrolled, the loads are independent of each other
+                while(n >= 4) {
+                    d[0] = s[0];
+                    d[1] = s[dx];
+                    d[2] = s[2 * dx];
+                    d[3] = s[3 * dx];
+                    s += 4 * dx;
+                    d += 4;
+                    n -= 4;
+                }
+                while(n--) {
+                    *d++ = *s;
+                    s += dx;
+                }
+            }
+        }
+    }
+}
+
+#if defined(__ARM_HAVE_NEON) && defined(SWROT_USE_NEON)
+//Square blocks transposed in registers, 8x8 bytes or 4x4 larger elements.
+//s[i] is source row i of the block, d[i] receives column i.
+static inline void transposeBlock(const uint8_t * const *s,
+        uint8_t * const *d) {
+    uint8x8x2_t t01 = vtrn_u8(vld1_u8(s[0]), vld1_u8(s[1]));
+    uint8x8x2_t t23 = vtrn_u8(vld1_u8(s[2]), vld1_u8(s[3]));
+    uint8x8x2_t t45 = vtrn_u8(vld1_u8(s[4]), vld1_u8(s[5]));
+    uint8x8x2_t t67 = vtrn_u8(vld1_u8(s[6]), vld1_u8(s[7]));
+    uint16x4x2_t u02 = vtrn_u16(vreinterpret_u16_u8(t01.val[0]),
+            vreinterpret_u16_u8(t23.val[0]));
+    uint16x4x2_t u13 = vtrn_u16(vreinterpret_u16_u8(t01.val[1]),
+            vreinterpret_u16_u8(t23.val[1]));
+    uint16x4x2_t u46 = vtrn_u16(vreinterpret_u16_u8(t45.val[0]),
+            vreinterpret_u16_u8(t67.val[0]));
+    uint16x4x2_t u57 = vtrn_u16(vreinterpret_u16_u8(t45.val[1]),
+            vreinterpret_u16_u8(t67.val[1]));
+    uint32x2x2_t v04 = vtrn_u32(vreinterpret_u32_u16(u02.val[0]),
+            vreinterpret_u32_u16(u46.val[0]));
+    uint32x2x2_t v26 = vtrn_u32(vreinterpret_u32_u16(u02.val[1]),
+            vreinterpret_u32_u16(u46.val[1]));
+    uint32x2x2_t v15 = vtrn_u32(vreinterpret_u32_u16(u13.val[0]),
+            vreinterpret_u32_u16(u57.val[0]));
+    uint32x2x2_t v37 = vtrn_u32(vreinterpret_u32_u16(u13.val[1]),
+            vreinterpret_u32_u16(u57.val[1]));
+    vst1_u8(d[0], vreinterpret_u8_u32(v04.val[0]));
+    vst1_u8(d[1], vreinterpret_u8_u32(v15.val[0]));
+    vst1_u8(d[2], vreinterpret_u8_u32(v26.val[0]));
+    vst1_u8(d[3], vreinterpret_u8_u32(v37.val[0]));
+    vst1_u8(d[4], vreinterpret_u8_u32(v04.val[1]));
+    vst1_u8(d[5], vreinterpret_u8_u32(v15.val[1]));
+    vst1_u8(d[6], vreinterpret_u8_u32(v26.val[1]));
+    vst1_u8(d[7], vreinterpret_u8_u32(v37.val[1]));
+}
+
+static inline void transposeBlock(const uint16_t * const *s,
+        uint16_t * const *d) {
+    uint16x4x2_t t01 = vtrn_u16(vld1_u16(s[0]), vld1_u16(s[1]));
+    uint16x4x2_t t23 = vtrn_u16(vld1_u16(s[2]), vld1_u16(s[3]));
+    uint32x2x2_t v02 = vtrn_u32(vreinterpret_u32_u16(t01.val[0]),
+            vreinterpret_u32_u16(t23.val[0]));
+    uint32x2x2_t v13 = vtrn_u32(vreinterpret_u32_u16(t01.val[1]),
+            vreinterpret_u32_u16(t23.val[1]));
+    vst1_u16(d[0], vreinterpret_u16_u32(v02.val[0]));
+    vst1_u16(d[1], vreinterpret_u16_u32(v13.val[0]));
+    vst1_u16(d[2], vreinterpret_u16_u32(v02.val[1]));
+    vst1_u16(d[3], vreinterpret_u16_u32(v13.val[1]));
+}
+
+static inline void transposeBlock(const uint32_t * const *s,
+        uint32_t * const *d) {
+    uint32x4x2_t t01 = vtrnq_u32(vld1q_u32(s[0]), vld1q_u32(s[1]));
+    uint32x4x2_t t23 = vtrnq_u32(vld1q_u32(s[2]), vld1q_u32(s[3]));
+    vst1q_u32(d[0], vcombine_u32(vget_low_u32(t01.val[0]),
+            vget_low_u32(t23.val[0])));
+    vst1q_u32(d[1], vcombine_u32(vget_low_u32(t01.val[1]),
+            vget_low_u32(t23.val[1])));
+    vst1q_u32(d[2], vcombine_u32(vget_high_u32(t01.val[0]),
+            vget_high_u32(t23.val[0])));
+    vst1q_u32(d[3], vcombine_u32(vget_high_u32(t01.val[1]),
+            vget_high_u32(t23.val[1])));
+}
+
+//90 degree rotations, a step along an output row is a source row (dx) and
+//a step down an output column is the next or previous source element (dy
+//+1 or -1). Handles the whole blocks and shrinks dw, dh to what they
+//cover.
+template <typename T>
+static void rotateBlocks(const T *origin, ptrdiff_t dx, ptrdiff_t dy,
+        T *out, uint32_t outStride, uint32_t *dw, uint32_t *dh) {
+    const uint32_t n = (sizeof(T) == 1) ? 8 : 4;
+    const uint32_t bw = *dw - *dw % n, bh = *dh - *dh % n;
+    const uint32_t tile = TILE_BYTES / sizeof(T) * 2;
+    //A block row read backwards is loaded from its last element and its
+    //columns are stored bottom up
+    const ptrdiff_t back = (dy < 0) ? n - 1 : 0;
+    const T *s[8];
+    T *d[8];
+    for(uint32_t ty = 0; ty < bh; ty += tile) {
+        uint32_t yEnd = (ty + tile < bh) ? ty + tile : bh;
+        for(uint32_t tx = 0; tx < bw; tx += tile) {
+            uint32_t xEnd = (tx + tile < bw) ? tx + tile : bw;
+            for(uint32_t by = ty; by < yEnd; by += n) {
+                for(uint32_t bx = tx; bx < xEnd; bx += n) {
+                    for(uint32_t i = 0; i < n; i++) {
+                        s[i] = origin + (ptrdiff_t)(bx + i) * dx +
+                                (ptrdiff_t)by * dy - back;
+                        d[i] = out + (by + (back ? back - i : i)) *
+                                outStride + bx;
+                    }
+                    transposeBlock(s, d);
+                }
+            }
+        }
+    }
+    *dw = bw;
+    *dh = bh;
+}
+#endif
+
+template <typename T>
+static void transformPlaneT(const uint8_t *src, const SwRot::Plane& sp,
+        uint8_t *dst, const SwRot::Plane& dp, int orient) {
+    const ptrdiff_t stride = sp.stride;
+    const ptrdiff_t W = sp.w, H = sp.h;
+    const bool flipH = orient & MDP_FLIP_LR;
+    const bool flipV = orient & MDP_FLIP_UD;
+    ptrdiff_t sx0, sy0, dx, dy;
+
+    //Flips are applied first, then the 90 degree clockwise rotation. Find
+    //the source element of output (0, 0) and the source steps for a step
+    //along an output row (dx) and down an output column (dy).
+    if(orient & MDP_ROT_90) {
+        sx0 = flipH ? W - 1 : 0;
+        sy0 = flipV ? 0 : H - 1;
+        dx = flipV ? stride : -stride;
+        dy = flipH ? -1 : 1;
+    } else {
+        sx0 = flipH ? W - 1 : 0;
+        sy0 = flipV ? H - 1 : 0;
+        dx = flipH ? -1 : 1;
+        dy = flipV ? -stride : stride;
+    }
+
+    const T *origin = reinterpret_cast<const T*>(src) + sy0 * stride + sx0;
+    T *out = reinterpret_cast<T*>(dst);
+    const uint32_t dw = dp.w, dh = dp.h;
+
+    if(dx == 1) {
+        for(uint32_t oy = 0; oy < dh; oy++) {
+            memcpy(out + oy * dp.stride, origin + oy * dy, dw * sizeof(T));
+        }
+        return;
+    }
+
+#if defined(__ARM_HAVE_NEON) && defined(SWROT_USE_NEON)
+    if(orient & MDP_ROT_90) {
+        uint32_t bw = dw, bh = dh;
+        rotateBlocks(origin, dx, dy, out, dp.stride, &bw, &bh);
+        //The right and bottom edges that don't fill a block
+        copyRect(origin, dx, dy, out, dp.stride, bw, dw, 0, dh);
+        copyRect(origin, dx, dy, out, dp.stride, 0, bw, bh, dh);
+        return;
+    }
+#endif
+    copyRect(origin, dx, dy, out, dp.stride, 0, dw, 0, dh);
+}
+
+void SwRot::transformPlane(const uint8_t *src, const Plane& sp,
+        uint8_t *dst, const Plane& dp, int orient) {
+    switch(sp.bpp) {
+        case 1:
+            transformPlaneT<uint8_t>(src, sp, dst, dp, orient);
+            break;
+        case 2:
+            transformPlaneT<uint16_t>(src, sp, dst, dp, orient);
+            break;
+        case 4:
+            transformPlaneT<uint32_t>(src, sp, dst, dp, orient);
+            break;
+        default:
+            ALOGE("%s: unsupported element size %d", __FUNCTION__, sp.bpp);
+    }
+}
+
+static void setPlane(SwRot::Plane& p, uint32_t offset, uint32_t stride,
+        uint32_t w, uint32_t h, uint32_t bpp) {
+    p.offset = offset;
+    p.stride = stride;
+    p.w = w;
+    p.h = h;
+    p.bpp = bpp;
+}
+
+int SwRot::getPlanes(uint32_t format, uint32_t w, uint32_t h,
+        Plane *planes, uint32_t *size) {
+    int count = 0;
+    switch(format) {
+        case MDP_RGBA_8888:
+        case MDP_BGRA_8888:
+        case MDP_RGBX_8888:
+        case MDP_ARGB_8888:
+        case MDP_XRGB_8888:
+            setPlane(planes[0], 0, w, w, h, 4);
+            *size = w * h * 4;
+            count = 1;
+            break;
+        case MDP_RGB_565:
+            setPlane(planes[0], 0, w, w, h, 2);
+            *size = w * h * 2;
+            count = 1;
+            break;
+        case MDP_Y_CBCR_H2V2:
+        case MDP_Y_CRCB_H2V2:
+            //NV12/NV21, the interleaved chroma pair is one element
+            if((w & 1) || (h & 1))
+                return 0;
+            setPlane(planes[0], 0, w, w, h, 1);
+            setPlane(planes[1], w * h, w / 2, w / 2, h / 2, 2);
+            *size = w * h + w * h / 2;
+            count = 2;
+            break;
+        case MDP_Y_CR_CB_GH2V2: {
+            //YV12 with the Android stride alignment
+            if((w & 1) || (h & 1))
+                return 0;
+            uint32_t ystride = ovutils::align(w, 16);
+            uint32_t cstride = ovutils::align(ystride / 2, 16);
+            uint32_t ysize = ystride * h;
+            uint32_t csize = cstride * (h / 2);
+            setPlane(planes[0], 0, ystride, w, h, 1);
+            setPlane(planes[1], ysize, cstride, w / 2, h / 2, 1);
+            setPlane(planes[2], ysize + csize, cstride, w / 2, h / 2, 1);
+            *size = ysize + 2 * csize;
+            count = 3;
+            break;
+        }
+        default:
+            break;
+    }
+    return count;
+}
+
+bool SwRot::isFormatSupported(uint32_t format) {
+    Plane planes[MAX_PLANES];
+    uint32_t size = 0;
+    return getPlanes(format, 2, 2, planes, &size) > 0;
+}
+
+//============SwRot=========================
+
+SwRot::SwRot() : mTimeline(-1), mQueued(0), mFencePending(false),
+        mJobHead(0), mJobCount(0), mExit(false) {
+    mAcquireFence = -1;
+    reset();
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mCond, NULL);
+    mTimeline = sw_sync_timeline_create();
+    if(mTimeline >= 0 &&
+            pthread_create(&mThread, NULL, workerThread, this) != 0) {
+        ::close(mTimeline);
+        mTimeline = -1;
+    }
+    ALOGE_IF(mTimeline < 0, "%s: no sw_sync, rotating synchronously",
+            __FUNCTION__);
+}
+
+SwRot::~SwRot() {
+    if(mTimeline >= 0) {
+        //A fence handed out must signal even if nothing gets queued
+        if(mFencePending)
+            pushJob(-1, 0);
+        pthread_mutex_lock(&mLock);
+        mExit = true;
+        pthread_cond_broadcast(&mCond);
+        pthread_mutex_unlock(&mLock);
+        pthread_join(mThread, NULL);
+        ::close(mTimeline);
+    }
+    if(mAcquireFence >= 0)
+        ::close(mAcquireFence);
+    mMem.close();
+    pthread_mutex_destroy(&mLock);
+    pthread_cond_destroy(&mCond);
+}
+
+void SwRot::reset() {
+    mWhf = utils::Whf();
+    mOrigWhf = utils::Whf();
+    mOrientation = 0;
+    mEnabled = false;
+    mSecure = false;
+    mDownscale = 0;
+    mDstOffset = 0;
+}
+
+void SwRot::setSource(const utils::Whf& whf) {
+    mWhf = whf;
+    mOrigWhf = whf;
+}
+
+void SwRot::setSource(const utils::Whf& awhf, const utils::Whf& owhf) {
+    mWhf = awhf;
+    mOrigWhf = owhf;
+}
+
+void SwRot::setFlags(const utils::eMdpFlags& flags) {
+    mSecure = flags & utils::OV_MDP_SECURE_OVERLAY_SESSION;
+}
+
+void SwRot::setTransform(const utils::eTransform& rot) {
+    int flags = utils::getMdpOrient(rot);
+    mOrientation = (flags == -1) ? 0 : flags;
+}
+
+void SwRot::setDownscale(int ds) { mDownscale = ds; }
+
+bool SwRot::commit() {
+    Plane planes[MAX_PLANES];
+    uint32_t size = 0;
+    //The CPU can't read protected buffers, and scaling is left to MDP
+    mEnabled = !mSecure && !mDownscale &&
+            getPlanes(mWhf.format, mWhf.w, mWhf.h, planes, &size) > 0;
+    if(!mEnabled) {
+        ALOGE_IF(DEBUG_OVERLAY, "%s: can't rotate format=%d secure=%d "
+                "downscale=%d", __FUNCTION__, mWhf.format, mSecure,
+                mDownscale);
+    }
+    return mEnabled;
+}
+
+int SwRot::getDstMemId() const { return mMem.curr().m.getFD(); }
+
+uint32_t SwRot::getDstOffset() const { return mDstOffset; }
+
+uint32_t SwRot::getDstFormat() const { return mWhf.format; }
+
+uint32_t SwRot::getSessId() const { return 0; }
+
+void SwRot::setAcquireFence(int fence) {
+    if(mAcquireFence >= 0)
+        ::close(mAcquireFence);
+    mAcquireFence = (fence >= 0) ? dup(fence) : -1;
+}
+
+int SwRot::getOutputFence() {
+    if(mTimeline < 0)
+        return -1;
+    //The previous fence was never followed by a queueBuffer
+    if(mFencePending)
+        pushJob(-1, 0);
+    int fence = sw_sync_fence_create(mTimeline, "swrot", mQueued + 1);
+    mFencePending = (fence >= 0);
+    return fence;
+}
+
+bool SwRot::remap(uint32_t numbufs) {
+    Plane planes[MAX_PLANES];
+    uint32_t size = 0;
+    bool rot90 = mOrientation & MDP_ROT_90;
+    getPlanes(mWhf.format, rot90 ? mWhf.h : mWhf.w,
+            rot90 ? mWhf.w : mWhf.h, planes, &size);
+    size = ovutils::align(size, getpagesize());
+    if(size == mMem.curr().size() && numbufs == mMem.curr().m.numBufs())
+        return true;
+
+    //Pending rotations write into the current memory
+    drain();
+    ++mMem;
+    mMem.curr().closeFences();
+    mMem.curr().mCurrOffset = 0;
+    OvMem mem;
+    if(!mem.open(numbufs, size, false)) {
+        ALOGE("%s: Failed to open", __FUNCTION__);
+        mem.close();
+        return false;
+    }
+    mMem.curr().m = mem;
+    for(uint32_t i = 0; i < numbufs; ++i) {
+        mMem.curr().mRotOffset[i] = i * size;
+    }
+    return true;
+}
+
+bool SwRot::queueBuffer(int fd, uint32_t offset) {
+    if(!mEnabled)
+        return true;
+
+    int srcFd = -1;
+    if(remap(mMem.mNumBufs)) {
+        mDstOffset = mMem.nextOffset();
+        if(mMem.prev().valid() && !mMem.prev().close()) {
+            ALOGE("%s error in closing prev rot mem", __FUNCTION__);
+        }
+        srcFd = dup(fd);
+        ALOGE_IF(srcFd < 0, "%s: dup failed %s", __FUNCTION__,
+                strerror(errno));
+    }
+
+    if(mTimeline < 0) {
+        if(mAcquireFence >= 0) {
+            sync_wait(mAcquireFence, 1000);
+            ::close(mAcquireFence);
+            mAcquireFence = -1;
+        }
+        if(srcFd < 0)
+            return false;
+        Job job;
+        setupJob(job, srcFd, offset);
+        rotate(job);
+        ::close(srcFd);
+        return true;
+    }
+
+    //Queued even on failure, so that the output fence signals
+    pushJob(srcFd, offset);
+    return srcFd >= 0;
+}
+
+void SwRot::setupJob(Job& job, int srcFd, uint32_t srcOffset) {
+    job.srcFd = srcFd;
+    job.srcOffset = srcOffset;
+    job.whf = mWhf;
+    job.srcSize = mOrigWhf.size;
+    job.orientation = mOrientation;
+    job.dst = mMem.curr().valid() ?
+            (uint8_t*)mMem.curr().m.addr() + mDstOffset : NULL;
+}
+
+void SwRot::pushJob(int srcFd, uint32_t srcOffset) {
+    pthread_mutex_lock(&mLock);
+    //At most one job per output buffer can be pending, the slot fences
+    //keep hwc from getting further ahead
+    while(mJobCount == RotMem::Mem::ROT_MAX_BUFS)
+        pthread_cond_wait(&mCond, &mLock);
+    Job& job = mJobs[(mJobHead + mJobCount) % RotMem::Mem::ROT_MAX_BUFS];
+    //The next configRotator rewrites the session while this is pending
+    setupJob(job, srcFd, srcOffset);
+    job.acquireFence = mAcquireFence;
+    mAcquireFence = -1;
+    mJobCount++;
+    mQueued++;
+    mFencePending = false;
+    pthread_cond_broadcast(&mCond);
+    pthread_mutex_unlock(&mLock);
+}
+
+void SwRot::drain() {
+    if(mTimeline < 0)
+        return;
+    pthread_mutex_lock(&mLock);
+    while(mJobCount)
+        pthread_cond_wait(&mCond, &mLock);
+    pthread_mutex_unlock(&mLock);
+}
+
+void *SwRot::workerThread(void *arg) {
+    setpriority(PRIO_PROCESS, 0, HAL_PRIORITY_URGENT_DISPLAY);
+    static_cast<SwRot*>(arg)->workerLoop();
+    return NULL;
+}
+
+void SwRot::workerLoop() {
+    pthread_mutex_lock(&mLock);
+    while(true) {
+        while(!mJobCount && !mExit)
+            pthread_cond_wait(&mCond, &mLock);
+        if(!mJobCount)
+            break;
+        Job job = mJobs[mJobHead];
+        pthread_mutex_unlock(&mLock);
+
+        if(job.acquireFence >= 0) {
+            if(sync_wait(job.acquireFence, 1000) < 0) {
+                ALOGE("%s: sync_wait error!! error no = %d err str = %s",
+                        __FUNCTION__, errno, strerror(errno));
+            }
+            ::close(job.acquireFence);
+        }
+        if(job.srcFd >= 0) {
+            rotate(job);
+            ::close(job.srcFd);
+        }
+        //Signalled even if the rotation failed, MDP must not wait forever
+        sw_sync_timeline_inc(mTimeline, 1);
+
+        pthread_mutex_lock(&mLock);
+        mJobHead = (mJobHead + 1) % RotMem::Mem::ROT_MAX_BUFS;
+        mJobCount--;
+        pthread_cond_broadcast(&mCond);
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+void SwRot::rotate(const Job& job) {
+    Plane sp[MAX_PLANES], dp[MAX_PLANES];
+    uint32_t srcSize = 0, dstSize = 0;
+    const utils::Whf& whf = job.whf;
+    bool rot90 = job.orientation & MDP_ROT_90;
+    int count = getPlanes(whf.format, whf.w, whf.h, sp, &srcSize);
+    getPlanes(whf.format, rot90 ? whf.h : whf.w, rot90 ? whf.w : whf.h,
+            dp, &dstSize);
+    if(!count || !job.dst)
+        return;
+
+    int fd = job.srcFd;
+    size_t mapSize = job.srcOffset + ((job.srcSize > srcSize) ?
+            job.srcSize : srcSize);
+    void *base = mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        ALOGE("%s: mmap of source fd=%d failed %s", __FUNCTION__, fd,
+                strerror(errno));
+        return;
+    }
+    //The producer wrote the source with a device, drop stale lines
+    gralloc::IMemAlloc *memalloc =
+            gralloc::IAllocController::getInstance()->getAllocator(
+            private_handle_t::PRIV_FLAGS_USES_ION);
+    if(memalloc) {
+        memalloc->clean_buffer(base, mapSize, 0, fd,
+                gralloc::CACHE_INVALIDATE);
+    }
+
+    const uint8_t *src = (const uint8_t*)base + job.srcOffset;
+    for(int i = 0; i < count; i++) {
+        transformPlane(src + sp[i].offset, sp[i], job.dst + dp[i].offset,
+                dp[i], job.orientation);
+    }
+    munmap(base, mapSize);
+    //The caller closes the dup'd fd, drop the ion import cached for it
+    if(memalloc)
+        memalloc->release_fd(fd);
+}
+
+void SwRot::dump() const {
+    ALOGE("== Dump SwRot start ==");
+    mMem.curr().m.dump();
+    ALOGE("whf w=%d h=%d format=%d orientation=%d", mWhf.w, mWhf.h,
+            mWhf.format, mOrientation);
+    ALOGE("== Dump SwRot end ==");
+}
+
+void SwRot::getDump(char *buf, size_t len) const {
+    char str[128] = {'\0'};
+    snprintf(str, 128, "SwRot: w=%d h=%d format=%d orientation=%d "
+            "queued=%d\n", mWhf.w, mWhf.h, mWhf.format, mOrientation,
+            mQueued);
+    strlcat(buf, str, len);
+}
+
+} // namespace overlay
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of The Linux Foundation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cutils/atomic.h>
+#include <cutils/atomic-inline.h>
+#include "overlayTrace.h"
+
+namespace overlay {
+using namespace utils;
+
+static const char *sEventStr[] = { "set", "commit", "fail", "unset" };
+
+static const char* getTypeStr(int type) {
+    switch(type) {
+        case OV_MDP_PIPE_RGB: return "RGB";
+        case OV_MDP_PIPE_VG: return "VG";
+        case OV_MDP_PIPE_DMA: return "DMA";
+        default: return "Invalid";
+    }
+}
+
+OverlayTrace::OverlayTrace() : mLastCommitMask(0), mHead(0), mFrame(0) {
+    memset(mRecords, 0, sizeof(mRecords));
+    memset(mLastCommit, 0, sizeof(mLastCommit));
+    for(int i = 0; i < MAX_RECORDS; i++) {
+        mRecords[i].seq = -1;
+    }
+}
+
+OverlayTrace::Record* OverlayTrace::begin(eEvent ev, int dest, int dpy,
+        eMdpPipeType type) {
+    Record *rec = &mRecords[mHead & (MAX_RECORDS - 1)];
+    android_atomic_release_store(-1, &rec->seq);
+    //readers must not see the field writes below before the -1
+    android_memory_barrier();
+    rec->frame = mFrame;
+    rec->event = (uint8_t)ev;
+    rec->dest = (int8_t)dest;
+    rec->dpy = (int8_t)dpy;
+    rec->type = (int8_t)type;
+    return rec;
+}
+
+void OverlayTrace::end(Record *rec) {
+    android_atomic_release_store(mHead, &rec->seq);
+    android_atomic_release_store(mHead + 1, &mHead);
+}
+
+void OverlayTrace::add(eEvent ev, int dest, int dpy, eMdpPipeType type) {
+    //next commit on this pipe is recorded whatever its config
+    if(dest >= 0 && dest < OV_MAX)
+        mLastCommitMask &= ~(1 << dest);
+    Record *rec = begin(ev, dest, dpy, type);
+    memset(&rec->cfg, 0, sizeof(rec->cfg));
+    rec->cfg.z = -1;
+    end(rec);
+}
+
+void OverlayTrace::add(eEvent ev, int dest, int dpy, eMdpPipeType type,
+        const PipeArgs& args, const Dim& crop, const Dim& dst) {
+    Config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.z = (int8_t)args.zorder;
+    cfg.format = args.whf.format;
+    cfg.flags = args.mdpFlags;
+    cfg.srcW = (uint16_t)args.whf.w;
+    cfg.srcH = (uint16_t)args.whf.h;
+    cfg.crop[0] = (uint16_t)crop.x;
+    cfg.crop[1] = (uint16_t)crop.y;
+    cfg.crop[2] = (uint16_t)crop.w;
+    cfg.crop[3] = (uint16_t)crop.h;
+    cfg.dst[0] = (uint16_t)dst.x;
+    cfg.dst[1] = (uint16_t)dst.y;
+    cfg.dst[2] = (uint16_t)dst.w;
+    cfg.dst[3] = (uint16_t)dst.h;
+
+    if(dest >= 0 && dest < OV_MAX) {
+        uint32_t bit = 1 << dest;
+        if(ev == EV_COMMIT) {
+            //same config as the last recorded commit, nothing new
+            if((mLastCommitMask & bit) &&
+                    !memcmp(&mLastCommit[dest], &cfg, sizeof(cfg)))
+                return;
+            mLastCommit[dest] = cfg;
+            mLastCommitMask |= bit;
+        } else {
+            mLastCommitMask &= ~bit;
+        }
+    }
+
+    Record *rec = begin(ev, dest, dpy, type);
+    rec->cfg = cfg;
+    end(rec);
+}
+
+bool OverlayTrace::read(int32_t index, Record& rec) const {
+    const Record *src = &mRecords[index & (MAX_RECORDS - 1)];
+    if(android_atomic_acquire_load(&src->seq) != index)
+        return false;
+    memcpy(&rec, src, sizeof(rec));
+    //order the copy before the re-check, writer came around while copying
+    android_memory_barrier();
+    return android_atomic_acquire_load(&src->seq) == index;
+}
+
+void OverlayTrace::decode(const Record& rec, char *str, size_t len) {
+    const char *ev = rec.event < (sizeof(sEventStr) / sizeof(sEventStr[0])) ?
+            sEventStr[rec.event] : "?";
+    if(rec.event == EV_COMMIT || rec.event == EV_FAIL) {
+        snprintf(str, len, "#%u %s pipe=%d(%s) dpy=%d z=%d fmt=%s flags=0x%x "
+                "src=%ux%u crop=[%u,%u,%u,%u] dst=[%u,%u,%u,%u]\n",
+                rec.frame, ev, rec.dest, getTypeStr(rec.type),
+                rec.dpy, rec.cfg.z, getFormatString(rec.cfg.format),
+                rec.cfg.flags, rec.cfg.srcW, rec.cfg.srcH, rec.cfg.crop[0],
+                rec.cfg.crop[1], rec.cfg.crop[2], rec.cfg.crop[3],
+                rec.cfg.dst[0], rec.cfg.dst[1], rec.cfg.dst[2],
+                rec.cfg.dst[3]);
+    } else {
+        snprintf(str, len, "#%u %s pipe=%d(%s) dpy=%d\n", rec.frame, ev,
+                rec.dest, getTypeStr(rec.type), rec.dpy);
+    }
+}
+
+void OverlayTrace::logFrame() const {
+    int32_t head = android_atomic_acquire_load(&mHead);
+    int32_t first = head > MAX_RECORDS ? head - MAX_RECORDS : 0;
+    char str[256];
+    for(int32_t i = first; i < head; i++) {
+        Record rec;
+        if(read(i, rec) && rec.frame == mFrame) {
+            decode(rec, str, sizeof(str));
+            ALOGD("%s", str);
+        }
+    }
+}
+
+void OverlayTrace::getDump(char *buf, size_t len, int count) const {
+    int32_t head = android_atomic_acquire_load(&mHead);
+    if(count > MAX_RECORDS)
+        count = MAX_RECORDS;
+    int32_t first = head > count ? head - count : 0;
+    char str[256];
+    strlcat(buf, "Pipe history:\n", len);
+    for(int32_t i = first; i < head; i++) {
+        Record rec;
+        if(read(i, rec)) {
+            decode(rec, str, sizeof(str));
+            strlcat(buf, str, len);
+        }
+    }
+}
+
+} // overlay
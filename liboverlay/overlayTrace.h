@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2016, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *   * Neither the name of The Linux Foundation nor the names of its
+ *     contributors may be used to endorse or promote products derived
+ *     from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OVERLAY_TRACE_H
+#define OVERLAY_TRACE_H
+
+#include <stdint.h>
+#include "overlayUtils.h"
+
+namespace overlay {
+
+/*
+* Always on history of pipe state changes. Each event is a small binary
+* record written into a ring, text is only produced when the history is
+* dumped. There is a single writer, the composition thread, readers
+* (dumpsys) never block it and drop records overwritten while copying.
+* A commit is only recorded when the pipe config changed since the last
+* commit on that pipe, so steady frames don't push out older history.
+* */
+class OverlayTrace : utils::NoCopy {
+public:
+    enum eEvent {
+        EV_SET,     //pipe object created for a display
+        EV_COMMIT,  //pipe config committed
+        EV_FAIL,    //pipe config rejected
+        EV_UNSET,   //pipe released
+    };
+    enum { MAX_RECORDS = 128 }; //power of 2
+
+    struct Config {
+        int8_t z;
+        uint8_t pad[3];
+        uint32_t format;
+        uint32_t flags;
+        uint16_t srcW, srcH;
+        uint16_t crop[4];
+        uint16_t dst[4];
+    };
+
+    struct Record {
+        volatile int32_t seq; //index of the record, -1 while written
+        uint32_t frame;
+        uint8_t event;
+        int8_t dest;
+        int8_t dpy;
+        int8_t type;
+        Config cfg;
+    };
+
+    explicit OverlayTrace();
+    /* Starts the records of a new drawing round */
+    void newFrame() { mFrame++; }
+    /* Adds an event without pipe config */
+    void add(eEvent ev, int dest, int dpy, utils::eMdpPipeType type);
+    /* Adds an event with the pipe config */
+    void add(eEvent ev, int dest, int dpy, utils::eMdpPipeType type,
+            const utils::PipeArgs& args, const utils::Dim& crop,
+            const utils::Dim& dst);
+    /* Logs the records of the current frame */
+    void logFrame() const;
+    /* Decodes up to last "count" records into buf */
+    void getDump(char *buf, size_t len, int count) const;
+
+private:
+    Record* begin(eEvent ev, int dest, int dpy, utils::eMdpPipeType type);
+    void end(Record *rec);
+    /* Copies out the record at index, false if it was overwritten */
+    bool read(int32_t index, Record& rec) const;
+    static void decode(const Record& rec, char *str, size_t len);
+
+    Record mRecords[MAX_RECORDS];
+    //config of the last recorded commit per pipe, valid if its bit is set
+    Config mLastCommit[utils::OV_MAX];
+    uint32_t mLastCommitMask;
+    //index of the next record
+    volatile int32_t mHead;
+    uint32_t mFrame;
+};
+
+} // overlay
+
+#endif // OVERLAY_TRACE_H
@@ -33,6 +33,7 @@
 #include <linux/msm_mdp.h>
 #include <cutils/properties.h>
 #include "gralloc_priv.h"
+#include "format_info.h"
 #include "overlayUtils.h"
 #include "mdpWrapper.h"
 #include "mdp_version.h"
@@ -88,63 +89,20 @@ namespace utils {
 //--------------------------------------------------------
 //Refer to graphics.h, gralloc_priv.h, msm_mdp.h
 int getMdpFormat(int format) {
+#define MDP_FORMAT_CASE(fmt, name, bpp, planes, hsub, vsub, chroma,       \
+                        align, flags, mdp, c2d)                           \
+        case fmt: mdpFormat = mdp; break;
+    int mdpFormat = -1;
     switch (format) {
-        //From graphics.h
-        case HAL_PIXEL_FORMAT_RGBA_8888 :
-            return MDP_RGBA_8888;
-        case HAL_PIXEL_FORMAT_RGBX_8888:
-            return MDP_RGBX_8888;
-        case HAL_PIXEL_FORMAT_RGB_888:
-            return MDP_RGB_888;
-        case HAL_PIXEL_FORMAT_BGR_888:
-            return MDP_BGR_888;
-        case HAL_PIXEL_FORMAT_RGB_565:
-            return MDP_RGB_565;
-        case HAL_PIXEL_FORMAT_BGRA_8888:
-            return MDP_BGRA_8888;
-        case HAL_PIXEL_FORMAT_YV12:
-            return MDP_Y_CR_CB_GH2V2;
-        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
-            return MDP_Y_CBCR_H2V1;
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-            return MDP_Y_CRCB_H2V2;
-
-        //From gralloc_priv.h
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP_TILED:
-            return MDP_Y_CBCR_H2V2_TILE;
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
-            return MDP_Y_CBCR_H2V2;
-        case HAL_PIXEL_FORMAT_YCrCb_422_SP:
-            return MDP_Y_CRCB_H2V1;
-        case HAL_PIXEL_FORMAT_YCbCr_422_I:
-            return MDP_YCBYCR_H2V1;
-        case HAL_PIXEL_FORMAT_YCrCb_422_I:
-            return MDP_YCRYCB_H2V1;
-        case HAL_PIXEL_FORMAT_CbYCrY_422_I:
-            return MDP_CBYCRY_H2V1;
-        case HAL_PIXEL_FORMAT_CrYCbY_422_I:
-            return MDP_CRYCBY_H2V1;
-        case HAL_PIXEL_FORMAT_YCbCr_444_SP:
-            return MDP_Y_CBCR_H1V1;
-        case HAL_PIXEL_FORMAT_YCrCb_444_SP:
-            return MDP_Y_CRCB_H1V1;
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP_VENUS:
-            return MDP_Y_CBCR_H2V2_VENUS;
-        default:
-            //Unsupported by MDP
-            //---graphics.h--------
-            //HAL_PIXEL_FORMAT_RGBA_5551
-            //HAL_PIXEL_FORMAT_RGBA_4444
-            //HAL_PIXEL_FORMAT_YCbCr_422_I
-            //---gralloc_priv.h-----
-            //HAL_PIXEL_FORMAT_YCrCb_420_SP_ADRENO    = 0x7FA30C01
-            //HAL_PIXEL_FORMAT_R_8                    = 0x10D
-            //HAL_PIXEL_FORMAT_RG_88                  = 0x10E
-            ALOGE("%s: Unsupported HAL format = 0x%x", __func__, format);
-            return -1;
+        GRALLOC_FORMAT_TABLE(MDP_FORMAT_CASE)
+        default: break;
     }
-    // not reached
-    return -1;
+#undef MDP_FORMAT_CASE
+    if (mdpFormat == -1) {
+        //Unsupported by MDP, see the MDP column of the format table
+        ALOGE("%s: Unsupported HAL format = 0x%x", __func__, format);
+    }
+    return mdpFormat;
 }
 
 //Takes mdp format as input and translates to equivalent HAL format
@@ -240,6 +198,149 @@ int getDownscaleFactor(const int& src_w, const int& src_h,
     return dscale_factor;
 }
 
+//Bits per pixel of an MDP format, over all planes
+static uint32_t getBitsPerPixel(uint32_t mdpFormat) {
+    const format_info *info = getFormatInfo(getHALFormat(mdpFormat));
+    if(!info)
+        return 32;
+    uint32_t bits = info->bpp * 8;
+    if(info->planes > 1)
+        bits += (info->bpp * 16) >> (info->hsub + info->vsub);
+    return bits;
+}
+
+//MDP fetching this many source lines per output line or more in direct
+//mode can't keep up with the panel and the driver switches to BLT.
+//Expressed as a ratio of 3/2.
+#define DIRECT_MAX_VDS_NUM 3
+#define DIRECT_MAX_VDS_DEN 2
+//Cost of a lost source pixel relative to fetching it
+#define DS_QUALITY_WEIGHT 4
+
+DownscalePlan planDownscale(const DownscaleParams& p) {
+    DownscalePlan best;
+    uint64_t bestCost = 0;
+    bool found = false;
+    if(!p.srcW || !p.srcH || !p.dstW || !p.dstH)
+        return best;
+
+    const qdutils::MDPCaps& caps =
+            qdutils::MDPVersion::getInstance().getCaps();
+    const qdutils::MDPPipeCaps& vg = caps.pipe[qdutils::MDP_CAPS_PIPE_VG];
+    const uint64_t maxMdpDown = vg.maxDownscale << caps.maxDecimation;
+    const uint64_t bits = getBitsPerPixel(p.format);
+    const uint64_t fps = p.fps ? p.fps : 60;
+    const uint64_t srcArea = (uint64_t)p.srcW * p.srcH;
+    const uint64_t dstArea = (uint64_t)p.dstW * p.dstH;
+    //Writing the composed frame back and reading it again, RGB888
+    const uint64_t bltBytes = 2ULL * p.panelW * p.panelH * 3;
+    //The MDP clock and fetch limits behind the area based rule aren't
+    //modelled, it stays a floor. 1080p on a 720p panel needs HALF on 8960.
+    const int minDs = getDownscaleFactor(p.srcW, p.srcH, p.dstW, p.dstH);
+
+    for(int ds = minDs; ds <= ROT_DS_EIGHTH; ds++) {
+        uint64_t w = p.srcW >> ds, h = p.srcH >> ds;
+        if(!w || !h)
+            break;
+        //MDP has to do the rest of the downscale
+        if(w > p.dstW * maxMdpDown || h > p.dstH * maxMdpDown)
+            continue;
+
+        uint64_t area = w * h;
+        //MDP fetch, and the rotator read and write when it runs
+        uint64_t bytes = area * bits / 8;
+        if(ds != ROT_DS_NONE || p.rotRequired)
+            bytes += (srcArea + area) * bits / 8;
+        if(p.blt || h * DIRECT_MAX_VDS_DEN >= p.dstH * DIRECT_MAX_VDS_NUM)
+            bytes += bltBytes;
+        uint64_t bandwidth = bytes * fps;
+        //The rotator decimates, detail it drops below the displayed size
+        //is lost and weighs more than bandwidth
+        uint64_t lost = (area < dstArea) ? dstArea - area : 0;
+        uint64_t cost = bandwidth + lost * bits / 8 * fps * DS_QUALITY_WEIGHT;
+
+        if(!found || cost < bestCost) {
+            found = true;
+            bestCost = cost;
+            best.rotDownscale = ds;
+            best.bandwidth = (uint32_t)(bandwidth >> 20);
+        }
+    }
+
+    if(!found) {
+        //Too much downscale for MDP at any split, do the most we can
+        best.rotDownscale = ROT_DS_EIGHTH;
+    }
+    ALOGD_IF(DEBUG_OVERLAY, "%s: %dx%d -> %dx%d format %d ds %d bw %dMB/s",
+            __FUNCTION__, p.srcW, p.srcH, p.dstW, p.dstH, p.format,
+            best.rotDownscale, best.bandwidth);
+    return best;
+}
+
+static bool isSupportedByPipe(const qdutils::MDPCaps& caps, int type,
+        const PipeArgs& args, const Dim& crop, const Dim& dst) {
+    const qdutils::MDPPipeCaps& pipe = caps.pipe[type];
+    if(isYuv(args.whf.format) && !pipe.yuv) {
+        ALOGD_IF(DEBUG_OVERLAY, "%s: pipe %d can't fetch format %d",
+                __FUNCTION__, type, args.whf.format);
+        return false;
+    }
+    uint32_t maxDown = pipe.maxDownscale;
+    if(maxDown > 1)
+        maxDown <<= caps.maxDecimation;
+    if(crop.w > dst.w * maxDown || crop.h > dst.h * maxDown) {
+        ALOGD_IF(DEBUG_OVERLAY, "%s: pipe %d can't downscale %dx%d to %dx%d",
+                __FUNCTION__, type, crop.w, crop.h, dst.w, dst.h);
+        return false;
+    }
+    if(dst.w > crop.w * pipe.maxUpscale || dst.h > crop.h * pipe.maxUpscale) {
+        ALOGD_IF(DEBUG_OVERLAY, "%s: pipe %d can't upscale %dx%d to %dx%d",
+                __FUNCTION__, type, crop.w, crop.h, dst.w, dst.h);
+        return false;
+    }
+    return true;
+}
+
+bool isSupportedConfig(const eMdpPipeType& type, const PipeArgs& args,
+        const Dim& crop, const Dim& dst) {
+    qdutils::MDPVersion& mdpVersion = qdutils::MDPVersion::getInstance();
+    const qdutils::MDPCaps& caps = mdpVersion.getCaps();
+
+    if(!dst.w || !dst.h || crop.w < caps.minSrcW || crop.h < caps.minSrcH ||
+            crop.w > caps.maxSrcW || crop.h > caps.maxSrcH) {
+        ALOGD_IF(DEBUG_OVERLAY, "%s: src %dx%d crop %dx%d dst %dx%d out of "
+                "range", __FUNCTION__, args.whf.w, args.whf.h, crop.w, crop.h,
+                dst.w, dst.h);
+        return false;
+    }
+    if(dst.w > caps.maxMixerWidth) {
+        ALOGD_IF(DEBUG_OVERLAY, "%s: dst w %d wider than the mixer",
+                __FUNCTION__, dst.w);
+        return false;
+    }
+    if((args.rotFlags & ROT_PREROTATED) && caps.rotYuvOnly &&
+            !isYuv(args.whf.format)) {
+        ALOGD_IF(DEBUG_OVERLAY, "%s: rotator can't take format %d",
+                __FUNCTION__, args.whf.format);
+        return false;
+    }
+
+    if(type != OV_MDP_PIPE_ANY)
+        return isSupportedByPipe(caps, type, args, crop, dst);
+
+    //Any pipe present on this target will do, all when the counts are
+    //unknown
+    const int pipes[qdutils::MDP_CAPS_PIPE_MAX] = {
+            mdpVersion.getRGBPipes(), mdpVersion.getVGPipes(),
+            mdpVersion.getDMAPipes() };
+    bool any = (mdpVersion.getTotalPipes() == 0);
+    for(int i = 0; i < qdutils::MDP_CAPS_PIPE_MAX; i++) {
+        if((pipes[i] || any) && isSupportedByPipe(caps, i, args, crop, dst))
+            return true;
+    }
+    return false;
+}
+
 static inline int compute(const uint32_t& x, const uint32_t& y,
         const uint32_t& z) {
     return x - ( y + z );
@@ -242,6 +242,14 @@ enum eRotDownscale {
     ROT_DS_EIGHTH = 3,
 };
 
+/* Rotator downscale picked by planDownscale, with the bus bandwidth
+ * predicted for the layer, in MB/s */
+struct DownscalePlan {
+    DownscalePlan() : rotDownscale(ROT_DS_NONE), bandwidth(0) {}
+    int rotDownscale; //eRotDownscale
+    uint32_t bandwidth;
+};
+
 /* The values for is_fg flag for control alpha and transp
  * IS_FG_OFF means is_fg = 0
  * IS_FG_SET means is_fg = 1
@@ -375,6 +383,8 @@ struct PipeArgs {
     eRotFlags rotFlags;
     int planeAlpha;
     eBlending blending;
+    //Rotator downscale, used with ROT_DOWNSCALE_ENABLED
+    DownscalePlan dsPlan;
 };
 
 // Cannot use HW_OVERLAY_MAGNIFICATION_LIMIT, since at the time
@@ -410,6 +420,32 @@ int getHALFormat(int mdpFormat);
 int getDownscaleFactor(const int& src_w, const int& src_h,
         const int& dst_w, const int& dst_h);
 
+/* What planDownscale needs to know about a layer and its display */
+struct DownscaleParams {
+    DownscaleParams() : srcW(0), srcH(0), dstW(0), dstH(0), format(0),
+            fps(60), panelW(0), panelH(0), blt(false), rotRequired(false) {}
+    uint32_t srcW, srcH; //crop
+    uint32_t dstW, dstH;
+    uint32_t format; //MDP format
+    uint32_t fps;
+    uint32_t panelW, panelH;
+    //MDP composes through writeback rather than straight to the panel
+    bool blt;
+    //The rotator runs for this layer even without a downscale
+    bool rotRequired;
+};
+
+/* Splits a downscale between the rotator and MDP, picking the rotator
+ * downscale with the lowest estimated bus bandwidth plus quality cost.
+ * Never less than getDownscaleFactor picks. */
+DownscalePlan planDownscale(const DownscaleParams& p);
+/* Checks a configuration of a pipe of the given type, or of any pipe,
+ * against the capability model of the MDP. Crop and dst are what the pipe
+ * gets, after any pre-rotation. Configurations failing this would fail
+ * MSMFB_OVERLAY_SET. */
+bool isSupportedConfig(const eMdpPipeType& type, const PipeArgs& args,
+        const Dim& crop, const Dim& dst);
+
 /* flip is upside down and such. V, H flip
  * rotation is 90, 180 etc
  * It returns MDP related enum/define that match rot+flip*/
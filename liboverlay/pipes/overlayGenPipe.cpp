@@ -46,6 +46,7 @@ bool GenericPipe::init()
 {
     ALOGE_IF(DEBUG_OVERLAY, "GenericPipe init");
     mRotDownscaleOpt = false;
+    mArgs = utils::PipeArgs();
 
     int fbNum = Overlay::getFbForDpy(mDpy);
     if( fbNum < 0 ) {
@@ -87,6 +88,7 @@ bool GenericPipe::close() {
 
 void GenericPipe::setSource(const utils::PipeArgs& args) {
     mRotDownscaleOpt = args.rotFlags & utils::ROT_DOWNSCALE_ENABLED;
+    mArgs = args;
     mCtrlData.ctrl.setSource(args);
 }
 
@@ -107,19 +109,17 @@ bool GenericPipe::setVisualParams(const MetaData_t &metadata)
         return mCtrlData.ctrl.setVisualParams(metadata);
 }
 
-bool GenericPipe::commit() {
+bool GenericPipe::commit(MdpBatch *batch) {
     bool ret = false;
     int downscale_factor = utils::ROT_DS_NONE;
 
+    //The rotator was set up with the same plan, MDP takes the rest
     if(mRotDownscaleOpt) {
-        ovutils::Dim src(mCtrlData.ctrl.getCrop());
-        ovutils::Dim dst(mCtrlData.ctrl.getPosition());
-        downscale_factor = ovutils::getDownscaleFactor(
-                src.w, src.h, dst.w, dst.h);
+        downscale_factor = mArgs.dsPlan.rotDownscale;
     }
 
     mCtrlData.ctrl.setDownscale(downscale_factor);
-    ret = mCtrlData.ctrl.commit();
+    ret = mCtrlData.ctrl.commit(batch);
 
     pipeState = ret ? OPEN : CLOSED;
     return ret;
@@ -140,11 +140,21 @@ int GenericPipe::getCtrlFd() const {
     return mCtrlData.ctrl.getFd();
 }
 
+const utils::PipeArgs& GenericPipe::getArgs() const
+{
+    return mArgs;
+}
+
 utils::Dim GenericPipe::getCrop() const
 {
     return mCtrlData.ctrl.getCrop();
 }
 
+utils::Dim GenericPipe::getPosition() const
+{
+    return mCtrlData.ctrl.getPosition();
+}
+
 void GenericPipe::dump() const
 {
     ALOGE("== Dump Generic pipe start ==");
@@ -158,6 +168,12 @@ void GenericPipe::dump() const
 void GenericPipe::getDump(char *buf, size_t len) {
     mCtrlData.ctrl.getDump(buf, len);
     mCtrlData.data.getDump(buf, len);
+    if(mRotDownscaleOpt) {
+        char str[64] = {'\0'};
+        snprintf(str, 64, "RotDownscale: ds=%d bw=%uMB/s\n",
+                mArgs.dsPlan.rotDownscale, mArgs.dsPlan.bandwidth);
+        strlcat(buf, str, len);
+    }
 }
 
 bool GenericPipe::isClosed() const  {
@@ -54,8 +54,8 @@ public:
     void setPosition(const utils::Dim& dim);
     /* set visual param */
     bool setVisualParams(const MetaData_t &metadata);
-    /* commit changes to the overlay "set"*/
-    bool commit();
+    /* commit changes to the overlay "set", deferred if batch is open */
+    bool commit(MdpBatch *batch = NULL);
     /* Data APIs */
     /* queue buffer to the overlay */
     bool queueBuffer(int fd, uint32_t offset);
@@ -63,6 +63,8 @@ public:
     const utils::PipeArgs& getArgs() const;
     /* retrieve cached crop data */
     utils::Dim getCrop() const;
+    /* retrieve cached destination rect */
+    utils::Dim getPosition() const;
     /* is closed */
     bool isClosed() const;
     /* is open */
@@ -88,6 +90,8 @@ private:
     //Whether we will do downscale opt. This is just a request. If the frame is
     //not a candidate, we might not do it.
     bool mRotDownscaleOpt;
+    //Last source args, including the planned rotator downscale
+    utils::PipeArgs mArgs;
     /* Pipe open or closed */
     enum ePipeState {
         CLOSED,
@@ -36,6 +36,33 @@
 ANDROID_SINGLETON_STATIC_INSTANCE(qdutils::MDPVersion);
 namespace qdutils {
 
+//Capabilities by MDP revision, each entry applies from its version up to
+//the next one. Unknown targets are treated like MDP4.
+static const struct {
+    int version;
+    MDPCaps caps;
+} sCapsTable[] = {
+    //pipe {down, up, yuv} RGB, VG, DMA, decimation, min src, max src,
+    //mixer width, rotator YUV only
+    { MDP_V_UNKNOWN,
+        { { {8, 8, false}, {8, 8, true}, {1, 1, false} },
+          0, 2, 2, 2048, 2048, 2048, true } },
+    { MDP_V3_0,
+        { { {1, 1, false}, {1, 1, false}, {1, 1, false} },
+          0, 2, 2, 2048, 2048, 2048, true } },
+    { MDP_V4_0,
+        { { {8, 8, false}, {8, 8, true}, {1, 1, false} },
+          0, 2, 2, 2048, 2048, 2048, true } },
+    //8960 and later MDP4 revisions upscale up to 20x
+    { MDP_V4_1,
+        { { {8, 20, false}, {8, 20, true}, {1, 1, false} },
+          0, 2, 2, 2048, 2048, 2048, true } },
+    //Decimation isn't enabled for MDSS yet, downscale is limited to 4x
+    { MDSS_V5,
+        { { {4, 20, false}, {4, 20, true}, {1, 1, false} },
+          0, 2, 2, 0x3FFF, 0x3FFF, 2048, true } },
+};
+
 MDPVersion::MDPVersion()
 {
     int fb_fd = open("/dev/graphics/fb0", O_RDWR);
@@ -102,6 +129,14 @@ MDPVersion::MDPVersion()
     if((mMDPVersion >= MDP_V4_0) || (mMDPVersion == MDP_V_UNKNOWN))
         mHasOverlay = true;
     mPanelType = panel_type;
+
+    int caps = 0;
+    for(int i = 0; i < (int)(sizeof(sCapsTable) / sizeof(sCapsTable[0]));
+            i++) {
+        if(sCapsTable[i].version <= mMDPVersion)
+            caps = i;
+    }
+    mCaps = sCapsTable[caps].caps;
 }
 
 bool MDPVersion::is8x26() {
@@ -69,6 +69,35 @@ enum mdp_rev {
 #define WRITEBACK_PANEL  'a'
 #define LVDS_PANEL       'b'
 
+/* Limits of one type of MDP pipe. Scale limits are ratios, 1 when the
+ * pipe can't scale. */
+struct MDPPipeCaps {
+    uint8_t maxDownscale;
+    uint8_t maxUpscale;
+    bool yuv; //Can fetch YUV formats
+};
+
+//Pipe types, same order as overlay::utils::eMdpPipeType
+enum { MDP_CAPS_PIPE_RGB, MDP_CAPS_PIPE_VG, MDP_CAPS_PIPE_DMA,
+        MDP_CAPS_PIPE_MAX };
+
+/* What the MDP of a revision can be configured for. Configurations outside
+ * these limits are rejected by the driver at MSMFB_OVERLAY_SET. */
+struct MDPCaps {
+    MDPPipeCaps pipe[MDP_CAPS_PIPE_MAX];
+    //Source decimation on top of the pipe downscale, as a power of 2
+    uint8_t maxDecimation;
+    uint16_t minSrcW;
+    uint16_t minSrcH;
+    //Largest source crop a pipe fetches
+    uint16_t maxSrcW;
+    uint16_t maxSrcH;
+    //Widest output of one layer mixer
+    uint16_t maxMixerWidth;
+    //The rotator takes only YUV sources
+    bool rotYuvOnly;
+};
+
 
 class MDPVersion : public Singleton <MDPVersion>
 {
@@ -83,6 +112,7 @@ public:
     uint8_t getVGPipes() { return mVGPipes; }
     uint8_t getDMAPipes() { return mDMAPipes; }
     bool is8x26();
+    const MDPCaps& getCaps() { return mCaps; }
 private:
     int mMDPVersion;
     char mPanelType;
@@ -91,6 +121,7 @@ private:
     uint8_t mRGBPipes;
     uint8_t mVGPipes;
     uint8_t mDMAPipes;
+    MDPCaps mCaps;
 };
 }; //namespace qdutils
 #endif //INCLUDE_LIBQCOMUTILS_MDPVER
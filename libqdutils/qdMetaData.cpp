@@ -39,7 +39,13 @@ int setMetaData(private_handle_t *handle, DispParamType paramType,
         ALOGE("%s: Private handle is null!", __func__);
         return -1;
     }
-    if (handle->fd_metadata == -1) {
+    int fd = handle->fd_metadata;
+    int offset = 0;
+    if (handle->flags & private_handle_t::PRIV_FLAGS_METADATA_COLOCATED) {
+        fd = handle->fd;
+        offset = handle->offset_metadata;
+    }
+    if (fd == -1) {
         ALOGE("%s: Bad fd for extra data!", __func__);
         return -1;
     }
@@ -49,7 +55,7 @@ int setMetaData(private_handle_t *handle, DispParamType paramType,
     }
     unsigned long size = ROUND_UP_PAGESIZE(sizeof(MetaData_t));
     void *base = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED,
-        handle->fd_metadata, 0);
+        fd, offset);
     if (!base) {
         ALOGE("%s: mmap() failed: Base addr is NULL!", __func__);
         return -1;
@@ -71,6 +77,7 @@ int setMetaData(private_handle_t *handle, DispParamType paramType,
             break;
         case PP_PARAM_IGC:
             memcpy((void *)&data->igcData, param, sizeof(IGCData_t));
+            data->igcHash = getIgcHash(&data->igcData);
             break;
         case PP_PARAM_SHARP2:
             memcpy((void *)&data->Sharp2Data, param, sizeof(Sharp2Data_t));
@@ -87,3 +94,14 @@ int setMetaData(private_handle_t *handle, DispParamType paramType,
                                                                         errno);
     return 0;
 }
+
+uint32_t getIgcHash(const IGCData_t *igc) {
+    //FNV-1a
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(igc);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(IGCData_t); i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash ? hash : 1;
+}
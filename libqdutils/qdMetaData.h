@@ -66,6 +66,8 @@ struct MetaData_t {
     int32_t video_interface;
     IGCData_t igcData;
     Sharp2Data_t Sharp2Data;
+    /* Hash of igcData written by setMetaData, 0 if not computed */
+    uint32_t igcHash;
 };
 
 typedef enum {
@@ -80,5 +82,8 @@ typedef enum {
 
 int setMetaData(private_handle_t *handle, DispParamType paramType, void *param);
 
+/* Content hash of an IGC LUT, never 0 */
+uint32_t getIgcHash(const IGCData_t *igc);
+
 #endif /* _QDMETADATA_H */
 